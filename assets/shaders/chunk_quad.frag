@@ -5,6 +5,8 @@
 #pragma variant[1] WORLD_FOG
 
 in vec3 vs_TexCoord;
+in vec3 vs_VoxelPosition;
+flat in uint vs_Variants;
 in float vs_Shade;
 
 #if WORLD_FOG
@@ -14,11 +16,28 @@ in float vs_FogFactor;
 out vec4 frag_Target;
 
 uniform vec4 u_FogColor;
+uniform uvec3 u_ChunkCoord;
 uniform sampler2DArray u_Textures;
 
+// A cheap integer hash; voxels only need to
+// look different from their neighbours
+uint hash_voxel(uvec3 vpos)
+{
+    uint hash = (vpos.x * 0x8DA6B343U) ^ (vpos.y * 0xD8163841U) ^ (vpos.z * 0xCB1AB31FU);
+    hash ^= hash >> 16U;
+    hash *= 0x7FEB352DU;
+    hash ^= hash >> 15U;
+    return hash;
+}
+
 void main(void)
 {
-    frag_Target = vs_Shade * texture(u_Textures, vs_TexCoord);
+    // Quads span many voxels; every one of them
+    // picks a texture variant of its own
+    uvec3 voxel = uvec3(ivec3(floor(vs_VoxelPosition))) + u_ChunkCoord * 16U;
+    float variant = float(hash_voxel(voxel) % vs_Variants);
+
+    frag_Target = vs_Shade * texture(u_Textures, vec3(vs_TexCoord.xy, vs_TexCoord.z + variant));
 
 #if WORLD_FOG
     frag_Target = mix(frag_Target, u_FogColor, vs_FogFactor);
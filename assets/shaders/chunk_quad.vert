@@ -8,6 +8,8 @@ layout(location = 0) in vec3 vert_Position;
 layout(location = 1) in uvec2 vert_Quad;
 
 out vec3 vs_TexCoord;
+out vec3 vs_VoxelPosition;
+flat out uint vs_Variants;
 out float vs_Shade;
 
 #if WORLD_FOG
@@ -27,32 +29,46 @@ void main(void)
     quad_offset.z = float(0x00FFU & (vert_Quad.x >> 8U))  / 16.0;
 
     vec2 quad_scale;
-    quad_scale.x = float((0x000FU & (vert_Quad.x >> 4U)) + 1U) / 16.0;
-    quad_scale.y = float((0x000FU & (vert_Quad.x >> 0U)) + 1U) / 16.0;
+    quad_scale.x = float((0x000FU & (vert_Quad.x >> 4U)) + 1U);
+    quad_scale.y = float((0x000FU & (vert_Quad.x >> 0U)) + 1U);
 
     uint quad_facing = (0x000FU & (vert_Quad.y >> 28U));
     uint quad_toffset = (0x07FFU & (vert_Quad.y >> 17));
     uint quad_tframes = max(1U, (0x001FU & (vert_Quad.y >> 12)));
+    uint quad_tvariants = max(1U, (0x001FU & (vert_Quad.y >> 7)));
 
     gl_Position.xyz = vert_Position;
     gl_Position.x *= quad_scale.x;
     gl_Position.z *= quad_scale.y;
 
     vec3 positions[6]; // FIXME: 16
-    positions[0x00U] = vec3(gl_Position.x, 1.0 - gl_Position.z, 1.0);
+    positions[0x00U] = vec3(gl_Position.x, quad_scale.y - gl_Position.z, 1.0);
     positions[0x01U] = vec3(gl_Position.x, gl_Position.z, 0.0);
-    positions[0x02U] = vec3(1.0, 1.0 - gl_Position.x, gl_Position.z);
+    positions[0x02U] = vec3(1.0, quad_scale.x - gl_Position.x, gl_Position.z);
     positions[0x03U] = vec3(0.0, gl_Position.x, gl_Position.z);
     positions[0x04U] = vec3(gl_Position.x, 1.0, gl_Position.z);
-    positions[0x05U] = vec3(gl_Position.x, 0.0, 1.0 - gl_Position.z);
+    positions[0x05U] = vec3(gl_Position.x, 0.0, quad_scale.y - gl_Position.z);
 
+    // Texture coordinates are scaled along with the
+    // quad, so a texture repeats once every voxel just
+    // like it would if every face was a quad of its own
     vec2 texcoords[6]; // FIXME: 16
-    texcoords[0x00U] = vec2(vert_Position.x, 1.0 - vert_Position.z);
-    texcoords[0x01U] = vec2(1.0 - vert_Position.x, vert_Position.z);
-    texcoords[0x02U] = vec2(-vert_Position.z, 1.0 - vert_Position.x);
-    texcoords[0x03U] = vec2(1.0 + vert_Position.z, vert_Position.x);
-    texcoords[0x04U] = vec2(1.0 - vert_Position.x, vert_Position.z);
-    texcoords[0x05U] = vec2(1.0 - vert_Position.x, vert_Position.z);
+    texcoords[0x00U] = vec2(gl_Position.x, quad_scale.y - gl_Position.z);
+    texcoords[0x01U] = vec2(quad_scale.x - gl_Position.x, gl_Position.z);
+    texcoords[0x02U] = vec2(-gl_Position.z, quad_scale.x - gl_Position.x);
+    texcoords[0x03U] = vec2(1.0 + gl_Position.z, gl_Position.x);
+    texcoords[0x04U] = vec2(quad_scale.x - gl_Position.x, gl_Position.z);
+    texcoords[0x05U] = vec2(quad_scale.x - gl_Position.x, gl_Position.z);
+
+    // Pointing into the voxel the face belongs
+    // to, half a voxel away from the face itself
+    vec3 insides[6]; // FIXME: 16
+    insides[0x00U] = vec3(0.0, 0.0, -0.5);
+    insides[0x01U] = vec3(0.0, 0.0, 0.5);
+    insides[0x02U] = vec3(-0.5, 0.0, 0.0);
+    insides[0x03U] = vec3(0.5, 0.0, 0.0);
+    insides[0x04U] = vec3(0.0, -0.5, 0.0);
+    insides[0x05U] = vec3(0.0, 0.5, 0.0);
 
     float shades[6]; // FIXME: 16
     shades[0x00U] = 0.8;
@@ -64,6 +80,8 @@ void main(void)
 
     vs_TexCoord.xy = texcoords[quad_facing];
     vs_TexCoord.z = floor(float(quad_toffset + u_Timings.z % quad_tframes) + 0.5);
+    vs_VoxelPosition = positions[quad_facing] + quad_offset + insides[quad_facing];
+    vs_Variants = quad_tvariants;
     vs_Shade = shades[quad_facing];
 
     gl_Position.w = 1.0;
@@ -3,6 +3,12 @@
 #include <chrono>
 #include <common/epoch.hh>
 
+std::uint64_t epoch::nanoseconds(void)
+{
+    const auto tv = std::chrono::high_resolution_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(tv).count());
+}
+
 std::uint64_t epoch::microseconds(void)
 {
     const auto tv = std::chrono::high_resolution_clock::now().time_since_epoch();
@@ -20,3 +26,15 @@ std::uint64_t epoch::seconds(void)
     const auto tv = std::chrono::high_resolution_clock::now().time_since_epoch();
     return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(tv).count());
 }
+
+std::uint64_t epoch::monotonic_nanoseconds(void)
+{
+    const auto tv = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(tv).count());
+}
+
+std::uint64_t epoch::monotonic_microseconds(void)
+{
+    const auto tv = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(tv).count());
+}
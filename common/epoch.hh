@@ -5,7 +5,17 @@
 
 namespace epoch
 {
+std::uint64_t nanoseconds(void);
 std::uint64_t microseconds(void);
 std::uint64_t milliseconds(void);
 std::uint64_t seconds(void);
 } // namespace epoch
+
+namespace epoch
+{
+// Unlike the wall clock these never step back
+// or jump; their zero point is unspecified and
+// they are only good for measuring intervals
+std::uint64_t monotonic_nanoseconds(void);
+std::uint64_t monotonic_microseconds(void);
+} // namespace epoch
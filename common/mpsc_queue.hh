@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <atomic>
+#include <utility>
+
+// Unbounded multiple-producer single-consumer queue;
+// pushing is lock-free and popping is wait-free as long
+// as there is exactly one thread that pops elements. Based
+// on the intrusive node queue described by Dmitry Vyukov
+template<typename T>
+class MPSCQueue final {
+public:
+    MPSCQueue(void);
+    MPSCQueue(const MPSCQueue<T> &other) = delete;
+    MPSCQueue<T> &operator=(const MPSCQueue<T> &other) = delete;
+    virtual ~MPSCQueue(void);
+
+public:
+    void push(T &&value);
+    void push(const T &value);
+    bool pop(T &value);
+
+private:
+    struct Node final {
+        std::atomic<Node *> next {nullptr};
+        T value {};
+    };
+
+private:
+    void push_node(Node *node);
+
+private:
+    std::atomic<Node *> head;
+    Node *tail;
+};
+
+template<typename T>
+inline MPSCQueue<T>::MPSCQueue(void)
+{
+    // The queue always has a node the tail points to,
+    // which makes it possible to push without ever touching
+    // the consumer side of the queue from the producer threads
+    Node *stub = new Node();
+    head.store(stub, std::memory_order_relaxed);
+    tail = stub;
+}
+
+template<typename T>
+inline MPSCQueue<T>::~MPSCQueue(void)
+{
+    while(tail) {
+        Node *next = tail->next.load(std::memory_order_relaxed);
+        delete tail;
+        tail = next;
+    }
+}
+
+template<typename T>
+inline void MPSCQueue<T>::push(T &&value)
+{
+    Node *node = new Node();
+    node->value = std::move(value);
+    push_node(node);
+}
+
+template<typename T>
+inline void MPSCQueue<T>::push(const T &value)
+{
+    Node *node = new Node();
+    node->value = value;
+    push_node(node);
+}
+
+template<typename T>
+inline bool MPSCQueue<T>::pop(T &value)
+{
+    Node *next = tail->next.load(std::memory_order_acquire);
+
+    if(next) {
+        // The next node becomes the new stub; its value
+        // is moved out and is never going to be looked at again
+        value = std::move(next->value);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    return false;
+}
+
+template<typename T>
+inline void MPSCQueue<T>::push_node(Node *node)
+{
+    Node *prev = head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
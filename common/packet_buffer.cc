@@ -93,18 +93,65 @@ std::uint64_t PacketBuffer::read_UI64(PacketBuffer &buffer)
 
 std::string PacketBuffer::read_string(PacketBuffer &buffer)
 {
-    std::size_t size = PacketBuffer::read_UI16(buffer);
+    const std::uint64_t size = PacketBuffer::read_VUI64(buffer);
     std::string result = std::string();
 
-    for(std::size_t i = 0; i < size; ++i) {
-        if(buffer.read_position < buffer.vector.size())
-            result.push_back(buffer.vector[buffer.read_position]);
-        buffer.read_position += 1U;
+    if(buffer.read_position < buffer.vector.size()) {
+        // The size comes from the wire; never trust it
+        const std::size_t avail = buffer.vector.size() - buffer.read_position;
+        const std::size_t count = static_cast<std::size_t>(cxpr::min<std::uint64_t>(avail, size));
+        result.assign(buffer.vector.cbegin() + buffer.read_position, buffer.vector.cbegin() + buffer.read_position + count);
     }
 
+    buffer.read_position += static_cast<std::size_t>(cxpr::min<std::uint64_t>(size, UINT32_MAX));
     return std::move(result);
 }
 
+std::uint64_t PacketBuffer::read_VUI64(PacketBuffer &buffer)
+{
+    std::uint64_t result = UINT64_C(0);
+
+    for(unsigned int shift = 0U; shift < 64U; shift += 7U) {
+        const std::uint8_t value = PacketBuffer::read_UI8(buffer);
+        result |= static_cast<std::uint64_t>(value & UINT8_C(0x7F)) << shift;
+
+        if(!(value & UINT8_C(0x80))) {
+            // That was the last byte
+            break;
+        }
+    }
+
+    return result;
+}
+
+std::int64_t PacketBuffer::read_VI64(PacketBuffer &buffer)
+{
+    const std::uint64_t value = PacketBuffer::read_VUI64(buffer);
+    return static_cast<std::int64_t>((value >> 1U) ^ (~(value & UINT64_C(1)) + UINT64_C(1)));
+}
+
+std::uint32_t PacketBuffer::read_bits(PacketBuffer &buffer, unsigned int count)
+{
+    std::uint32_t result = UINT32_C(0);
+
+    for(unsigned int i = 0U; i < count; ++i) {
+        if(!buffer.read_bits_left || ((buffer.read_bits_byte + 1U) != buffer.read_position)) {
+            buffer.read_bits_byte = buffer.read_position;
+            buffer.read_bits_left = 8U;
+            buffer.read_position += 1U;
+        }
+
+        buffer.read_bits_left -= 1U;
+        result <<= 1U;
+
+        if(buffer.read_bits_byte < buffer.vector.size()) {
+            result |= (buffer.vector[buffer.read_bits_byte] >> buffer.read_bits_left) & 1U;
+        }
+    }
+
+    return result;
+}
+
 void PacketBuffer::write_FP32(PacketBuffer &buffer, float value)
 {
     PacketBuffer::write_UI32(buffer, floathacks::float_to_uint32(value));
@@ -164,19 +211,56 @@ void PacketBuffer::write_UI64(PacketBuffer &buffer, std::uint64_t value)
 void PacketBuffer::write_string(PacketBuffer &buffer, const std::string &value)
 {
     const std::size_t size = cxpr::min<std::size_t>(UINT16_MAX, value.size());
-    PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(size));
-    for(std::size_t i = 0; i < size; PacketBuffer::write_UI8(buffer, value[i++]));
+    PacketBuffer::write_VUI64(buffer, static_cast<std::uint64_t>(size));
+    buffer.vector.insert(buffer.vector.end(), value.cbegin(), value.cbegin() + size);
+}
+
+void PacketBuffer::write_VUI64(PacketBuffer &buffer, std::uint64_t value)
+{
+    while(value >= UINT64_C(0x80)) {
+        buffer.vector.push_back(static_cast<std::uint8_t>((value & UINT64_C(0x7F)) | UINT64_C(0x80)));
+        value >>= 7U;
+    }
+
+    buffer.vector.push_back(static_cast<std::uint8_t>(value));
+}
+
+void PacketBuffer::write_VI64(PacketBuffer &buffer, std::int64_t value)
+{
+    const std::uint64_t uvalue = static_cast<std::uint64_t>(value);
+    PacketBuffer::write_VUI64(buffer, (uvalue << 1U) ^ (value < 0 ? UINT64_MAX : UINT64_C(0)));
+}
+
+void PacketBuffer::write_bits(PacketBuffer &buffer, std::uint32_t value, unsigned int count)
+{
+    for(unsigned int i = count; i-- > 0U;) {
+        if(!buffer.write_bits_free || ((buffer.write_bits_byte + 1U) != buffer.vector.size())) {
+            buffer.write_bits_byte = buffer.vector.size();
+            buffer.write_bits_free = 8U;
+            buffer.vector.push_back(UINT8_C(0x00));
+        }
+
+        buffer.write_bits_free -= 1U;
+
+        if((value >> i) & 1U) {
+            buffer.vector[buffer.write_bits_byte] |= static_cast<std::uint8_t>(1U << buffer.write_bits_free);
+        }
+    }
 }
 
 void PacketBuffer::setup(PacketBuffer &buffer)
 {
     buffer.read_position = 0;
+    buffer.read_bits_left = 0U;
+    buffer.write_bits_free = 0U;
     buffer.vector.clear();
 }
 
 void PacketBuffer::setup(PacketBuffer &buffer, const void *data, std::size_t size)
 {
     buffer.read_position = 0;
+    buffer.read_bits_left = 0U;
+    buffer.write_bits_free = 0U;
     const std::uint8_t *data_p = reinterpret_cast<const std::uint8_t *>(data);
     buffer.vector.assign(data_p, data_p + size);
 }
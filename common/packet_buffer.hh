@@ -8,6 +8,14 @@
 struct PacketBuffer final {
     std::size_t read_position {};
     std::vector<std::uint8_t> vector {};
+
+    // Bit-level access state; bits are packed into
+    // bytes MSB-first and any byte-level access that happens
+    // in between makes the next bit start in a fresh byte
+    std::size_t read_bits_byte {};
+    std::size_t write_bits_byte {};
+    unsigned int read_bits_left {};
+    unsigned int write_bits_free {};
     
 public:
     static float read_FP32(PacketBuffer &buffer);
@@ -20,6 +28,13 @@ public:
     static std::uint32_t read_UI32(PacketBuffer &buffer);
     static std::uint64_t read_UI64(PacketBuffer &buffer);
     static std::string read_string(PacketBuffer &buffer);
+
+public:
+    // Variable-length integers; unsigned values are
+    // LEB128-encoded, signed values are zig-zag encoded first
+    static std::uint64_t read_VUI64(PacketBuffer &buffer);
+    static std::int64_t read_VI64(PacketBuffer &buffer);
+    static std::uint32_t read_bits(PacketBuffer &buffer, unsigned int count);
     
 public:
     static void write_FP32(PacketBuffer &buffer, float value);
@@ -33,6 +48,11 @@ public:
     static void write_UI64(PacketBuffer &buffer, std::uint64_t value);
     static void write_string(PacketBuffer &buffer, const std::string &value);
 
+public:
+    static void write_VUI64(PacketBuffer &buffer, std::uint64_t value);
+    static void write_VI64(PacketBuffer &buffer, std::int64_t value);
+    static void write_bits(PacketBuffer &buffer, std::uint32_t value, unsigned int count);
+
 public:
     static void setup(PacketBuffer &buffer);
     static void setup(PacketBuffer &buffer, const void *data, std::size_t size);
@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <common/epoch.hh>
+#include <common/fstools.hh>
+#include <common/profiler.hh>
+#include <memory>
+#include <mutex>
+#include <physfs.h>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+// Zones each thread remembers; a server tick
+// produces a few dozen of them at most, so this
+// covers a minute or so of a busy thread
+constexpr static std::size_t RING_SIZE = 65536;
+// Zones nested deeper than this are
+// left out of the tracked zone stack
+constexpr static std::size_t MAX_DEPTH = 32;
+
+struct ZoneEvent final {
+    const char *name {};
+    std::uint64_t start {};
+    std::uint64_t duration {};
+};
+
+struct ThreadBuffer final {
+    std::mutex mutex {};
+    std::uint32_t thread_id {};
+    std::string name {};
+    std::vector<ZoneEvent> events {};
+    std::size_t next {};
+    std::size_t size {};
+
+    // Written by the owning thread only
+    std::array<std::atomic<const char *>, MAX_DEPTH> stack {};
+    std::atomic<std::size_t> depth {};
+};
+
+// Zones are recorded when any of these is set
+constexpr static unsigned int RECORD_SESSION = 0x0001U;
+constexpr static unsigned int RECORD_BACKGROUND = 0x0002U;
+
+static std::atomic<unsigned int> is_active = {};
+static std::atomic<bool> is_tracking = {};
+static std::atomic<std::uint32_t> next_thread_id = {};
+
+// Buffers outlive their threads; there are only
+// ever as many of them as there were threads profiled
+static std::mutex buffers_mutex = {};
+static std::vector<std::shared_ptr<ThreadBuffer>> buffers = {};
+
+static thread_local std::shared_ptr<ThreadBuffer> local_buffer = nullptr;
+
+static ThreadBuffer *get_local_buffer(void)
+{
+    if(!local_buffer) {
+        local_buffer = std::make_shared<ThreadBuffer>();
+        local_buffer->thread_id = next_thread_id.fetch_add(1U, std::memory_order_relaxed);
+        local_buffer->name = fmt::format("thread {}", local_buffer->thread_id);
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        buffers.push_back(local_buffer);
+    }
+
+    return local_buffer.get();
+}
+
+static void push_event(const ZoneEvent &event)
+{
+    ThreadBuffer *buffer = get_local_buffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+
+    if(buffer->events.empty()) {
+        // Threads that never get to record
+        // anything don't take up any memory
+        buffer->events.resize(RING_SIZE);
+    }
+
+    buffer->events[buffer->next] = event;
+    buffer->next = (buffer->next + 1) % RING_SIZE;
+    buffer->size = std::min(buffer->size + 1, RING_SIZE);
+}
+
+static std::string escape(const std::string &str)
+{
+    std::string result = {};
+
+    for(const char character : str) {
+        if((character == '"') || (character == '\\'))
+            result.push_back('\\');
+        if(static_cast<unsigned char>(character) >= 0x20)
+            result.push_back(character);
+    }
+
+    return result;
+}
+
+void profiler::enable(void)
+{
+    is_active.fetch_or(RECORD_SESSION, std::memory_order_relaxed);
+}
+
+void profiler::disable(void)
+{
+    is_active.fetch_and(~RECORD_SESSION, std::memory_order_relaxed);
+}
+
+bool profiler::is_enabled(void)
+{
+    return is_active.load(std::memory_order_relaxed) & RECORD_SESSION;
+}
+
+void profiler::enable_background(void)
+{
+    is_active.fetch_or(RECORD_BACKGROUND, std::memory_order_relaxed);
+}
+
+void profiler::disable_background(void)
+{
+    is_active.fetch_and(~RECORD_BACKGROUND, std::memory_order_relaxed);
+}
+
+bool profiler::dump(const std::string &path)
+{
+    return profiler::dump(path, UINT64_C(0), UINT64_MAX);
+}
+
+bool profiler::dump(const std::string &path, std::uint64_t since_ns)
+{
+    return profiler::dump(path, since_ns, UINT64_MAX);
+}
+
+bool profiler::dump(const std::string &path, std::uint64_t since_ns, std::uint64_t until_ns)
+{
+    PHYSFS_File *file = PHYSFS_openWrite(path.c_str());
+
+    if(!file) {
+        spdlog::warn("profiler: {}: {}", path, fstools::error());
+        return false;
+    }
+
+    std::vector<std::shared_ptr<ThreadBuffer>> dumped = {};
+
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        dumped = buffers;
+    }
+
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    std::size_t num_events = 0;
+    bool is_first = true;
+
+    for(const std::shared_ptr<ThreadBuffer> &buffer : dumped) {
+        std::lock_guard<std::mutex> lock(buffer->mutex);
+
+        if(!is_first)
+            json.push_back(',');
+        json.append(fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", buffer->thread_id, escape(buffer->name)));
+        is_first = false;
+
+        for(std::size_t i = 0; i < buffer->size; ++i) {
+            // Oldest event first
+            const ZoneEvent &event = buffer->events[(buffer->next + RING_SIZE - buffer->size + i) % RING_SIZE];
+
+            if((event.start + event.duration < since_ns) || (event.start > until_ns)) {
+                // Entirely outside
+                // of the time window
+                continue;
+            }
+
+            json.append(fmt::format(",{{\"name\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}", escape(event.name),
+                buffer->thread_id, static_cast<double>(event.start) / 1000.0, static_cast<double>(event.duration) / 1000.0));
+            num_events += 1;
+        }
+
+        if(json.size() >= 65536) {
+            PHYSFS_writeBytes(file, json.data(), json.size());
+            json.clear();
+        }
+    }
+
+    json.append("]}\n");
+    PHYSFS_writeBytes(file, json.data(), json.size());
+    PHYSFS_close(file);
+
+    spdlog::info("profiler: wrote {} zones from {} threads to {}", num_events, dumped.size(), path);
+
+    return true;
+}
+
+void profiler::clear(void)
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+
+    for(const std::shared_ptr<ThreadBuffer> &buffer : buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        buffer->next = 0;
+        buffer->size = 0;
+    }
+}
+
+void profiler::set_thread_name(const std::string &name)
+{
+    ThreadBuffer *buffer = get_local_buffer();
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->name = name;
+}
+
+void profiler::enable_tracking(void)
+{
+    is_tracking.store(true, std::memory_order_relaxed);
+}
+
+void profiler::disable_tracking(void)
+{
+    is_tracking.store(false, std::memory_order_relaxed);
+}
+
+std::vector<std::string> profiler::get_zone_stack(const std::string &thread_name)
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+    std::vector<std::string> result = {};
+
+    for(const std::shared_ptr<ThreadBuffer> &buffer : buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+
+        if(buffer->name != thread_name)
+            continue;
+
+        // The thread keeps going while we're looking;
+        // the result is only a best effort snapshot
+        const std::size_t depth = std::min(buffer->depth.load(std::memory_order_acquire), MAX_DEPTH);
+        for(std::size_t i = 0; i < depth; ++i)
+            result.push_back(buffer->stack[i].load(std::memory_order_relaxed));
+        break;
+    }
+
+    return result;
+}
+
+ProfilerZone::ProfilerZone(const char *name) : name(name)
+{
+    if(is_tracking.load(std::memory_order_relaxed)) {
+        ThreadBuffer *buffer = get_local_buffer();
+        const std::size_t depth = buffer->depth.load(std::memory_order_relaxed);
+        if(depth < MAX_DEPTH)
+            buffer->stack[depth].store(name, std::memory_order_relaxed);
+        buffer->depth.store(depth + 1, std::memory_order_release);
+        this->is_tracked = true;
+    }
+
+    if(is_active.load(std::memory_order_relaxed)) {
+        this->start = epoch::monotonic_nanoseconds();
+    }
+}
+
+ProfilerZone::~ProfilerZone(void)
+{
+    if(this->is_tracked) {
+        ThreadBuffer *buffer = local_buffer.get();
+        buffer->depth.store(buffer->depth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+    }
+
+    if(this->start && is_active.load(std::memory_order_relaxed)) {
+        ZoneEvent event = {};
+        event.name = this->name;
+        event.start = this->start;
+        event.duration = epoch::monotonic_nanoseconds() - this->start;
+        push_event(event);
+    }
+}
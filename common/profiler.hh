@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace profiler
+{
+// Zones are only recorded while the profiler is
+// enabled; a disabled zone costs an atomic load
+void enable(void);
+void disable(void);
+bool is_enabled(void);
+} // namespace profiler
+
+namespace profiler
+{
+// Background recording is kept apart from the above so
+// that whoever needs zones recorded all the time is not
+// switched off by somebody stopping a profiling session
+void enable_background(void);
+void disable_background(void);
+} // namespace profiler
+
+namespace profiler
+{
+// Every thread keeps the most recent zones in a ring
+// buffer of its own; dumping them writes Chrome trace-event
+// JSON (chrome://tracing, ui.perfetto.dev) through PhysFS,
+// optionally only the zones still running at since_ns or later
+// and started no later than until_ns
+// (zones are timed with epoch::monotonic_nanoseconds)
+bool dump(const std::string &path);
+bool dump(const std::string &path, std::uint64_t since_ns);
+bool dump(const std::string &path, std::uint64_t since_ns, std::uint64_t until_ns);
+void clear(void);
+void set_thread_name(const std::string &name);
+} // namespace profiler
+
+namespace profiler
+{
+// With tracking enabled threads keep track of the zones
+// they're in even when nothing is being recorded, so that
+// other threads can find out what they're busy with
+void enable_tracking(void);
+void disable_tracking(void);
+std::vector<std::string> get_zone_stack(const std::string &thread_name);
+} // namespace profiler
+
+class ProfilerZone final {
+public:
+    explicit ProfilerZone(const char *name);
+    ~ProfilerZone(void);
+
+private:
+    const char *name {};
+    std::uint64_t start {};
+    bool is_tracked {};
+};
+
+#define PROFILER_ZONE_CONCAT_(x, y) x##y
+#define PROFILER_ZONE_CONCAT(x, y) PROFILER_ZONE_CONCAT_(x, y)
+
+// Measures the enclosing scope; the name must be
+// a string literal or otherwise outlive the profiler
+#define PROFILER_ZONE(name) const ProfilerZone PROFILER_ZONE_CONCAT(profiler_zone_, __LINE__)(name)
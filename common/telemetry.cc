@@ -0,0 +1,274 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <common/epoch.hh>
+#include <common/fstools.hh>
+#include <common/telemetry.hh>
+#include <mutex>
+#include <physfs.h>
+#include <spdlog/spdlog.h>
+
+struct TelemetryVariable final {
+    std::string name {};
+    TelemetryCounter *counter {};
+    TelemetryGauge *gauge {};
+    TelemetryHistogram *histogram {};
+
+    // Values at the time of the previous
+    // snapshot written to the stats file
+    std::uint64_t last_value {};
+    std::uint64_t last_sum {};
+    TelemetryHistogram::Buckets last_buckets {};
+};
+
+static std::mutex variables_mutex = {};
+static std::vector<TelemetryVariable> variables = {};
+
+static PHYSFS_File *file = nullptr;
+static std::uint64_t write_time = UINT64_C(0);
+
+void TelemetryCounter::add(std::uint64_t amount)
+{
+    value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+std::uint64_t TelemetryCounter::get(void) const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+void TelemetryGauge::set(std::int64_t value)
+{
+    this->value.store(value, std::memory_order_relaxed);
+}
+
+void TelemetryGauge::add(std::int64_t amount)
+{
+    value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+std::int64_t TelemetryGauge::get(void) const
+{
+    return value.load(std::memory_order_relaxed);
+}
+
+void TelemetryHistogram::record(std::uint64_t value)
+{
+    buckets[TelemetryHistogram::get_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void TelemetryHistogram::get_buckets(TelemetryHistogram::Buckets &buckets) const
+{
+    for(std::size_t i = 0; i < NUM_BUCKETS; ++i) {
+        buckets[i] = this->buckets[i].load(std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t TelemetryHistogram::get_sum(void) const
+{
+    return sum.load(std::memory_order_relaxed);
+}
+
+std::size_t TelemetryHistogram::get_bucket(std::uint64_t value)
+{
+    if(value < 4)
+        return static_cast<std::size_t>(value);
+
+    std::size_t msb = 2;
+    while(value >> (msb + 1))
+        msb += 1;
+
+    // The two bits following the most significant
+    // one pick one of the four buckets of its range
+    const std::size_t sub = static_cast<std::size_t>((value >> (msb - 2)) & 3);
+    return 4 * (msb - 1) + sub;
+}
+
+std::uint64_t TelemetryHistogram::get_bucket_value(std::size_t bucket)
+{
+    if(bucket < 4)
+        return static_cast<std::uint64_t>(bucket);
+
+    // The middle of the range
+    // that the bucket covers
+    const std::size_t shift = bucket / 4 - 1;
+    const std::uint64_t lower = static_cast<std::uint64_t>(4 + bucket % 4) << shift;
+    return lower + ((UINT64_C(1) << shift) >> 1);
+}
+
+static std::uint64_t get_percentile(const TelemetryHistogram::Buckets &buckets, std::uint64_t count, double fraction)
+{
+    const std::uint64_t target = static_cast<std::uint64_t>(fraction * static_cast<double>(count - 1)) + 1;
+    std::uint64_t seen = 0;
+
+    for(std::size_t i = 0; i < TelemetryHistogram::NUM_BUCKETS; ++i) {
+        seen += buckets[i];
+
+        if(seen >= target) {
+            return TelemetryHistogram::get_bucket_value(i);
+        }
+    }
+
+    return 0;
+}
+
+static std::string format_histogram(const TelemetryHistogram::Buckets &buckets, std::uint64_t sum)
+{
+    std::uint64_t count = 0;
+    for(std::uint64_t bucket : buckets)
+        count += bucket;
+
+    if(count == 0)
+        return std::string("count=0");
+
+    return fmt::format("count={} mean={:.0f} p50={} p90={} p99={}", count, static_cast<double>(sum) / static_cast<double>(count),
+        get_percentile(buckets, count, 0.50), get_percentile(buckets, count, 0.90), get_percentile(buckets, count, 0.99));
+}
+
+static void add_variable(const std::string &name, TelemetryCounter *counter, TelemetryGauge *gauge, TelemetryHistogram *histogram)
+{
+    std::lock_guard<std::mutex> lock(variables_mutex);
+
+    for(const TelemetryVariable &variable : variables) {
+        if(variable.name == name) {
+            spdlog::warn("telemetry: {} is already registered", name);
+            return;
+        }
+    }
+
+    TelemetryVariable variable = {};
+    variable.name = name;
+    variable.counter = counter;
+    variable.gauge = gauge;
+    variable.histogram = histogram;
+    variables.push_back(variable);
+}
+
+void telemetry::add(const std::string &name, TelemetryCounter &counter)
+{
+    add_variable(name, &counter, nullptr, nullptr);
+}
+
+void telemetry::add(const std::string &name, TelemetryGauge &gauge)
+{
+    add_variable(name, nullptr, &gauge, nullptr);
+}
+
+void telemetry::add(const std::string &name, TelemetryHistogram &histogram)
+{
+    add_variable(name, nullptr, nullptr, &histogram);
+}
+
+bool telemetry::open(const std::string &path)
+{
+    telemetry::close();
+
+    std::lock_guard<std::mutex> lock(variables_mutex);
+
+    if(!(file = PHYSFS_openAppend(path.c_str()))) {
+        spdlog::warn("telemetry: {}: {}", path, fstools::error());
+        return false;
+    }
+
+    // Rates in the first snapshot
+    // cover everything up to that point
+    for(TelemetryVariable &variable : variables) {
+        variable.last_value = UINT64_C(0);
+        variable.last_sum = UINT64_C(0);
+        variable.last_buckets.fill(UINT64_C(0));
+    }
+
+    write_time = epoch::microseconds();
+
+    spdlog::info("telemetry: writing snapshots to {}", path);
+
+    return true;
+}
+
+void telemetry::close(void)
+{
+    std::lock_guard<std::mutex> lock(variables_mutex);
+
+    if(file) {
+        PHYSFS_close(file);
+        file = nullptr;
+    }
+}
+
+void telemetry::write(void)
+{
+    std::lock_guard<std::mutex> lock(variables_mutex);
+
+    if(!file)
+        return;
+
+    const std::uint64_t curtime = epoch::microseconds();
+    const double seconds = static_cast<double>(curtime - write_time) / 1000000.0;
+    const std::uint64_t timestamp = epoch::seconds();
+    write_time = curtime;
+
+    std::string lines = {};
+
+    for(TelemetryVariable &variable : variables) {
+        if(variable.counter) {
+            const std::uint64_t value = variable.counter->get();
+            const double rate = (seconds > 0.0) ? static_cast<double>(value - variable.last_value) / seconds : 0.0;
+            lines += fmt::format("{} {} {} rate={:.1f}\n", timestamp, variable.name, value, rate);
+            variable.last_value = value;
+            continue;
+        }
+
+        if(variable.gauge) {
+            lines += fmt::format("{} {} {}\n", timestamp, variable.name, variable.gauge->get());
+            continue;
+        }
+
+        if(variable.histogram) {
+            TelemetryHistogram::Buckets buckets = {};
+            TelemetryHistogram::Buckets delta = {};
+            variable.histogram->get_buckets(buckets);
+
+            for(std::size_t i = 0; i < TelemetryHistogram::NUM_BUCKETS; ++i)
+                delta[i] = buckets[i] - variable.last_buckets[i];
+            const std::uint64_t sum = variable.histogram->get_sum();
+
+            lines += fmt::format("{} {} {}\n", timestamp, variable.name, format_histogram(delta, sum - variable.last_sum));
+            variable.last_buckets = buckets;
+            variable.last_sum = sum;
+            continue;
+        }
+    }
+
+    PHYSFS_writeBytes(file, lines.data(), lines.size());
+    PHYSFS_flush(file);
+}
+
+std::vector<std::string> telemetry::format(const std::string &prefix)
+{
+    std::lock_guard<std::mutex> lock(variables_mutex);
+    std::vector<std::string> result = {};
+
+    for(const TelemetryVariable &variable : variables) {
+        if(variable.name.compare(0, prefix.size(), prefix))
+            continue;
+
+        if(variable.counter) {
+            result.push_back(fmt::format("{} {}", variable.name, variable.counter->get()));
+            continue;
+        }
+
+        if(variable.gauge) {
+            result.push_back(fmt::format("{} {}", variable.name, variable.gauge->get()));
+            continue;
+        }
+
+        if(variable.histogram) {
+            TelemetryHistogram::Buckets buckets = {};
+            variable.histogram->get_buckets(buckets);
+            result.push_back(fmt::format("{} {}", variable.name, format_histogram(buckets, variable.histogram->get_sum())));
+            continue;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Only ever goes up; snapshots report the
+// total along with its rate per second
+class TelemetryCounter final {
+public:
+    void add(std::uint64_t amount = 1);
+    std::uint64_t get(void) const;
+
+private:
+    std::atomic<std::uint64_t> value {};
+};
+
+class TelemetryGauge final {
+public:
+    void set(std::int64_t value);
+    void add(std::int64_t amount);
+    std::int64_t get(void) const;
+
+private:
+    std::atomic<std::int64_t> value {};
+};
+
+// Values are counted in buckets, four of them per power
+// of two, so a percentile is off by at most an eighth
+class TelemetryHistogram final {
+public:
+    constexpr static std::size_t NUM_BUCKETS = 256;
+    using Buckets = std::array<std::uint64_t, NUM_BUCKETS>;
+
+public:
+    void record(std::uint64_t value);
+    void get_buckets(Buckets &buckets) const;
+    std::uint64_t get_sum(void) const;
+
+public:
+    static std::size_t get_bucket(std::uint64_t value);
+    static std::uint64_t get_bucket_value(std::size_t bucket);
+
+private:
+    std::array<std::atomic<std::uint64_t>, NUM_BUCKETS> buckets {};
+    std::atomic<std::uint64_t> sum {};
+};
+
+namespace telemetry
+{
+// Variables are owned by whoever registers them and
+// must outlive the registry; updating them is safe from
+// any thread, registering is meant for init functions
+void add(const std::string &name, TelemetryCounter &counter);
+void add(const std::string &name, TelemetryGauge &gauge);
+void add(const std::string &name, TelemetryHistogram &histogram);
+} // namespace telemetry
+
+namespace telemetry
+{
+// Snapshots are appended to a line-oriented stats file
+// in the write directory, one variable per line prefixed
+// with the Unix time; rates and histograms cover the time
+// since the previous snapshot written to the file
+bool open(const std::string &path);
+void close(void);
+void write(void);
+} // namespace telemetry
+
+namespace telemetry
+{
+// Lifetime values of the variables whose
+// names start with the prefix, one per line
+std::vector<std::string> format(const std::string &prefix);
+} // namespace telemetry
@@ -0,0 +1,504 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <cmath>
+#include <common/cmdline.hh>
+#include <common/epoch.hh>
+#include <csignal>
+#include <cstdlib>
+#include <entt/entity/entity.hpp>
+#include <entt/signal/dispatcher.hpp>
+#include <game/bot/main.hh>
+#include <game/shared/globals.hh>
+#include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
+#include <random>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+constexpr static enet_uint32 SERVICE_TIMEOUT_MS = 1;
+constexpr static std::uint64_t SAMPLE_INTERVAL_US = UINT64_C(1000000);
+constexpr static std::uint64_t REPORT_INTERVAL_US = UINT64_C(5000000);
+// Bots are given this long to go away at the end
+constexpr static std::uint64_t LINGER_US = UINT64_C(2000000);
+
+// Bots walk in circles around the spawn point and
+// dig random holes within this distance of it
+constexpr static float WALK_RADIUS = 6.0f;
+constexpr static std::int64_t EDIT_RADIUS = 32;
+
+struct Bot final {
+    ENetPeer *peer {};
+    unsigned int index {};
+    entt::entity player {entt::null};
+    std::uint64_t move_interval {};
+
+    std::uint64_t connect_time {};
+    std::uint64_t next_move_time {};
+    std::uint64_t next_edit_time {};
+    std::uint64_t next_chat_time {};
+    std::uint64_t rx_bytes {};
+    float phase {};
+
+    // Spawn area chunks requested
+    // but not received yet
+    std::vector<ChunkCoord> spawn_chunks {};
+    std::uint32_t spawn_num_chunks {};
+    bool spawn_is_loading {};
+    bool spawn_is_complete {};
+    bool is_spawned {};
+};
+
+struct Samples final {
+    std::vector<double> join_ms {};
+    std::vector<double> rtt_ms {};
+    std::vector<double> rx_kbps {};
+    std::size_t num_periods {};
+};
+
+static bool is_running = false;
+
+static unsigned int num_bots = 8U;
+static unsigned int connect_interval = 100U;
+static unsigned int duration = 0U;
+static double move_rate = 0.0;
+static double edit_rate = 0.2;
+static double chat_rate = 0.05;
+static bool is_cached = false;
+
+static ENetHost *host = nullptr;
+static std::vector<Bot> bots = {};
+static std::mt19937_64 rng = {};
+
+static Samples window = {};
+static Samples total = {};
+static std::uint64_t num_kicked = 0;
+
+static void on_sigint(int)
+{
+    spdlog::warn("bot: received SIGINT");
+    is_running = false;
+}
+
+static Bot *find_bot(ENetPeer *peer)
+{
+    return peer ? reinterpret_cast<Bot *>(peer->data) : nullptr;
+}
+
+static std::uint64_t jitter(double rate)
+{
+    // Spread things out a little so that the
+    // bots don't end up doing everything in lockstep
+    std::uniform_real_distribution<double> dist(0.5, 1.5);
+    return static_cast<std::uint64_t>(dist(rng) * 1000000.0 / rate);
+}
+
+static double percentile(std::vector<double> values, double fraction)
+{
+    if(values.empty())
+        return 0.0;
+    const std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void report(const char *title, const Samples &samples)
+{
+    std::size_t num_spawned = 0;
+    for(const Bot &bot : bots)
+        num_spawned += bot.is_spawned ? 1 : 0;
+
+    double rx_total = 0.0;
+    for(const double value : samples.rx_kbps)
+        rx_total += value;
+    rx_total /= static_cast<double>(cxpr::max<std::size_t>(1, samples.num_periods));
+
+    spdlog::info("bot: {}: {}/{} spawned, {} kicked", title, num_spawned, bots.size(), num_kicked);
+    spdlog::info("bot: {}: join ms p50={:.0f} p90={:.0f} max={:.0f}", title, percentile(samples.join_ms, 0.5), percentile(samples.join_ms, 0.9), percentile(samples.join_ms, 1.0));
+    spdlog::info("bot: {}: rtt ms p50={:.0f} p90={:.0f} p99={:.0f} max={:.0f}", title, percentile(samples.rtt_ms, 0.5), percentile(samples.rtt_ms, 0.9), percentile(samples.rtt_ms, 0.99), percentile(samples.rtt_ms, 1.0));
+    spdlog::info("bot: {}: rx KiB/s total={:.1f} per bot p50={:.1f} p90={:.1f} max={:.1f}", title, rx_total, percentile(samples.rx_kbps, 0.5), percentile(samples.rx_kbps, 0.9), percentile(samples.rx_kbps, 1.0));
+}
+
+static void send_spawn_ready(Bot *bot)
+{
+    protocol::SpawnReady packet = {};
+    packet.num_chunks = bot->spawn_num_chunks;
+    protocol::send(bot->peer, nullptr, packet);
+    bot->spawn_is_loading = false;
+}
+
+static void receive_chunk(Bot *bot, const ChunkCoord &cpos)
+{
+    if(bot->spawn_is_loading) {
+        const auto it = std::find(bot->spawn_chunks.begin(), bot->spawn_chunks.end(), cpos);
+
+        if(it != bot->spawn_chunks.end()) {
+            *it = bot->spawn_chunks.back();
+            bot->spawn_chunks.pop_back();
+        }
+
+        if(bot->spawn_is_complete && bot->spawn_chunks.empty()) {
+            send_spawn_ready(bot);
+        }
+    }
+}
+
+static void on_login_response_packet(const protocol::LoginResponse &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        const double rate = (move_rate > 0.0) ? move_rate : static_cast<double>(cxpr::max<std::uint16_t>(10, packet.tickrate));
+        bot->move_interval = static_cast<std::uint64_t>(1000000.0 / rate);
+    }
+}
+
+static void on_disconnect_packet(const protocol::Disconnect &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        spdlog::warn("bot: bot{} disconnected: {}", bot->index, packet.reason);
+    }
+}
+
+static void on_chunk_hash_packet(const protocol::ChunkHash &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        if(is_cached) {
+            // Pretend everything is
+            // in the chunk cache already
+            return;
+        }
+
+        protocol::ChunkRequest request = {};
+        request.chunk = packet.chunk;
+        protocol::send(bot->peer, nullptr, request);
+
+        if(bot->spawn_is_loading && !bot->spawn_is_complete) {
+            bot->spawn_chunks.push_back(packet.chunk);
+        }
+    }
+}
+
+static void on_chunk_voxels_packet(const protocol::ChunkVoxels &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        receive_chunk(bot, packet.chunk);
+    }
+}
+
+static void on_chunk_bundle_packet(const protocol::ChunkBundle &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        for(const protocol::ChunkBundle::Entry &entry : packet.chunks) {
+            receive_chunk(bot, entry.chunk);
+        }
+    }
+}
+
+static void on_spawn_area_packet(const protocol::SpawnArea &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        if(packet.type == protocol::SpawnArea::STREAMING) {
+            bot->spawn_chunks.clear();
+            bot->spawn_is_loading = true;
+            bot->spawn_is_complete = false;
+            return;
+        }
+
+        if(packet.type == protocol::SpawnArea::COMPLETE) {
+            bot->spawn_num_chunks = packet.num_chunks;
+            bot->spawn_is_complete = true;
+
+            if(bot->spawn_chunks.empty())
+                send_spawn_ready(bot);
+            return;
+        }
+    }
+}
+
+static void on_spawn_player_packet(const protocol::SpawnPlayer &packet)
+{
+    if(Bot *bot = find_bot(packet.peer)) {
+        const std::uint64_t curtime = epoch::microseconds();
+        const double join_ms = static_cast<double>(curtime - bot->connect_time) / 1000.0;
+        window.join_ms.push_back(join_ms);
+        total.join_ms.push_back(join_ms);
+
+        bot->player = packet.entity;
+        bot->is_spawned = true;
+        bot->next_move_time = curtime;
+        bot->next_edit_time = curtime + ((edit_rate > 0.0) ? jitter(edit_rate) : UINT64_MAX / 2);
+        bot->next_chat_time = curtime + ((chat_rate > 0.0) ? jitter(chat_rate) : UINT64_MAX / 2);
+    }
+}
+
+static void send_movement(Bot *bot, std::uint64_t curtime)
+{
+    const float seconds = static_cast<float>(curtime / UINT64_C(1000)) / 1000.0f;
+    const float angle = bot->phase + 0.5f * seconds;
+
+    protocol::EntityTransform transform = {};
+    transform.entity = bot->player;
+    transform.coord = ChunkCoord::to_world(ChunkCoord(0, 0, 0), Vec3f(8.0f + WALK_RADIUS * std::cos(angle), 8.0f, 8.0f + WALK_RADIUS * std::sin(angle)));
+    transform.angles = Vec3angles(0.0f, -angle, 0.0f);
+    protocol::send(bot->peer, nullptr, transform);
+
+    protocol::EntityVelocity velocity = {};
+    velocity.entity = bot->player;
+    velocity.angular = Vec3angles(0.0f, -0.5f, 0.0f);
+    velocity.linear = Vec3f(-0.5f * WALK_RADIUS * std::sin(angle), 0.0f, 0.5f * WALK_RADIUS * std::cos(angle));
+    protocol::send(bot->peer, nullptr, velocity);
+
+    protocol::EntityHead head = {};
+    head.entity = bot->player;
+    head.angles = Vec3angles(0.0f, -angle, 0.0f);
+    protocol::send(bot->peer, nullptr, head);
+}
+
+static void send_edit(Bot *bot)
+{
+    std::uniform_int_distribution<std::int64_t> horizontal(-EDIT_RADIUS, EDIT_RADIUS);
+    std::uniform_int_distribution<std::int64_t> vertical(-EDIT_RADIUS / 2, EDIT_RADIUS / 2);
+
+    // Digging is the only edit that's safe without
+    // knowing anything about the voxel definitions
+    protocol::SetVoxel packet = {};
+    packet.coord = VoxelCoord(horizontal(rng), vertical(rng), horizontal(rng));
+    packet.voxel = NULL_VOXEL;
+    packet.flags = UINT16_C(0x0000);
+    protocol::send(bot->peer, nullptr, packet);
+}
+
+static void update_bot(Bot *bot, std::uint64_t curtime)
+{
+    if(!bot->is_spawned)
+        return;
+
+    if(curtime >= bot->next_move_time) {
+        bot->next_move_time += bot->move_interval;
+        if(bot->next_move_time < curtime)
+            bot->next_move_time = curtime + bot->move_interval;
+        send_movement(bot, curtime);
+    }
+
+    if(curtime >= bot->next_edit_time) {
+        bot->next_edit_time = curtime + jitter(edit_rate);
+        send_edit(bot);
+    }
+
+    if(curtime >= bot->next_chat_time) {
+        bot->next_chat_time = curtime + jitter(chat_rate);
+        protocol::send_chat_message(bot->peer, nullptr, "beep boop");
+    }
+}
+
+static void handle_event(const ENetEvent &event)
+{
+    if(event.type == ENET_EVENT_TYPE_CONNECT) {
+        if(Bot *bot = find_bot(event.peer)) {
+            protocol::reset_baselines(event.peer);
+
+            protocol::LoginRequest packet = {};
+            packet.version = protocol::VERSION;
+            packet.password_hash = UINT64_MAX;
+            packet.vdef_checksum = UINT64_MAX;
+            packet.player_uid = rng();
+            packet.username = "bot" + std::to_string(bot->index);
+            protocol::send(bot->peer, nullptr, packet);
+        }
+
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+        if(Bot *bot = find_bot(event.peer)) {
+            protocol::reset_baselines(event.peer);
+            bot->peer->data = nullptr;
+            bot->peer = nullptr;
+            bot->is_spawned = false;
+            num_kicked += is_running ? 1 : 0;
+        }
+
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+        if(Bot *bot = find_bot(event.peer))
+            bot->rx_bytes += event.packet->dataLength;
+        protocol::receive(event.packet, event.peer);
+        enet_packet_destroy(event.packet);
+        return;
+    }
+}
+
+static void sample(std::uint64_t elapsed_us)
+{
+    const double seconds = static_cast<double>(elapsed_us) / 1000000.0;
+
+    window.num_periods += 1;
+    total.num_periods += 1;
+
+    for(Bot &bot : bots) {
+        if(!bot.peer)
+            continue;
+
+        const double rx_kbps = static_cast<double>(bot.rx_bytes) / 1024.0 / seconds;
+        window.rx_kbps.push_back(rx_kbps);
+        total.rx_kbps.push_back(rx_kbps);
+        bot.rx_bytes = 0;
+
+        if(bot.peer->state == ENET_PEER_STATE_CONNECTED) {
+            window.rtt_ms.push_back(bot.peer->roundTripTime);
+            total.rtt_ms.push_back(bot.peer->roundTripTime);
+        }
+    }
+}
+
+static void parse_options(void)
+{
+    std::string value = {};
+
+    if(cmdline::get_value("bots", value) && !value.empty())
+        num_bots = cxpr::clamp<unsigned int>(std::strtoul(value.c_str(), nullptr, 10), 1U, ENET_PROTOCOL_MAXIMUM_PEER_ID);
+    if(cmdline::get_value("connect_interval", value) && !value.empty())
+        connect_interval = std::strtoul(value.c_str(), nullptr, 10);
+    if(cmdline::get_value("duration", value) && !value.empty())
+        duration = std::strtoul(value.c_str(), nullptr, 10);
+    if(cmdline::get_value("move_rate", value) && !value.empty())
+        move_rate = std::strtod(value.c_str(), nullptr);
+    if(cmdline::get_value("edit_rate", value) && !value.empty())
+        edit_rate = std::strtod(value.c_str(), nullptr);
+    if(cmdline::get_value("chat_rate", value) && !value.empty())
+        chat_rate = std::strtod(value.c_str(), nullptr);
+    if(cmdline::get_value("seed", value) && !value.empty())
+        rng.seed(std::strtoull(value.c_str(), nullptr, 10));
+    else rng.seed(std::random_device()());
+
+    is_cached = cmdline::contains("cached");
+}
+
+void bot::main(void)
+{
+    parse_options();
+
+    std::string hostname = {};
+    std::string value = {};
+    ENetAddress address = {};
+    address.port = protocol::PORT;
+
+    if(!cmdline::get_value("host", hostname) || hostname.empty())
+        hostname = "127.0.0.1";
+    enet_address_set_host(&address, hostname.c_str());
+
+    if(cmdline::get_value("port", value) && !value.empty())
+        address.port = static_cast<enet_uint16>(std::strtoul(value.c_str(), nullptr, 10));
+
+    // All the bots share a single socket;
+    // ENet tells the connections apart by peer ID
+    if(!(host = enet_host_create(nullptr, num_bots, protocol::NUM_CHANNELS, 0, 0))) {
+        spdlog::critical("bot: unable to setup an ENet host");
+        return;
+    }
+
+    globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
+    globals::dispatcher.sink<protocol::Disconnect>().connect<&on_disconnect_packet>();
+    globals::dispatcher.sink<protocol::ChunkHash>().connect<&on_chunk_hash_packet>();
+    globals::dispatcher.sink<protocol::ChunkVoxels>().connect<&on_chunk_voxels_packet>();
+    globals::dispatcher.sink<protocol::ChunkBundle>().connect<&on_chunk_bundle_packet>();
+    globals::dispatcher.sink<protocol::SpawnArea>().connect<&on_spawn_area_packet>();
+    globals::dispatcher.sink<protocol::SpawnPlayer>().connect<&on_spawn_player_packet>();
+
+    // Bots are pointed to by their peers
+    // so the vector must never reallocate
+    bots.reserve(num_bots);
+
+    is_running = true;
+
+    std::signal(SIGINT, &on_sigint);
+
+    spdlog::info("bot: connecting {} bots to {}:{}", num_bots, hostname, address.port);
+
+    const std::uint64_t start_time = epoch::microseconds();
+    const std::uint64_t end_time = duration ? (start_time + UINT64_C(1000000) * duration) : UINT64_MAX;
+    std::uint64_t next_connect_time = start_time;
+    std::uint64_t sample_time = start_time;
+    std::uint64_t report_time = start_time;
+
+    std::uniform_real_distribution<float> phases(0.0f, 6.2831853f);
+
+    while(is_running) {
+        const std::uint64_t curtime = epoch::microseconds();
+
+        if(curtime >= end_time)
+            break;
+
+        if((bots.size() < num_bots) && (curtime >= next_connect_time)) {
+            next_connect_time = curtime + UINT64_C(1000) * connect_interval;
+
+            Bot &bot = bots.emplace_back();
+            bot.index = static_cast<unsigned int>(bots.size() - 1);
+            bot.connect_time = curtime;
+            bot.move_interval = UINT64_C(50000);
+            bot.phase = phases(rng);
+
+            if((bot.peer = enet_host_connect(host, &address, protocol::NUM_CHANNELS, 0)) != nullptr)
+                bot.peer->data = &bot;
+            else spdlog::warn("bot: bot{}: out of peers", bot.index);
+        }
+
+        for(Bot &bot : bots) {
+            if(bot.peer) {
+                update_bot(&bot, curtime);
+            }
+        }
+
+        ENetEvent event = {};
+
+        if(enet_host_service(host, &event, SERVICE_TIMEOUT_MS) > 0) {
+            handle_event(event);
+
+            while(enet_host_check_events(host, &event) > 0) {
+                handle_event(event);
+            }
+        }
+
+        if(curtime - sample_time >= SAMPLE_INTERVAL_US) {
+            sample(curtime - sample_time);
+            sample_time = curtime;
+        }
+
+        if(curtime - report_time >= REPORT_INTERVAL_US) {
+            report("last 5s", window);
+            window = Samples();
+            report_time = curtime;
+        }
+    }
+
+    report("total", total);
+
+    is_running = false;
+
+    for(Bot &bot : bots) {
+        if(bot.peer) {
+            protocol::send_disconnect(bot.peer, nullptr, "protocol.client_shutdown");
+            enet_peer_disconnect_later(bot.peer, 0);
+        }
+    }
+
+    const std::uint64_t linger_time = epoch::microseconds();
+    ENetEvent event = {};
+
+    while(epoch::microseconds() - linger_time < LINGER_US) {
+        if(enet_host_service(host, &event, SERVICE_TIMEOUT_MS) > 0) {
+            if(event.type == ENET_EVENT_TYPE_RECEIVE)
+                enet_packet_destroy(event.packet);
+            if(event.type == ENET_EVENT_TYPE_DISCONNECT)
+                event.peer->data = nullptr;
+        }
+
+        if(std::none_of(bots.cbegin(), bots.cend(), [](const Bot &bot) { return bot.peer && bot.peer->data; })) {
+            // Everyone's gone
+            break;
+        }
+    }
+
+    enet_host_destroy(host);
+}
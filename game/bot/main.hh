@@ -0,0 +1,8 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+
+namespace bot
+{
+void main(void);
+} // namespace bot
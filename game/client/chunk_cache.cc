@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <common/config.hh>
+#include <common/fstools.hh>
+#include <ctime>
+#include <game/client/chunk_cache.hh>
+#include <game/client/globals.hh>
+#include <mathlib/constexpr.hh>
+#include <miniz.h>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <thread_pool.hpp>
+
+// Cached chunks are content-addressed: the file name
+// is the checksum the server advertises, so identical chunks
+// share a single file and changed chunks simply miss the cache
+constexpr static const char *CACHE_DIRNAME = "cache/chunks";
+// Each pending write holds a copy of the voxel data
+constexpr static std::size_t MAX_PENDING_WRITES = 1024;
+// Used files are rewritten to mark them as recent,
+// but not more often than this many seconds apart
+constexpr static std::time_t REFRESH_AGE = 3600;
+
+bool chunk_cache::enabled = true;
+unsigned int chunk_cache::max_size = 256U;
+
+struct CachedFile final {
+    std::string path {};
+    PHYSFS_sint64 modtime {};
+    PHYSFS_sint64 size {};
+};
+
+static std::vector<std::uint8_t> zdata = {};
+
+// Checksumming, compressing and writing chunks
+// is done by a single thread in the background
+static std::unique_ptr<thread_pool> writer = {};
+
+static std::string get_path(std::uint64_t hash)
+{
+    return fmt::format("{}/{:016X}", CACHE_DIRNAME, hash);
+}
+
+// Files are rewritten whenever a chunk is used or received
+// again, so the modification time tells roughly when the chunk
+// was last needed; the least recently used ones go first
+static void prune(std::uint64_t max_bytes)
+{
+    char **list = PHYSFS_enumerateFiles(CACHE_DIRNAME);
+
+    if(list == nullptr) {
+        spdlog::warn("chunk_cache: {}: {}", CACHE_DIRNAME, fstools::error());
+        return;
+    }
+
+    std::vector<CachedFile> files = {};
+    std::uint64_t total_bytes = UINT64_C(0);
+
+    for(char **name = list; *name; ++name) {
+        CachedFile file = {};
+        file.path = fmt::format("{}/{}", CACHE_DIRNAME, *name);
+
+        PHYSFS_Stat stat = {};
+        if(!PHYSFS_stat(file.path.c_str(), &stat) || (stat.filetype != PHYSFS_FILETYPE_REGULAR))
+            continue;
+
+        file.modtime = stat.modtime;
+        file.size = cxpr::max<PHYSFS_sint64>(stat.filesize, 0);
+        total_bytes += static_cast<std::uint64_t>(file.size);
+        files.push_back(std::move(file));
+    }
+
+    PHYSFS_freeList(list);
+
+    if(total_bytes <= max_bytes)
+        return;
+
+    std::sort(files.begin(), files.end(), [](const CachedFile &a, const CachedFile &b) {
+        return a.modtime < b.modtime;
+    });
+
+    std::size_t num_removed = 0;
+    std::uint64_t removed_bytes = UINT64_C(0);
+
+    for(const CachedFile &file : files) {
+        if(total_bytes - removed_bytes <= max_bytes)
+            break;
+        if(!PHYSFS_delete(file.path.c_str()))
+            continue;
+        removed_bytes += static_cast<std::uint64_t>(file.size);
+        num_removed += 1;
+    }
+
+    spdlog::info("chunk_cache: removed {} oldest chunks ({} KiB)", num_removed, removed_bytes / 1024U);
+}
+
+// PhysFS can't change modification times,
+// so the file is written over with itself instead
+static void refresh(const std::string &path)
+{
+    PHYSFS_Stat stat = {};
+    if(!PHYSFS_stat(path.c_str(), &stat))
+        return;
+    if(stat.modtime >= static_cast<PHYSFS_sint64>(std::time(nullptr) - REFRESH_AGE))
+        return;
+
+    std::vector<std::uint8_t> contents = {};
+    if(fstools::read_bytes(path, contents)) {
+        fstools::write_bytes(path, contents);
+    }
+}
+
+static void write(const VoxelStorage &voxels)
+{
+    const std::string path = get_path(Chunk::checksum(voxels));
+
+    if(PHYSFS_exists(path.c_str())) {
+        // Contents are the same as long
+        // as the checksum is the same
+        refresh(path);
+        return;
+    }
+
+    std::array<std::uint8_t, sizeof(VoxelStorage)> bytes = {};
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        bytes[2 * i + 0] = static_cast<std::uint8_t>(voxels[i] & 0xFF);
+        bytes[2 * i + 1] = static_cast<std::uint8_t>(voxels[i] >> 8);
+    }
+
+    mz_ulong bound = mz_compressBound(static_cast<mz_ulong>(bytes.size()));
+    std::vector<std::uint8_t> compressed(bound);
+
+    if(mz_compress(compressed.data(), &bound, bytes.data(), static_cast<mz_ulong>(bytes.size())) == MZ_OK) {
+        compressed.resize(bound);
+        fstools::write_bytes(path, compressed);
+    }
+}
+
+void chunk_cache::init(void)
+{
+    Config::add(globals::client_config, "chunk_cache.enabled", chunk_cache::enabled);
+    Config::add(globals::client_config, "chunk_cache.max_size", chunk_cache::max_size);
+
+    if(!PHYSFS_mkdir(CACHE_DIRNAME)) {
+        spdlog::warn("chunk_cache: {}: {}", CACHE_DIRNAME, fstools::error());
+        spdlog::warn("chunk_cache: chunks are not going to be cached");
+        chunk_cache::enabled = false;
+    }
+}
+
+void chunk_cache::init_late(void)
+{
+    chunk_cache::max_size = cxpr::max(1U, chunk_cache::max_size);
+
+    if(chunk_cache::enabled) {
+        writer = std::make_unique<thread_pool>(1);
+
+        // The cache only grows while playing; it's
+        // brought back under the limit once per launch
+        const std::uint64_t max_bytes = UINT64_C(1048576) * chunk_cache::max_size;
+        writer->push_task([max_bytes](void) {
+            prune(max_bytes);
+        });
+    }
+}
+
+void chunk_cache::deinit(void)
+{
+    // Pending writes are finished
+    // before the thread is let go
+    writer.reset();
+}
+
+bool chunk_cache::load(std::uint64_t hash, VoxelStorage &voxels)
+{
+    if(!chunk_cache::enabled)
+        return false;
+
+    if(!fstools::read_bytes(get_path(hash), zdata))
+        return false;
+
+    std::array<std::uint8_t, sizeof(VoxelStorage)> bytes = {};
+    mz_ulong size = static_cast<mz_ulong>(bytes.size());
+
+    if(mz_uncompress(bytes.data(), &size, zdata.data(), static_cast<mz_ulong>(zdata.size())) != MZ_OK)
+        return false;
+    if(size != bytes.size())
+        return false;
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        // Voxel data is stored in little-endian byte order
+        voxels[i] = static_cast<Voxel>(bytes[2 * i + 0]) | static_cast<Voxel>(bytes[2 * i + 1] << 8);
+    }
+
+    // Anything could have happened to the file
+    // in between the sessions; make sure it's not stale
+    if(Chunk::checksum(voxels) != hash)
+        return false;
+
+    if(writer && (writer->get_tasks_total() < MAX_PENDING_WRITES)) {
+        writer->push_task([hash](void) {
+            refresh(get_path(hash));
+        });
+    }
+
+    return true;
+}
+
+void chunk_cache::store(const VoxelStorage &voxels)
+{
+    if(!chunk_cache::enabled || !writer)
+        return;
+
+    if(writer->get_tasks_total() >= MAX_PENDING_WRITES) {
+        // The chunk is simply going to be
+        // requested again the next time around
+        return;
+    }
+
+    writer->push_task([voxels](void) {
+        write(voxels);
+    });
+}
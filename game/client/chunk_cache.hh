@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <game/shared/chunk.hh>
+
+namespace chunk_cache
+{
+extern bool enabled;
+extern unsigned int max_size;
+} // namespace chunk_cache
+
+namespace chunk_cache
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+} // namespace chunk_cache
+
+namespace chunk_cache
+{
+// Called from the network thread as chunk hashes arrive;
+// it is not meant to be called from anywhere else
+bool load(std::uint64_t hash, VoxelStorage &voxels);
+// Chunks are written out in the background and
+// can miss the cache until the write is finished
+void store(const VoxelStorage &voxels);
+} // namespace chunk_cache
@@ -1,94 +1,204 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
-#include <common/crc64.hh>
+#include <algorithm>
+#include <atomic>
+#include <common/config.hh>
+#include <common/epoch.hh>
+#include <common/profiler.hh>
+#include <common/telemetry.hh>
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/client/chunk_mesher.hh>
 #include <game/client/chunk_quad.hh>
 #include <game/client/chunk_visibility.hh>
 #include <game/client/globals.hh>
+#include <game/client/view.hh>
 #include <game/client/voxel_atlas.hh>
 #include <game/shared/entity/chunk.hh>
 #include <game/shared/event/chunk_create.hh>
 #include <game/shared/event/chunk_remove.hh>
 #include <game/shared/event/chunk_update.hh>
-#include <game/shared/event/voxel_set.hh>
+#include <game/shared/event/voxel_batch.hh>
 #include <game/shared/chunk_coord.hh>
 #include <game/shared/local_coord.hh>
 #include <game/shared/vdef.hh>
-#include <game/shared/voxel_coord.hh>
 #include <game/shared/world.hh>
 #include <spdlog/spdlog.h>
+#include <thread>
 #include <thread_pool.hpp>
 
 using QuadBuilder = std::vector<ChunkQuad>;
 
-using CachedChunkCoord = unsigned short;
-constexpr static CachedChunkCoord CPOS_ITSELF = 0x0000;
-constexpr static CachedChunkCoord CPOS_NORTH  = 0x0001;
-constexpr static CachedChunkCoord CPOS_SOUTH  = 0x0002;
-constexpr static CachedChunkCoord CPOS_EAST   = 0x0003;
-constexpr static CachedChunkCoord CPOS_WEST   = 0x0004;
-constexpr static CachedChunkCoord CPOS_TOP    = 0x0005;
-constexpr static CachedChunkCoord CPOS_BOTTOM = 0x0006;
-constexpr static const size_t NUM_CACHED_CPOS = 7;
+// Axes a quad of every facing is laid along:
+// the facing's normal, the width and the height;
+// these have to match what chunk_quad.vert does
+constexpr static std::size_t FACE_AXES[6][3] = {
+    { 2, 0, 1 }, // FACING_NORTH
+    { 2, 0, 1 }, // FACING_SOUTH
+    { 0, 1, 2 }, // FACING_EAST
+    { 0, 1, 2 }, // FACING_WEST
+    { 1, 0, 2 }, // FACING_UP
+    { 1, 0, 2 }, // FACING_DOWN
+};
+
+// Distance between two voxels next to each other
+// along an axis in the terms of LocalCoord::to_index
+constexpr static std::size_t AXIS_STRIDES[3] = { 1, CHUNK_AREA, CHUNK_SIZE };
+
+static const LocalCoord FACE_DIRECTIONS[6] = {
+    LocalCoord::dir_north(),
+    LocalCoord::dir_south(),
+    LocalCoord::dir_east(),
+    LocalCoord::dir_west(),
+    LocalCoord::dir_up(),
+    LocalCoord::dir_down(),
+};
+
+// Neighbours are only ever looked at across the face
+// they share with the chunk, so a single layer of voxels
+// is all that's copied from each one; slabs are indexed
+// by facing and laid out along the facing's axes
+using VoxelSlab = std::array<Voxel, CHUNK_AREA>;
+
+// Visible faces are laid out in slices of a chunk's area,
+// one slice per layer of voxels for each of the six facings;
+// see make_face_key for what the stored values mean. The storage
+// is never cleared: only faces marked in face_rows are looked at
+constexpr static std::size_t NUM_FACE_SLICES = 6 * CHUNK_SIZE;
+
+// Voxels are culled a whole row along the X axis at a time,
+// one bit per voxel; both the bits and the grid of rows have
+// a voxel of padding on either side for the border slabs
+constexpr static std::size_t ROW_GRID_SIZE = CHUNK_SIZE + 2;
+constexpr static std::uint32_t ROW_VOXELS = ((UINT32_C(1) << CHUNK_SIZE) - 1) << 1;
+using VoxelRows = std::array<std::uint32_t, ROW_GRID_SIZE * ROW_GRID_SIZE>;
+
+// Offsets to the row that's in front of a row's
+// faces; east and west shift the bits instead
+constexpr static std::ptrdiff_t ROW_OFFSETS[6] = {
+    +1, // FACING_NORTH
+    -1, // FACING_SOUTH
+    +0, // FACING_EAST
+    +0, // FACING_WEST
+    +static_cast<std::ptrdiff_t>(ROW_GRID_SIZE), // FACING_UP
+    -static_cast<std::ptrdiff_t>(ROW_GRID_SIZE), // FACING_DOWN
+};
 
 struct WorkerContext final {
-    std::array<VoxelStorage, NUM_CACHED_CPOS> cache {};
+    VoxelStorage voxels {};
+    std::array<VoxelSlab, 6> neighbours {};
+    VoxelRows solid {};
+    VoxelRows blending {};
+    VoxelRows empty {};
+    std::array<std::uint16_t, NUM_FACE_SLICES * CHUNK_SIZE> face_rows {};
+    std::unique_ptr<std::uint32_t[]> faces {};
     std::vector<QuadBuilder> quads {};
     std::shared_future<bool> future {};
-    bool is_cancelled {};
+    std::atomic<bool> is_cancelled {};
+    std::uint64_t process_time {};
     ChunkCoord coord {};
 };
 
-static const CachedChunkCoord get_cached_cpos(const ChunkCoord &pivot, const ChunkCoord &cpos)
+static std::size_t get_row(std::size_t y, std::size_t z)
 {
-    static const CachedChunkCoord nx[3] = {CPOS_WEST, 0, CPOS_EAST};
-    static const CachedChunkCoord ny[3] = {CPOS_BOTTOM, 0, CPOS_TOP};
-    static const CachedChunkCoord nz[3] = {CPOS_NORTH, 0, CPOS_SOUTH};
-
-    if(pivot != cpos) {
-        ChunkCoord delta = pivot - cpos;
-        delta[0] = cxpr::clamp<std::int64_t>(delta[0], -1, 1);
-        delta[1] = cxpr::clamp<std::int64_t>(delta[1], -1, 1);
-        delta[2] = cxpr::clamp<std::int64_t>(delta[2], -1, 1);
-
-        if(delta[0])
-            return nx[delta[0] + 1];
-        if(delta[1])
-            return ny[delta[1] + 1];
-        return nz[delta[2] + 1];
-    }
+    // Coordinates include the padding, so zero
+    // is the neighbour's layer below or to the south
+    return y * ROW_GRID_SIZE + z;
+}
+
+static unsigned int lowest_bit(std::uint32_t mask)
+{
+    // De Bruijn multiplication; the mask must not be zero
+    constexpr static unsigned int positions[32] = {
+        0,  1,  28, 2,  29, 14, 24, 3,  30, 22, 20, 15, 25, 17, 4,  8,
+        31, 27, 13, 23, 21, 19, 16, 7,  26, 12, 18, 6,  11, 5,  10, 9,
+    };
 
-    return CPOS_ITSELF;
+    return positions[((mask & (~mask + 1U)) * UINT32_C(0x077CB531)) >> 27U];
 }
 
-static bool vis_test(WorkerContext *ctx, Voxel voxel, const VoxelInfo *info, const LocalCoord &lpos)
+// Voxels of unknown types are in none of
+// the masks: they hide faces and have none
+static VoxelRows *get_rows(WorkerContext *ctx, Voxel voxel)
 {
-    const auto pvpos = ChunkCoord::to_voxel(ctx->coord, lpos);
-    const auto pcpos = VoxelCoord::to_chunk(pvpos);
-    const auto plpos = VoxelCoord::to_local(pvpos);
-    const auto index = LocalCoord::to_index(plpos);
-
-    const auto cached_cpos = get_cached_cpos(ctx->coord, pcpos);
-    const auto &voxels = ctx->cache.at(cached_cpos);
-    const auto neighbour = voxels[index];
-
-    if(neighbour == NULL_VOXEL)
-        return true;
-    if(neighbour == voxel)
-        return false;
-
-    if(const VoxelInfo *neighbour_info = vdef::find(neighbour)) {
-        if(neighbour_info->blending != info->blending) {
-            // Voxel types that use blending are semi-transparent;
-            // this means they're rendered using a different setup
-            // and they must have visible faces with opaque voxels
-            return true;
+    if(voxel == NULL_VOXEL)
+        return &ctx->empty;
+    if(const VoxelInfo *info = vdef::find(voxel))
+        return info->blending ? &ctx->blending : &ctx->solid;
+    return nullptr;
+}
+
+static void classify(WorkerContext *ctx, Voxel voxel, std::size_t row, std::uint32_t bit)
+{
+    if(VoxelRows *rows = get_rows(ctx, voxel)) {
+        (*rows)[row] |= bit;
+    }
+}
+
+static void classify_voxels(WorkerContext *ctx)
+{
+    // Voxels mostly come in long runs of
+    // the same type, so lookups are skipped
+    Voxel last_voxel = NULL_VOXEL;
+    VoxelRows *last_rows = &ctx->empty;
+
+    for(std::size_t y = 0; y < CHUNK_SIZE; ++y) {
+        for(std::size_t z = 0; z < CHUNK_SIZE; ++z) {
+            const std::size_t row = get_row(y + 1, z + 1);
+            const Voxel *voxels = &ctx->voxels[(y * CHUNK_SIZE + z) * CHUNK_SIZE];
+
+            for(std::size_t x = 0; x < CHUNK_SIZE; ++x) {
+                if(voxels[x] != last_voxel) {
+                    last_voxel = voxels[x];
+                    last_rows = get_rows(ctx, last_voxel);
+                }
+
+                if(last_rows) {
+                    (*last_rows)[row] |= UINT32_C(2) << x;
+                }
+            }
         }
     }
 
-    return false;
+    // Slabs are laid along the facing's axes, that
+    // is XY for north and south, YZ for east and west
+    // and XZ for up and down; see FACE_AXES
+    for(std::size_t v = 0; v < CHUNK_SIZE; ++v) {
+        for(std::size_t u = 0; u < CHUNK_SIZE; ++u) {
+            const std::size_t index = v * CHUNK_SIZE + u;
+            const std::uint32_t bit = UINT32_C(2) << u;
+            classify(ctx, ctx->neighbours[FACING_NORTH][index], get_row(v + 1, CHUNK_SIZE + 1), bit);
+            classify(ctx, ctx->neighbours[FACING_SOUTH][index], get_row(v + 1, 0), bit);
+            classify(ctx, ctx->neighbours[FACING_EAST][index], get_row(u + 1, v + 1), UINT32_C(1) << (CHUNK_SIZE + 1));
+            classify(ctx, ctx->neighbours[FACING_WEST][index], get_row(u + 1, v + 1), UINT32_C(1));
+            classify(ctx, ctx->neighbours[FACING_UP][index], get_row(CHUNK_SIZE + 1, v + 1), bit);
+            classify(ctx, ctx->neighbours[FACING_DOWN][index], get_row(0, v + 1), bit);
+        }
+    }
+}
+
+// A face is visible when there's either nothing in front
+// of it or a voxel that differs in whether it uses blending;
+// voxel types that use blending are semi-transparent, so they
+// are rendered using a different setup and must have visible
+// faces with opaque voxels. Two voxels of the same type always
+// hide each other's faces, which falls out of this on its own
+static std::uint32_t get_visible(const WorkerContext *ctx, std::size_t row, VoxelFacing facing)
+{
+    const std::size_t front = row + ROW_OFFSETS[facing];
+    std::uint32_t under_solid = ctx->empty[front] | ctx->blending[front];
+    std::uint32_t under_blending = ctx->empty[front] | ctx->solid[front];
+
+    if(facing == FACING_EAST) {
+        under_solid >>= 1U;
+        under_blending >>= 1U;
+    }
+    else if(facing == FACING_WEST) {
+        under_solid <<= 1U;
+        under_blending <<= 1U;
+    }
+
+    return ROW_VOXELS & ((ctx->solid[row] & under_solid) | (ctx->blending[row] & under_blending));
 }
 
 static VoxelFacing get_facing(VoxelFace face, VoxelType type)
@@ -112,97 +222,178 @@ static VoxelFacing get_facing(VoxelFace face, VoxelType type)
     }
 }
 
-static void push_quad_a(WorkerContext *ctx, const VoxelInfo *info, const Vec3f &pos, const Vec2f &size, VoxelFace face)
+// Faces with the same key look exactly the same and can
+// be merged into a single quad; zero means there's no face.
+// Texture, frame and variant counts take up as many bits as
+// they do in ChunkQuad and the atlas plane gets ten of them
+static std::uint32_t make_face_key(std::size_t plane, std::size_t texture, std::size_t frames, std::size_t variants)
 {
-    const VoxelFacing facing = get_facing(face, info->type);
-    const VoxelTexture &vtex = info->textures[static_cast<std::size_t>(face)];
-    ctx->quads[vtex.cached_plane].push_back(make_chunk_quad(pos, size, facing, vtex.cached_offset, vtex.paths.size()));
+    std::uint32_t result = 0x80000000U;
+    result |= (0x000003FFU & static_cast<std::uint32_t>(plane)) << 21U;
+    result |= (0x000007FFU & static_cast<std::uint32_t>(texture)) << 10U;
+    result |= (0x0000001FU & static_cast<std::uint32_t>(frames)) << 5U;
+    result |= (0x0000001FU & static_cast<std::uint32_t>(variants));
+    return result;
 }
 
-static void push_quad_v(WorkerContext *ctx, const VoxelInfo *info, const Vec3f &pos, const Vec2f &size, VoxelFace face, std::size_t entropy)
+static void add_face(WorkerContext *ctx, const VoxelInfo *info, const LocalCoord &lpos, VoxelFace face)
 {
     const VoxelFacing facing = get_facing(face, info->type);
     const VoxelTexture &vtex = info->textures[static_cast<std::size_t>(face)];
-    const std::size_t entropy_mod = entropy % vtex.paths.size();
-    ctx->quads[vtex.cached_plane].push_back(make_chunk_quad(pos, size, facing, vtex.cached_offset + entropy_mod, 0));
+    const std::size_t *axes = FACE_AXES[facing];
+    const std::size_t slice = facing * CHUNK_SIZE + lpos[axes[0]];
+    const std::size_t row = slice * CHUNK_SIZE + lpos[axes[2]];
+    const std::size_t index = row * CHUNK_SIZE + lpos[axes[1]];
+
+    ctx->face_rows[row] |= static_cast<std::uint16_t>(1U << lpos[axes[1]]);
+
+    if(info->animated) {
+        ctx->faces[index] = make_face_key(vtex.cached_plane, vtex.cached_offset, vtex.paths.size(), 0);
+        return;
+    }
+
+    // Varied textures are picked per voxel by the
+    // shader, so the variant doesn't get in the way
+    ctx->faces[index] = make_face_key(vtex.cached_plane, vtex.cached_offset, 0, vtex.paths.size());
 }
 
-static void make_cube(WorkerContext *ctx, Voxel voxel, const VoxelInfo *info, const LocalCoord &lpos, VoxelVis vis, std::size_t entropy)
+static void add_faces(WorkerContext *ctx, std::size_t y, std::size_t z, VoxelFacing facing, std::uint32_t visible)
 {
-    const Vec3f fpos = LocalCoord::to_vec3f(lpos);
-    const Vec2f fsize = Vec2f(1.0f, 1.0f);
+    // FIXME: handle different voxel types
+    const VoxelFace face = static_cast<VoxelFace>(facing);
 
-    if(info->animated) {
-        if(vis & VIS_NORTH) push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeNorth);
-        if(vis & VIS_SOUTH) push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeSouth);
-        if(vis & VIS_EAST)  push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeEast);
-        if(vis & VIS_WEST)  push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeWest);
-        if(vis & VIS_UP)    push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeTop);
-        if(vis & VIS_DOWN)  push_quad_a(ctx, info, fpos, fsize, VoxelFace::CubeBottom);
+    while(visible) {
+        const LocalCoord lpos = LocalCoord(lowest_bit(visible) - 1U, y, z);
+        add_face(ctx, vdef::find(ctx->voxels[LocalCoord::to_index(lpos)]), lpos, face);
+        visible &= visible - 1U;
     }
-    else {
-        if(vis & VIS_NORTH) push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeNorth, entropy);
-        if(vis & VIS_SOUTH) push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeSouth, entropy);
-        if(vis & VIS_EAST)  push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeEast, entropy);
-        if(vis & VIS_WEST)  push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeWest, entropy);
-        if(vis & VIS_UP)    push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeTop, entropy);
-        if(vis & VIS_DOWN)  push_quad_v(ctx, info, fpos, fsize, VoxelFace::CubeBottom, entropy);
+}
+
+// Greedy meshing: a face is stretched along the width
+// as far as faces with the same key go, then whole rows
+// of that width are added along the height; every face
+// ends up in exactly one quad
+static void merge_slice(WorkerContext *ctx, std::size_t slice)
+{
+    const std::uint32_t *faces = &ctx->faces[slice * CHUNK_AREA];
+    std::uint16_t *rows = &ctx->face_rows[slice * CHUNK_SIZE];
+    const VoxelFacing facing = static_cast<VoxelFacing>(slice / CHUNK_SIZE);
+    const std::size_t *axes = FACE_AXES[facing];
+
+    for(std::size_t v = 0; v < CHUNK_SIZE; ++v) {
+        while(rows[v]) {
+            const std::size_t u = lowest_bit(rows[v]);
+            const std::uint32_t key = faces[v * CHUNK_SIZE + u];
+
+            std::size_t width = 1;
+            while(((u + width) < CHUNK_SIZE) && (rows[v] & (1U << (u + width))) && (faces[v * CHUNK_SIZE + u + width] == key))
+                width += 1;
+
+            // Faces the quad covers in
+            // each of the rows it spans
+            const std::uint16_t span = static_cast<std::uint16_t>(((1U << width) - 1U) << u);
+
+            std::size_t height = 1;
+            while((v + height) < CHUNK_SIZE) {
+                const std::uint32_t *row = &faces[(v + height) * CHUNK_SIZE + u];
+                if((rows[v + height] & span) != span)
+                    break;
+                if(std::any_of(row, row + width, [key](std::uint32_t other) { return other != key; }))
+                    break;
+                height += 1;
+            }
+
+            for(std::size_t dv = 0; dv < height; ++dv)
+                rows[v + dv] &= static_cast<std::uint16_t>(~span);
+
+            Vec3f position = {};
+            position[axes[0]] = static_cast<float>(slice % CHUNK_SIZE);
+            position[axes[1]] = static_cast<float>(u);
+            position[axes[2]] = static_cast<float>(v);
+
+            const Vec2f size = Vec2f(static_cast<float>(width), static_cast<float>(height));
+            const std::size_t plane = (key >> 21U) & 0x000003FFU;
+            const std::size_t texture = (key >> 10U) & 0x000007FFU;
+            const std::size_t frames = (key >> 5U) & 0x0000001FU;
+            const std::size_t variants = key & 0x0000001FU;
+            ctx->quads[plane].push_back(make_chunk_quad(position, size, facing, texture, frames, variants));
+        }
     }
 }
 
-static void cache_chunk(WorkerContext *ctx, const ChunkCoord &cpos)
+static void cache_chunk(WorkerContext *ctx, const Chunk *chunk)
 {
-    const auto index = get_cached_cpos(ctx->coord, cpos);
-    if(const Chunk *chunk = world::find(cpos)) {
-        ctx->cache[index] = chunk->voxels;
-        return;
+    ctx->voxels = chunk->voxels;
+
+    for(VoxelFacing facing = FACING_NORTH; facing <= FACING_DOWN; ++facing) {
+        const std::size_t *axes = FACE_AXES[facing];
+        VoxelSlab &slab = ctx->neighbours[facing];
+
+        if(const Chunk *neighbour = world::find(ctx->coord + ChunkCoord(FACE_DIRECTIONS[facing]))) {
+            // The neighbour's layer touching the
+            // chunk is on the far side of it
+            const std::size_t layer = (FACE_DIRECTIONS[facing][axes[0]] > 0) ? 0 : (CHUNK_SIZE - 1);
+            const std::size_t base = layer * AXIS_STRIDES[axes[0]];
+            const std::size_t u_stride = AXIS_STRIDES[axes[1]];
+            const std::size_t v_stride = AXIS_STRIDES[axes[2]];
+
+            for(std::size_t v = 0; v < CHUNK_SIZE; ++v) {
+                for(std::size_t u = 0; u < CHUNK_SIZE; ++u) {
+                    slab[v * CHUNK_SIZE + u] = neighbour->voxels[base + v * v_stride + u * u_stride];
+                }
+            }
+
+            continue;
+        }
+
+        // Faces along the edge of the
+        // loaded world are always visible
+        slab.fill(NULL_VOXEL);
     }
 }
 
 static void process(WorkerContext *ctx)
 {
+    PROFILER_ZONE("chunk_mesher::process");
+
+    const std::uint64_t start_time = epoch::microseconds();
+
     ctx->quads.resize(voxel_atlas::plane_count());
+    ctx->faces.reset(new std::uint32_t[NUM_FACE_SLICES * CHUNK_AREA]);
 
-    const VoxelStorage &voxels = ctx->cache.at(CPOS_ITSELF);
+    classify_voxels(ctx);
 
-    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
-        if(ctx->is_cancelled) {
+    for(std::size_t y = 0; y < CHUNK_SIZE; ++y) {
+        if(ctx->is_cancelled.load(std::memory_order_relaxed)) {
             ctx->quads.clear();
             return;
         }
 
-        const auto voxel = voxels[i];
-        const auto lpos = LocalCoord::from_index(i);
+        for(std::size_t z = 0; z < CHUNK_SIZE; ++z) {
+            const std::size_t row = get_row(y + 1, z + 1);
 
-        const VoxelInfo *info = vdef::find(voxel);
+            for(VoxelFacing facing = FACING_NORTH; facing <= FACING_DOWN; ++facing) {
+                if(const std::uint32_t visible = get_visible(ctx, row, facing)) {
+                    add_faces(ctx, y, z, facing, visible);
+                }
+            }
+        }
+    }
 
-        if(info == nullptr) {
-            // Either a NULL_VOXEL or something went
-            // horribly wrong and we don't what this is
-            continue;
+    for(std::size_t slice = 0; slice < NUM_FACE_SLICES; ++slice) {
+        if(ctx->is_cancelled.load(std::memory_order_relaxed)) {
+            ctx->quads.clear();
+            return;
         }
 
-        VoxelVis vis = 0;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_north()))
-            vis |= VIS_NORTH;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_south()))
-            vis |= VIS_SOUTH;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_east()))
-            vis |= VIS_EAST;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_west()))
-            vis |= VIS_WEST;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_up()))
-            vis |= VIS_UP;
-        if(vis_test(ctx, voxel, info, lpos + LocalCoord::dir_down()))
-            vis |= VIS_DOWN;
-
-        const VoxelCoord vpos = ChunkCoord::to_voxel(ctx->coord, lpos);
-        const VoxelCoord::value_type entropy_src = vpos[0] * vpos[1] * vpos[2];
-        const auto entropy = crc64::get(&entropy_src, sizeof(entropy_src));
-
-        // FIXME: handle different voxel types
-        make_cube(ctx, voxel, info, lpos, vis, entropy);
+        merge_slice(ctx, slice);
     }
+
+    // Contexts stay around until the mesh is finalized
+    // and faces are of no use to anyone after this
+    ctx->faces.reset();
+
+    ctx->process_time = epoch::microseconds() - start_time;
 }
 
 static void finalize(WorkerContext *ctx, entt::entity entity)
@@ -245,36 +436,211 @@ static void finalize(WorkerContext *ctx, entt::entity entity)
 // The code generated by MSVC on Debug configuration is
 // just so slow and full of whatever debug shit the compiler
 // decides to put there, it is slower than generating terrain.
-constexpr static const size_t MESHER_THREADS_COUNT = 1;
-constexpr static const size_t MESHER_TASKS_PER_FRAME = 16;
+constexpr static unsigned int MAX_DEFAULT_THREADS = 1U;
 #else
-constexpr static const size_t MESHER_THREADS_COUNT = 2;
-constexpr static const size_t MESHER_TASKS_PER_FRAME = 64;
+constexpr static unsigned int MAX_DEFAULT_THREADS = 64U;
 #endif
 
-static thread_pool workers_pool = thread_pool(MESHER_THREADS_COUNT);
+// Each thread is handed about as many jobs as it can
+// get through until the next frame; whatever is waiting
+// in the pool's queue can't be reordered when the view
+// moves or turns around, the heap of pending jobs can
+constexpr static std::size_t MIN_JOBS_PER_THREAD = 2U;
+constexpr static std::size_t MAX_JOBS_PER_THREAD = 256U;
+
+// The mesher never takes up more than this much of
+// the average frame time on the main thread, but it's
+// always allowed the minimum so that it doesn't stall
+constexpr static float FRAME_SHARE = 0.25f;
+constexpr static std::uint64_t MIN_FRAME_BUDGET_US = UINT64_C(500);
+
+// Waiting jobs are reordered once the view
+// turns away by more than about 25 degrees
+constexpr static float MIN_DIRECTION_DOT = 0.9f;
+
+// Chunks that are missing some of their neighbours wait
+// for them to arrive for this long and are meshed with
+// whatever is there once the time is up; the server may
+// not have the neighbours to send in the first place
+constexpr static std::uint64_t NEIGHBOUR_TIMEOUT_US = UINT64_C(1000000);
+
+unsigned int chunk_mesher::threads = 0U;
+unsigned int chunk_mesher::frame_budget = 4000U;
+
+struct MeshJob final {
+    float priority {};
+    ChunkCoord coord {};
+};
+
+static std::unique_ptr<thread_pool> workers_pool = {};
 static std::unordered_map<ChunkCoord, std::unique_ptr<WorkerContext>> workers = {};
 
+// Chunks waiting for a worker, kept as a heap with the
+// most important ones at the front; see get_priority
+static std::vector<MeshJob> jobs = {};
+static ChunkCoord jobs_cpos = {};
+static Vec3f jobs_direction = {};
+
+// Running average of how long
+// a job takes, in microseconds
+static float job_time_avg = 0.0f;
+
+// Workers counts meshes being built or waiting to
+// be finalized, queued those no thread has picked up yet
+// and pending chunks that haven't been handed to the pool;
+// waiting chunks are missing neighbours and timeouts count
+// the ones that got tired of it; job times are how long
+// workers take to build a mesh
+static TelemetryCounter num_finalized = {};
+static TelemetryCounter num_enqueued = {};
+static TelemetryGauge num_workers = {};
+static TelemetryGauge num_queued = {};
+static TelemetryGauge num_pending = {};
+static TelemetryGauge num_waiting = {};
+static TelemetryCounter num_timeouts = {};
+static TelemetryHistogram job_time = {};
+
 // Bogus internal flag component
 struct NeedsMeshingComponent final {};
 
+// Chunks that need meshing but don't get
+// a job until the neighbours are there
+struct WaitsForNeighboursComponent final {
+    std::uint64_t deadline {};
+};
+
+static bool compare_jobs(const MeshJob &a, const MeshJob &b)
+{
+    return a.priority > b.priority;
+}
+
+// Distance from the view in chunks; chunks straight
+// ahead count as they are and ones right behind the view
+// as twice as far, so the world fills in where one looks
+static float get_priority(const ChunkCoord &cpos)
+{
+    const Vec3f offset = Vec3f(cpos - jobs_cpos);
+    const float distance = Vec3f::length(offset);
+
+    if(distance > 0.0f)
+        return distance * (1.5f - 0.5f * Vec3f::dot(offset, jobs_direction) / distance);
+    return 0.0f;
+}
+
+static void update_priorities(void)
+{
+    if((jobs_cpos == view::position.chunk) && (Vec3f::dot(jobs_direction, view::direction) >= MIN_DIRECTION_DOT))
+        return;
+
+    jobs_cpos = view::position.chunk;
+    jobs_direction = view::direction;
+
+    for(MeshJob &job : jobs)
+        job.priority = get_priority(job.coord);
+    std::make_heap(jobs.begin(), jobs.end(), &compare_jobs);
+}
+
+static void push_job(const ChunkCoord &cpos)
+{
+    MeshJob job = {};
+    job.priority = get_priority(cpos);
+    job.coord = cpos;
+
+    jobs.push_back(job);
+    std::push_heap(jobs.begin(), jobs.end(), &compare_jobs);
+}
+
+// A neighbour can only change the mesh of a chunk
+// that has some voxels along the side they share
+static bool has_border(const Chunk *chunk, VoxelFacing facing)
+{
+    const std::size_t *axes = FACE_AXES[facing];
+    const std::size_t layer = (FACE_DIRECTIONS[facing][axes[0]] > 0) ? (CHUNK_SIZE - 1) : 0;
+    const std::size_t base = layer * AXIS_STRIDES[axes[0]];
+    const std::size_t u_stride = AXIS_STRIDES[axes[1]];
+    const std::size_t v_stride = AXIS_STRIDES[axes[2]];
+
+    for(std::size_t v = 0; v < CHUNK_SIZE; ++v) {
+        for(std::size_t u = 0; u < CHUNK_SIZE; ++u) {
+            if(chunk->voxels[base + v * v_stride + u * u_stride] != NULL_VOXEL) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static bool has_neighbours(const Chunk *chunk, const ChunkCoord &cpos)
+{
+    for(VoxelFacing facing = FACING_NORTH; facing <= FACING_DOWN; ++facing) {
+        if(world::find(cpos + ChunkCoord(FACE_DIRECTIONS[facing])))
+            continue;
+        if(has_border(chunk, facing))
+            return false;
+    }
+
+    return true;
+}
+
+// Chunks marked while they're loaded in may wait for their
+// neighbours so that they get a single job once the area is
+// there instead of one for every neighbour that shows up;
+// edits and updates are always meshed as soon as possible
+static void mark_for_meshing(const Chunk *chunk, const ChunkCoord &cpos, bool may_wait)
+{
+    if(!globals::registry.all_of<NeedsMeshingComponent>(chunk->entity)) {
+        globals::registry.emplace<NeedsMeshingComponent>(chunk->entity);
+
+        if(may_wait && !has_neighbours(chunk, cpos)) {
+            auto &component = globals::registry.emplace<WaitsForNeighboursComponent>(chunk->entity);
+            component.deadline = globals::curtime + NEIGHBOUR_TIMEOUT_US;
+            return;
+        }
+
+        push_job(cpos);
+        return;
+    }
+
+    // Chunks already marked and not waiting
+    // have their job in the heap; the rest
+    // might be done waiting by now
+    if(globals::registry.all_of<WaitsForNeighboursComponent>(chunk->entity)) {
+        if(!may_wait || has_neighbours(chunk, cpos)) {
+            globals::registry.remove<WaitsForNeighboursComponent>(chunk->entity);
+            push_job(cpos);
+        }
+    }
+}
+
+static std::uint64_t get_frame_budget(void)
+{
+    const float share = FRAME_SHARE * 1000000.0f * globals::frametime_avg;
+    const std::uint64_t budget = cxpr::max(MIN_FRAME_BUDGET_US, static_cast<std::uint64_t>(share));
+    return cxpr::min(budget, cxpr::max(MIN_FRAME_BUDGET_US, static_cast<std::uint64_t>(chunk_mesher::frame_budget)));
+}
+
+static std::size_t get_jobs_per_thread(void)
+{
+    if(job_time_avg <= 0.0f)
+        return MIN_JOBS_PER_THREAD;
+    const float jobs = 1000000.0f * globals::frametime_avg / job_time_avg;
+    return cxpr::clamp(static_cast<std::size_t>(jobs), MIN_JOBS_PER_THREAD, MAX_JOBS_PER_THREAD);
+}
+
 static void on_chunk_create(const ChunkCreateEvent &event)
 {
-    const std::array<ChunkCoord, 6> neighbours = {
-        event.coord + ChunkCoord::dir_north(),
-        event.coord + ChunkCoord::dir_south(),
-        event.coord + ChunkCoord::dir_east(),
-        event.coord + ChunkCoord::dir_west(),
-        event.coord + ChunkCoord::dir_up(),
-        event.coord + ChunkCoord::dir_down(),
-    };
+    mark_for_meshing(event.chunk, event.coord, true);
 
-    globals::registry.emplace_or_replace<NeedsMeshingComponent>(event.chunk->entity);
+    // Faces go in opposite pairs, so the neighbour's side
+    // touching the new chunk is the facing with the low bit flipped
+    for(VoxelFacing facing = FACING_NORTH; facing <= FACING_DOWN; ++facing) {
+        const ChunkCoord cpos = event.coord + ChunkCoord(FACE_DIRECTIONS[facing]);
 
-    for(const ChunkCoord &cpos : neighbours) {
         if(const Chunk *chunk = world::find(cpos)) {
-            globals::registry.emplace_or_replace<NeedsMeshingComponent>(chunk->entity);
-            continue;
+            if(has_border(chunk, static_cast<VoxelFacing>(facing ^ 1U))) {
+                mark_for_meshing(chunk, cpos, true);
+            }
         }
     }
 }
@@ -284,7 +650,7 @@ static void on_chunk_remove(const ChunkRemoveEvent &event)
     const auto it = workers.find(event.coord);
     if(it == workers.cend())
         return;
-    it->second->is_cancelled = true;
+    it->second->is_cancelled.store(true, std::memory_order_relaxed);
 }
 
 static void on_chunk_update(const ChunkUpdateEvent &event)
@@ -298,63 +664,107 @@ static void on_chunk_update(const ChunkUpdateEvent &event)
         event.coord + ChunkCoord::dir_down(),
     };
 
-    globals::registry.emplace_or_replace<NeedsMeshingComponent>(event.chunk->entity);
+    mark_for_meshing(event.chunk, event.coord, false);
 
     for(const ChunkCoord &cpos : neighbours) {
         if(const Chunk *chunk = world::find(cpos)) {
-            globals::registry.emplace_or_replace<NeedsMeshingComponent>(chunk->entity);
+            mark_for_meshing(chunk, cpos, false);
             continue;
         }
     }
 }
 
-static void on_voxel_set(const VoxelSetEvent &event)
+static void on_voxel_batch(const VoxelBatchEvent &event)
 {
-    globals::registry.emplace_or_replace<NeedsMeshingComponent>(event.chunk->entity);
+    mark_for_meshing(event.chunk, event.cpos, false);
+
+    // Neighbours sharing a face with any of
+    // the changed voxels; each one is marked once
+    // however many voxels along that face changed
+    std::array<bool, 6> neighbours = {};
 
-    std::vector<ChunkCoord> neighbours = {};
+    for(const VoxelSetEvent &voxel : event.voxels) {
+        for(int dim = 0; dim < 3; ++dim) {
+            if(voxel.lpos[dim] == 0) {
+                neighbours[2 * dim + 0] = true;
+                continue;
+            }
+
+            if(voxel.lpos[dim] == (CHUNK_SIZE - 1)) {
+                neighbours[2 * dim + 1] = true;
+                continue;
+            }
+        }
+    }
 
     for(int dim = 0; dim < 3; ++dim) {
         ChunkCoord offset = ChunkCoord(0, 0, 0);
         offset[dim] = 1;
 
-        if(event.lpos[dim] == 0) {
-            neighbours.push_back(event.cpos - offset);
-            continue;
-        }
-
-        if(event.lpos[dim] == (CHUNK_SIZE - 1)) {
-            neighbours.push_back(event.cpos + offset);
-            continue;
+        if(neighbours[2 * dim + 0]) {
+            if(const Chunk *chunk = world::find(event.cpos - offset)) {
+                mark_for_meshing(chunk, event.cpos - offset, false);
+            }
         }
-    }
 
-    for(const ChunkCoord &cpos : neighbours) {
-        if(const Chunk *chunk = world::find(cpos)) {
-            globals::registry.emplace_or_replace<NeedsMeshingComponent>(chunk->entity);
-            continue;
+        if(neighbours[2 * dim + 1]) {
+            if(const Chunk *chunk = world::find(event.cpos + offset)) {
+                mark_for_meshing(chunk, event.cpos + offset, false);
+            }
         }
     }
 }
 
 void chunk_mesher::init(void)
 {
+    Config::add(globals::client_config, "chunk_mesher.threads", chunk_mesher::threads);
+    Config::add(globals::client_config, "chunk_mesher.frame_budget", chunk_mesher::frame_budget);
+
+    telemetry::add("mesher.finalized", num_finalized);
+    telemetry::add("mesher.enqueued", num_enqueued);
+    telemetry::add("mesher.workers", num_workers);
+    telemetry::add("mesher.queued", num_queued);
+    telemetry::add("mesher.pending", num_pending);
+    telemetry::add("mesher.waiting", num_waiting);
+    telemetry::add("mesher.timeouts", num_timeouts);
+    telemetry::add("mesher.job_us", job_time);
+
     globals::dispatcher.sink<ChunkCreateEvent>().connect<&on_chunk_create>();
     globals::dispatcher.sink<ChunkRemoveEvent>().connect<&on_chunk_remove>();
     globals::dispatcher.sink<ChunkUpdateEvent>().connect<&on_chunk_update>();
-    globals::dispatcher.sink<VoxelSetEvent>().connect<&on_voxel_set>();
+    globals::dispatcher.sink<VoxelBatchEvent>().connect<&on_voxel_batch>();
+}
+
+void chunk_mesher::init_late(void)
+{
+    if(!chunk_mesher::threads) {
+        // One core is left for the main thread; everything
+        // else the mesher can have while the world loads in
+        const unsigned int cores = cxpr::max(2U, std::thread::hardware_concurrency());
+        chunk_mesher::threads = cxpr::min(cores - 1U, MAX_DEFAULT_THREADS);
+    }
+
+    workers_pool = std::make_unique<thread_pool>(chunk_mesher::threads);
+
+    spdlog::info("chunk_mesher: using {} threads", chunk_mesher::threads);
 }
 
 void chunk_mesher::deinit(void)
 {
     for(auto &worker : workers)
-        worker.second->is_cancelled = true;
-    workers_pool.wait_for_tasks();
+        worker.second->is_cancelled.store(true, std::memory_order_relaxed);
+    workers_pool.reset();
     workers.clear();
+    jobs.clear();
 }
 
 void chunk_mesher::update(void)
 {
+    PROFILER_ZONE("chunk_mesher::update");
+
+    const std::uint64_t start_time = epoch::microseconds();
+    const std::uint64_t budget = get_frame_budget();
+
     std::size_t finalized = 0;
     std::size_t enqueued = 0;
 
@@ -370,16 +780,18 @@ void chunk_mesher::update(void)
             continue;
         }
 
-        if(worker->second->is_cancelled) {
+        if(worker->second->is_cancelled.load(std::memory_order_relaxed)) {
             worker = workers.erase(worker);
             continue;
         }
 
+        // Chunks marked again while the job was running
+        // still get its mesh: it's newer than the one they
+        // have now and the next job is already on its way
         if(const Chunk *chunk = world::find(worker->second->coord)) {
-            if(globals::registry.any_of<NeedsMeshingComponent>(chunk->entity)) {
-                worker = workers.erase(worker);
-                continue;
-            }
+            const float time = static_cast<float>(worker->second->process_time);
+            job_time_avg = (job_time_avg > 0.0f) ? (0.9f * job_time_avg + 0.1f * time) : time;
+            job_time.record(worker->second->process_time);
 
             finalize(worker->second.get(), chunk->entity);
             finalized += 1U;
@@ -387,44 +799,88 @@ void chunk_mesher::update(void)
 
         worker = workers.erase(worker);
 
-        if(finalized >= MESHER_TASKS_PER_FRAME)
+        if((epoch::microseconds() - start_time) >= budget)
             break;
         continue;
     }
 
-    const auto group = globals::registry.group<NeedsMeshingComponent>(entt::get<ChunkComponent>);
-    for(const auto [entity, chunk] : group.each()) {
-        const auto it = workers.find(chunk.coord);
+    const auto waiting = globals::registry.view<WaitsForNeighboursComponent, ChunkComponent>();
+
+    for(const auto [entity, component, chunk] : waiting.each()) {
+        if(globals::curtime >= component.deadline) {
+            globals::registry.remove<WaitsForNeighboursComponent>(entity);
+            push_job(chunk.coord);
+            num_timeouts.add();
+        }
+    }
+
+    update_priorities();
+
+    // Chunks whose previous mesh is still being
+    // built are put back once this frame is done
+    std::vector<MeshJob> deferred = {};
+
+    // The budget isn't allowed to starve the pool:
+    // every thread gets at least one job per frame
+    const std::size_t max_jobs = get_jobs_per_thread() * workers_pool->get_thread_count();
+    const std::size_t min_enqueued = workers_pool->get_thread_count();
+
+    while(!jobs.empty() && (workers_pool->get_tasks_total() < max_jobs)) {
+        if((enqueued >= min_enqueued) && ((epoch::microseconds() - start_time) >= budget))
+            break;
+
+        std::pop_heap(jobs.begin(), jobs.end(), &compare_jobs);
+        const MeshJob job = jobs.back();
+        jobs.pop_back();
+
+        const Chunk *chunk = world::find(job.coord);
+
+        if(!chunk || !globals::registry.all_of<NeedsMeshingComponent>(chunk->entity)) {
+            // The chunk has either been removed
+            // or handed to a worker under a job
+            // pushed by the chunk's previous life
+            continue;
+        }
+
+        if(globals::registry.all_of<WaitsForNeighboursComponent>(chunk->entity)) {
+            // Left over from the chunk's previous
+            // life as well; it gets a job of its own
+            // once it's done waiting
+            continue;
+        }
+
+        const auto it = workers.find(job.coord);
 
         if(it == workers.cend()) {
-            globals::registry.remove<NeedsMeshingComponent>(entity);
+            globals::registry.remove<NeedsMeshingComponent>(chunk->entity);
 
-            auto &worker = workers.emplace(chunk.coord, std::make_unique<WorkerContext>()).first->second;
-            worker->coord = chunk.coord;
+            auto &worker = workers.emplace(job.coord, std::make_unique<WorkerContext>()).first->second;
+            worker->coord = job.coord;
 
-            cache_chunk(worker.get(), chunk.coord);
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_north());
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_south());
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_east());
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_west());
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_up());
-            cache_chunk(worker.get(), chunk.coord + ChunkCoord::dir_down());
+            cache_chunk(worker.get(), chunk);
 
-            worker->future = workers_pool.submit(std::bind(&process, worker.get()));
+            worker->future = workers_pool->submit(std::bind(&process, worker.get()));
 
             enqueued += 1U;
         }
         else {
-            it->second->is_cancelled = true;
+            // However many times the chunk is marked
+            // meanwhile, it's meshed once more after the
+            // job that's running now is done with
+            deferred.push_back(job);
             continue;
         }
-
-        if(enqueued >= MESHER_TASKS_PER_FRAME)
-            break;
-        continue;
     }
 
-    if(finalized || enqueued) {
-        spdlog::info("mesher: {} {}", finalized, enqueued);
+    for(const MeshJob &job : deferred) {
+        jobs.push_back(job);
+        std::push_heap(jobs.begin(), jobs.end(), &compare_jobs);
     }
+
+    num_finalized.add(finalized);
+    num_enqueued.add(enqueued);
+    num_workers.set(static_cast<std::int64_t>(workers.size()));
+    num_queued.set(static_cast<std::int64_t>(workers_pool->get_tasks_queued()));
+    num_pending.set(static_cast<std::int64_t>(jobs.size()));
+    num_waiting.set(static_cast<std::int64_t>(waiting.size_hint()));
 }
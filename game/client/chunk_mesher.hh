@@ -8,9 +8,18 @@ struct ChunkMeshComponent final {
     std::vector<ChunkVBO> quad {};
 };
 
+namespace chunk_mesher
+{
+// Zero picks the thread count based on the hardware;
+// the budget is main thread time per frame in microseconds
+extern unsigned int threads;
+extern unsigned int frame_budget;
+} // namespace chunk_mesher
+
 namespace chunk_mesher
 {
 void init(void);
+void init_late(void);
 void deinit(void);
 void update(void);
 } // namespace chunk_mesher
@@ -8,10 +8,13 @@
 #include <utility>
 
 // [0] XXXXXXXXYYYYYYYYZZZZZZZZWWWWHHHH
-// [1] FFFFTTTTTTTTTTTAAAAA------------
+// [1] FFFFTTTTTTTTTTTAAAAAVVVVV-------
+// Positions are in 1/16 of a voxel, sizes are in whole
+// voxels, up to a chunk's worth; textures repeat every voxel
+// and each voxel of a quad picks one of the texture's variants
 using ChunkQuad = std::array<std::uint32_t, 2>;
 
-constexpr inline static ChunkQuad make_chunk_quad(const Vec3f &position, const Vec2f &size, VoxelFacing facing, std::size_t texture, std::size_t frames)
+constexpr inline static ChunkQuad make_chunk_quad(const Vec3f &position, const Vec2f &size, VoxelFacing facing, std::size_t texture, std::size_t frames, std::size_t variants)
 {
     ChunkQuad result = {};
     result[0] = 0x00000000;
@@ -23,15 +26,16 @@ constexpr inline static ChunkQuad make_chunk_quad(const Vec3f &position, const V
     result[0] |= (0x000000FFU & static_cast<std::uint32_t>(position[2] * 16.0f)) << 8U;
 
     // [0] ------------------------WWWWHHHH
-    result[0] |= (0x0000000FU & static_cast<std::uint32_t>(size[0] * 16.0f - 1.0f)) << 4U;
-    result[0] |= (0x0000000FU & static_cast<std::uint32_t>(size[1] * 16.0f - 1.0f));
+    result[0] |= (0x0000000FU & static_cast<std::uint32_t>(size[0] - 1.0f)) << 4U;
+    result[0] |= (0x0000000FU & static_cast<std::uint32_t>(size[1] - 1.0f));
 
     // [1] FFFF----------------------------
     result[1] |= (0x0000000FU & static_cast<std::uint32_t>(facing)) << 28U;
 
-    // [1] ----TTTTTTTTTTTAAAAA------------
+    // [1] ----TTTTTTTTTTTAAAAAVVVVV-------
     result[1] |= (0x000007FFU & static_cast<std::uint32_t>(texture)) << 17U;
     result[1] |= (0x0000001FU & static_cast<std::uint32_t>(frames)) << 12U;
+    result[1] |= (0x0000001FU & static_cast<std::uint32_t>(variants)) << 7U;
 
     return std::move(result);
 }
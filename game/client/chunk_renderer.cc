@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/profiler.hh>
 #include <entt/entity/registry.hpp>
 #include <game/client/chunk_mesher.hh>
 #include <game/client/chunk_quad.hh>
@@ -28,6 +29,7 @@ static std::size_t u_quad_world_position = {};
 static std::size_t u_quad_timings = {};
 static std::size_t u_quad_fog_color = {};
 static std::size_t u_quad_view_distance = {};
+static std::size_t u_quad_chunk_coord = {};
 static std::size_t u_quad_textures = {};
 static GLuint quad_vaobj = {};
 static GLuint quad_vbo = {};
@@ -44,6 +46,7 @@ void chunk_renderer::init(void)
     u_quad_timings = VariedProgram::add_uniform(quad_program, "u_Timings");
     u_quad_fog_color = VariedProgram::add_uniform(quad_program, "u_FogColor");
     u_quad_view_distance = VariedProgram::add_uniform(quad_program, "u_ViewDistance");
+    u_quad_chunk_coord = VariedProgram::add_uniform(quad_program, "u_ChunkCoord");
     u_quad_textures = VariedProgram::add_uniform(quad_program, "u_Textures");
 
     const Vec3f vertices[4] = {
@@ -74,6 +77,8 @@ void chunk_renderer::deinit(void)
 
 void chunk_renderer::render(void)
 {
+    PROFILER_ZONE("chunk_renderer::render");
+
     glEnable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
@@ -127,6 +132,11 @@ void chunk_renderer::render(void)
             const Vec3f wpos = ChunkCoord::to_vec3f(chunk.coord - view::position.chunk);
             glUniform3fv(quad_program.uniforms[u_quad_world_position].location, 1, wpos.data());
 
+            // Texture variants are picked by the absolute voxel
+            // position; coordinates only need to wrap around the same way
+            glUniform3ui(quad_program.uniforms[u_quad_chunk_coord].location, static_cast<GLuint>(chunk.coord[0]),
+                static_cast<GLuint>(chunk.coord[1]), static_cast<GLuint>(chunk.coord[2]));
+
             glBindBuffer(GL_ARRAY_BUFFER, mesh.quad[plane_id].handle);
 
             glEnableVertexAttribArray(1);
@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <game/shared/chunk.hh>
+#include <game/shared/chunk_coord.hh>
+
+struct ChunkCachedEvent final {
+    entt::entity entity {};
+    ChunkCoord chunk {};
+    VoxelStorage voxels {};
+};
@@ -1,8 +1,11 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/cmdline.hh>
+#include <common/profiler.hh>
 #include <common/config.hh>
 #include <common/epoch.hh>
 #include <common/fstools.hh>
+#include <common/telemetry.hh>
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/client/entity/player_look.hh>
@@ -10,6 +13,7 @@
 #include <game/client/event/glfw_framebuffer_size.hh>
 #include <game/client/background.hh>
 #include <game/client/chat.hh>
+#include <game/client/chunk_cache.hh>
 #include <game/client/chunk_mesher.hh>
 #include <game/client/chunk_renderer.hh>
 #include <game/client/chunk_visibility.hh>
@@ -24,6 +28,7 @@
 #include <game/client/message_box.hh>
 #include <game/client/metrics.hh>
 #include <game/client/mouse.hh>
+#include <game/client/network.hh>
 #include <game/client/outline.hh>
 #include <game/client/play_menu.hh>
 #include <game/client/player_target.hh>
@@ -38,6 +43,7 @@
 #include <game/client/view.hh>
 #include <game/client/voxel_anims.hh>
 #include <game/client/voxel_atlas.hh>
+#include <game/shared/capture.hh>
 #include <game/shared/entity/head.hh>
 #include <game/shared/entity/transform.hh>
 #include <game/shared/entity/velocity.hh>
@@ -48,6 +54,7 @@
 #include <GLFW/glfw3.h>
 #include <imgui_impl_opengl3.h>
 #include <imgui.h>
+#include <mathlib/constexpr.hh>
 #include <spdlog/spdlog.h>
 
 // Debug
@@ -64,6 +71,11 @@ unsigned int client_game::fog_mode = 1U;
 std::string client_game::username = "player";
 std::uint64_t client_game::player_uid = UINT64_MAX;
 
+// Seconds between telemetry snapshots written to
+// stats.log; off by default since players rarely care
+static unsigned int telemetry_interval = 0U;
+static std::uint64_t telemetry_time = UINT64_C(0);
+
 static void on_glfw_framebuffer_size(const GlfwFramebufferSizeEvent &event)
 {
     if(globals::world_fbo) {
@@ -165,6 +177,7 @@ void client_game::init(void)
 
     Config::add(globals::client_config, "game.username", client_game::username);
     Config::add(globals::client_config, "game.player_uid", client_game::player_uid);
+    Config::add(globals::client_config, "telemetry.interval", telemetry_interval);
 
     settings::add_checkbox(5, settings::VIDEO, "game.vertical_sync", client_game::vertical_sync, false);
     settings::add_checkbox(4, settings::VIDEO, "game.world_curvature", client_game::world_curvature, true);
@@ -173,7 +186,7 @@ void client_game::init(void)
 
     settings::add_input(1, settings::GENERAL, "game.username", client_game::username, true, false);
 
-    globals::client_host = enet_host_create(nullptr, 1, 1, 0, 0);
+    globals::client_host = enet_host_create(nullptr, 1, protocol::NUM_CHANNELS, 0, 0);
 
     if(!globals::client_host) {
         spdlog::critical("game: unable to setup an ENet host");
@@ -184,6 +197,8 @@ void client_game::init(void)
 
     session::init();
 
+    client_network::init();
+
     player_move::init();
     player_target::init();
 
@@ -197,6 +212,7 @@ void client_game::init(void)
 
     voxel_anims::init();
 
+    chunk_cache::init();
     chunk_mesher::init();
     chunk_renderer::init();
 
@@ -316,6 +332,31 @@ void client_game::init_late(void)
 
     client_chat::init_late();
 
+    client_network::init_late();
+
+    chunk_cache::init_late();
+
+    chunk_mesher::init_late();
+
+    std::string capture_path = {};
+    if(cmdline::get_value("capture", capture_path)) {
+        if(capture_path.empty())
+            capture_path = "capture.vcap";
+        capture::start(capture_path, CAPTURE_CLIENT, cmdline::contains("capture_sent"));
+    }
+
+    if(cmdline::contains("profile")) {
+        // Profile everything from the start; the
+        // zones are dumped to profile.json on exit
+        profiler::enable();
+    }
+
+    if(telemetry_interval) {
+        telemetry_interval = cxpr::min<unsigned int>(telemetry_interval, 3600U);
+        telemetry::open("stats.log");
+        telemetry_time = globals::curtime;
+    }
+
     game_voxels::populate();
 
     staging::init_late();
@@ -360,6 +401,18 @@ void client_game::deinit(void)
         while(enet_host_service(globals::client_host, nullptr, 50));
     }
 
+    client_network::deinit();
+
+    capture::stop();
+
+    if(cmdline::contains("profile")) {
+        profiler::disable();
+        profiler::dump("profile.json");
+    }
+
+    telemetry::write();
+    telemetry::close();
+
     staging::deinit();
 
     play_menu::deinit();
@@ -379,6 +432,8 @@ void client_game::deinit(void)
     chunk_renderer::deinit();
     chunk_mesher::deinit();
 
+    chunk_cache::deinit();
+
     globals::registry.clear();
 
     enet_host_destroy(globals::client_host);
@@ -415,25 +470,9 @@ void client_game::update_late(void)
         glfwSwapInterval(1);
     else glfwSwapInterval(0);
 
-    ENetEvent event = {};
-
-    while(enet_host_service(globals::client_host, &event, 0) > 0) {
-        if(event.type == ENET_EVENT_TYPE_CONNECT) {
-            session::send_login_request();
-            continue;
-        }
-
-        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
-            session::invalidate();
-            continue;
-        }
+    client_network::update();
 
-        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
-            protocol::receive(event.packet, event.peer);
-            enet_packet_destroy(event.packet);
-            continue;
-        }
-    }
+    session::update_late();
 
     if(globals::session_peer && (globals::curtime >= globals::session_send_time)) {
         globals::session_send_time = globals::curtime + globals::session_tick_dt;
@@ -446,6 +485,11 @@ void client_game::update_late(void)
     }
 
     play_menu::update_late();
+
+    if(telemetry_interval && ((globals::curtime - telemetry_time) >= UINT64_C(1000000) * telemetry_interval)) {
+        telemetry_time = globals::curtime;
+        telemetry::write();
+    }
 }
 
 void client_game::render(void)
@@ -4,6 +4,7 @@
 #include <common/config.hh>
 #include <common/epoch.hh>
 #include <common/image.hh>
+#include <common/profiler.hh>
 #include <config/cmake.hh>
 #include <entt/signal/dispatcher.hpp>
 #include <game/client/event/glfw_cursor_pos.hh>
@@ -15,6 +16,7 @@
 #include <game/client/globals.hh>
 #include <game/client/main.hh>
 #include <game/shared/splash.hh>
+#include <game/shared/world.hh>
 #include <glad/gl.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
@@ -252,7 +254,11 @@ void client::main(void)
 
     std::uint64_t last_curtime = globals::curtime;
 
+    profiler::set_thread_name("main");
+
     while(!glfwWindowShouldClose(globals::window)) {
+        PROFILER_ZONE("client::frame");
+
         globals::curtime = epoch::microseconds();
         globals::frametime_us = globals::curtime - last_curtime;
         globals::frametime = static_cast<float>(globals::frametime_us) / 1000000.0f;
@@ -310,6 +316,10 @@ void client::main(void)
 
         glfwPollEvents();
 
+        // World changes made during the frame are
+        // queued, one batch of them per changed chunk
+        world::flush_events();
+
         // EnTT provides two ways of dispatching events:
         // queued and immediate. When glfwPollEvents() is
         // called, immediate events are triggered across
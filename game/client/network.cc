@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <atomic>
+#include <common/config.hh>
+#include <common/mpsc_queue.hh>
+#include <common/profiler.hh>
+#include <entt/signal/dispatcher.hpp>
+#include <game/client/chunk_cache.hh>
+#include <game/client/event/chunk_cached.hh>
+#include <game/client/globals.hh>
+#include <game/client/network.hh>
+#include <game/client/session.hh>
+#include <game/shared/capture.hh>
+#include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
+#include <thread>
+
+constexpr static enet_uint32 SERVICE_TIMEOUT_MS = 1;
+
+struct IncomingMessage final {
+    protocol::Message message {};
+    std::size_t num_chunks {};
+};
+
+unsigned int client_network::chunks_per_frame = 64U;
+
+static std::atomic<bool> is_servicing = {};
+static std::thread network_thread = {};
+
+// Network thread -> main thread
+static MPSCQueue<IncomingMessage> incoming = {};
+// Main thread -> network thread
+static MPSCQueue<protocol::Message> outgoing = {};
+
+static void push_outgoing(protocol::Message &&message)
+{
+    outgoing.push(std::move(message));
+}
+
+static void flush_outgoing(void)
+{
+    protocol::Message message = {};
+    while(outgoing.pop(message)) {
+        message();
+    }
+}
+
+static void handle_chunk_hash(const protocol::ChunkHash &packet)
+{
+    ChunkCachedEvent cached = {};
+
+    // Reading a cached chunk means a file read, an inflate
+    // and a checksum; none of that belongs on the main thread
+    if(chunk_cache::load(packet.hash, cached.voxels)) {
+        cached.entity = packet.entity;
+        cached.chunk = packet.chunk;
+
+        IncomingMessage message = {};
+        message.num_chunks = 1;
+        message.message = [cached](void) {
+            globals::dispatcher.trigger(cached);
+        };
+
+        incoming.push(std::move(message));
+        return;
+    }
+
+    protocol::ChunkRequest request = {};
+    request.chunk = packet.chunk;
+    protocol::send(packet.peer, nullptr, request);
+}
+
+static void handle_event(const ENetEvent &event)
+{
+    IncomingMessage message = {};
+    protocol::ChunkHash chunk_hash = {};
+
+    if(event.type == ENET_EVENT_TYPE_CONNECT) {
+        capture::record(CAPTURE_CONNECT, event.peer);
+        protocol::reset_baselines(event.peer);
+        protocol::reset_traffic(event.peer);
+        protocol::add_peer(event.peer);
+        message.message = [](void) { session::send_login_request(); };
+        incoming.push(std::move(message));
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+        capture::record(CAPTURE_DISCONNECT, event.peer);
+        protocol::reset_baselines(event.peer);
+        protocol::reset_traffic(event.peer);
+        protocol::remove_peer(event.peer);
+        message.message = [](void) { session::invalidate(); };
+        incoming.push(std::move(message));
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+        capture::record(CAPTURE_RECEIVE, event.peer, event.channelID, event.packet);
+
+        if(protocol::decode(event.packet, event.peer, chunk_hash)) {
+            enet_packet_destroy(event.packet);
+            handle_chunk_hash(chunk_hash);
+            return;
+        }
+
+        // Chunk payloads are decompressed right here; the
+        // main thread only gets to copy them into the world
+        message.num_chunks = protocol::peek_num_chunks(event.packet);
+        message.message = protocol::decode(event.packet, event.peer);
+        enet_packet_destroy(event.packet);
+
+        if(message.message)
+            incoming.push(std::move(message));
+        return;
+    }
+}
+
+static void network_main(void)
+{
+    ENetEvent event = {};
+
+    profiler::set_thread_name("network");
+
+    while(is_servicing.load(std::memory_order_acquire)) {
+        flush_outgoing();
+
+        if(enet_host_service(globals::client_host, &event, SERVICE_TIMEOUT_MS) > 0) {
+            handle_event(event);
+
+            while(enet_host_check_events(globals::client_host, &event) > 0) {
+                handle_event(event);
+            }
+        }
+    }
+
+    flush_outgoing();
+    enet_host_flush(globals::client_host);
+}
+
+void client_network::init(void)
+{
+    Config::add(globals::client_config, "network.chunks_per_frame", client_network::chunks_per_frame);
+}
+
+void client_network::init_late(void)
+{
+    client_network::chunks_per_frame = cxpr::max(1U, client_network::chunks_per_frame);
+}
+
+void client_network::deinit(void)
+{
+    client_network::stop();
+}
+
+void client_network::update(void)
+{
+    IncomingMessage message = {};
+    std::size_t num_chunks = 0;
+
+    // Chunks are handed over in bounded batches so that
+    // streaming the world in doesn't cause frametime spikes;
+    // everything queued after the last chunk has to wait too
+    // so that the order in which packets arrived is kept intact
+    while((num_chunks < client_network::chunks_per_frame) && incoming.pop(message)) {
+        num_chunks += message.num_chunks;
+        message.message();
+    }
+
+    if(network_thread.joinable()) {
+        // Traffic counters belong to the network
+        // thread; they're merged once every frame
+        outgoing.push(&protocol::flush_traffic);
+    }
+}
+
+void client_network::start(void)
+{
+    if(!network_thread.joinable()) {
+        protocol::set_send_queue(&push_outgoing);
+        is_servicing.store(true, std::memory_order_release);
+        network_thread = std::thread(&network_main);
+    }
+}
+
+void client_network::stop(void)
+{
+    if(network_thread.joinable()) {
+        is_servicing.store(false, std::memory_order_release);
+        network_thread.join();
+    }
+
+    protocol::set_send_queue(nullptr);
+
+    IncomingMessage message = {};
+    while(incoming.pop(message)) {
+        // Whatever is left over belongs
+        // to a session that is gone now
+    }
+}
@@ -0,0 +1,25 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+
+namespace client_network
+{
+extern unsigned int chunks_per_frame;
+} // namespace client_network
+
+namespace client_network
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+void update(void);
+} // namespace client_network
+
+namespace client_network
+{
+// The network thread services the client host
+// for as long as there is a session; the host must
+// not be touched by anyone else while it's running
+void start(void);
+void stop(void);
+} // namespace client_network
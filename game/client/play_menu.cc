@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/epoch.hh>
 #include <common/fstools.hh>
 #include <common/strtools.hh>
 #include <cstdlib>
@@ -28,8 +29,10 @@ constexpr static ServerStatus STATUS_PING = 0x0001;
 constexpr static ServerStatus STATUS_FAIL = 0x0002;
 constexpr static ServerStatus STATUS_MOTD = 0x0003;
 
-// Maximum amount of peers used for bothering
-constexpr static std::size_t BOTHER_PEERS = 4;
+// Status queries are plain datagrams; a lost query
+// or reply is sent again a few times before giving up
+constexpr static std::uint64_t QUERY_RESEND_US = UINT64_C(750000);
+constexpr static unsigned int QUERY_ATTEMPTS = 3U;
 
 // Default name for a server
 // Mind you this is not translated
@@ -43,6 +46,11 @@ struct ServerStatusItem final {
     std::string server_motd {};
     ServerStatus status {};
     std::string name {};
+
+    ENetAddress query_address {};
+    std::uint32_t query_token {};
+    std::uint64_t query_time {};
+    unsigned int query_attempts {};
 };
 
 static std::string str_worlds_tab = {};
@@ -67,7 +75,9 @@ static bool editing_server = false;
 static bool adding_server = false;
 static bool needs_focus = false;
 
-static ENetHost *bother_host = nullptr;
+static ENetSocket query_socket = ENET_SOCKET_NULL;
+static std::uint32_t query_token = UINT32_C(0);
+static std::uint8_t query_data[ENET_PROTOCOL_MAXIMUM_MTU] = {};
 
 static void parse_hostname(ServerStatusItem *item, const std::string &hostname)
 {
@@ -113,13 +123,6 @@ static void edit_selected_server(void)
 
 static void remove_selected_server(void)
 {
-    for(std::size_t i = 0; i < bother_host->peerCount; ++i) {
-        if(bother_host->peers[i].data == static_cast<void *>(selected_server)) {
-            enet_peer_reset(&bother_host->peers[i]);
-            break;
-        }
-    }
-
     for(auto it = servers_deque.cbegin(); it != servers_deque.cend(); ++it) {
         if(selected_server == (*it)) {
             delete selected_server;
@@ -174,19 +177,47 @@ static void on_language_set(const LanguageSetEvent &event)
     str_server_fail = language::resolve("play_menu.server.fail");
 }
 
-// NOTE: client-side networking doesn't attach
-// anything to the peer's data field so we are free
-// to assume anything with non-null data is a bother peer
-static void on_status_response_packet(const protocol::StatusResponse &packet)
+static void send_status_query(ServerStatusItem *item, std::uint64_t curtime)
 {
-    if(packet.peer->data) {
-        ServerStatusItem *item = reinterpret_cast<ServerStatusItem *>(packet.peer->data);
-        item->max_players = packet.max_players;
-        item->num_players = packet.num_players;
-        item->server_motd = packet.motd;
-        item->status = STATUS_MOTD;
+    PacketBuffer buffer = {};
+    protocol::StatusQuery query = {};
+    query.version = protocol::VERSION;
+    query.token = item->query_token;
+    protocol::write_status_query(buffer, query);
+
+    ENetBuffer datagram = {};
+    datagram.data = buffer.vector.data();
+    datagram.dataLength = buffer.vector.size();
+    enet_socket_send(query_socket, &item->query_address, &datagram, 1);
+
+    item->query_time = curtime;
+    item->query_attempts += 1U;
+}
+
+static void receive_status_reply(const ENetAddress &address, std::size_t size)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, query_data, size);
+
+    protocol::StatusQueryReply reply = {};
+    if(!protocol::read_status_query_reply(buffer, reply))
+        return;
 
-        enet_peer_disconnect(packet.peer, 0);
+    for(ServerStatusItem *item : servers_deque) {
+        if(item->status != STATUS_PING)
+            continue;
+        if(item->query_token != reply.token)
+            continue;
+        if(item->query_address.host != address.host)
+            continue;
+        if(item->query_address.port != address.port)
+            continue;
+        
+        item->max_players = reply.max_players;
+        item->num_players = reply.num_players;
+        item->server_motd = reply.motd;
+        item->status = STATUS_MOTD;
+        return;
     }
 }
 
@@ -277,13 +308,6 @@ static void layout_server_edit(ServerStatusItem *item)
 
         input_itemname.clear();
         input_hostname.clear();
-
-        for(std::size_t i = 0; i < bother_host->peerCount; ++i) {
-            if(bother_host->peers[i].data == static_cast<void *>(selected_server)) {
-                enet_peer_reset(&bother_host->peers[i]);
-                break;
-            }
-        }
     }
 
     ImGui::EndDisabled();
@@ -386,16 +410,24 @@ void play_menu::init(void)
         }
     }
 
-    bother_host = enet_host_create(nullptr, BOTHER_PEERS, 1, 0, 0);
+    ENetAddress address = {};
+    address.host = ENET_HOST_ANY;
+    address.port = ENET_PORT_ANY;
 
-    if(!bother_host) {
-        spdlog::warn("play_menu: cannot create a bother ENetHost");
+    query_socket = enet_socket_create(ENET_SOCKET_TYPE_DATAGRAM);
+
+    if((query_socket == ENET_SOCKET_NULL) || (enet_socket_bind(query_socket, &address) < 0) || (enet_socket_set_option(query_socket, ENET_SOCKOPT_NONBLOCK, 1) < 0)) {
+        spdlog::warn("play_menu: cannot create a status query socket");
         spdlog::warn("play_menu: this is not a death scenario but server status will not be available");
+
+        if(query_socket != ENET_SOCKET_NULL) {
+            enet_socket_destroy(query_socket);
+            query_socket = ENET_SOCKET_NULL;
+        }
     }
 
     globals::dispatcher.sink<GlfwKeyEvent>().connect<&on_glfw_key>();
     globals::dispatcher.sink<LanguageSetEvent>().connect<&on_language_set>();
-    globals::dispatcher.sink<protocol::StatusResponse>().connect<&on_status_response_packet>();
 }
 
 void play_menu::deinit(void)
@@ -409,7 +441,10 @@ void play_menu::deinit(void)
         delete item;
     servers_deque.clear();
 
-    enet_host_destroy(bother_host);
+    if(query_socket != ENET_SOCKET_NULL) {
+        enet_socket_destroy(query_socket);
+        query_socket = ENET_SOCKET_NULL;
+    }
 }
 
 void play_menu::layout(void)
@@ -457,48 +492,49 @@ void play_menu::layout(void)
 
 void play_menu::update_late(void)
 {
-    ENetEvent event = {};
-    std::size_t num_free_peers = 0;
+    if(query_socket == ENET_SOCKET_NULL)
+        return;
 
-    for(std::size_t i = 0; i < bother_host->peerCount; ++i) {
-        if(bother_host->peers[i].state != ENET_PEER_STATE_DISCONNECTED)
-            continue;
-        num_free_peers += 1;
-    }
+    const std::uint64_t curtime = epoch::microseconds();
 
     for(ServerStatusItem *item : servers_deque) {
-        if(num_free_peers && (item->status == STATUS_INIT)) {
-            ENetAddress address = {};
-            enet_address_set_host(&address, item->peer_host.c_str());
-            address.port = item->peer_port;
-
-            if(ENetPeer *peer = enet_host_connect(bother_host, &address, 1, 0)) {
-                item->status = STATUS_PING;
-                peer->data = item;
-                break;
+        if(item->status == STATUS_INIT) {
+            if(enet_address_set_host(&item->query_address, item->peer_host.c_str()) < 0) {
+                item->status = STATUS_FAIL;
+                continue;
             }
-        }
-    }
 
-    if(enet_host_service(bother_host, &event, 0) > 0) {
-        if(event.type == ENET_EVENT_TYPE_CONNECT) {
-            protocol::StatusRequest request = {};
-            request.version = protocol::VERSION;
-            protocol::send(event.peer, nullptr, request);
-            return;
+            // A fresh token for every refresh makes sure
+            // late replies to older queries are ignored
+            item->query_address.port = item->peer_port;
+            item->query_token = ++query_token;
+            item->query_attempts = 0U;
+            item->status = STATUS_PING;
+
+            send_status_query(item, curtime);
+            continue;
         }
 
-        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
-            ServerStatusItem *item = reinterpret_cast<ServerStatusItem *>(event.peer->data);
-            if(item->status != STATUS_MOTD)
+        if((item->status == STATUS_PING) && (curtime - item->query_time >= QUERY_RESEND_US)) {
+            if(item->query_attempts >= QUERY_ATTEMPTS) {
                 item->status = STATUS_FAIL;
-            return;
-        }
+                continue;
+            }
 
-        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
-            protocol::receive(event.packet, event.peer);
-            enet_packet_destroy(event.packet);
-            return;
+            send_status_query(item, curtime);
+            continue;
         }
     }
+
+    ENetAddress address = {};
+    ENetBuffer buffer = {};
+    buffer.data = query_data;
+    buffer.dataLength = sizeof(query_data);
+
+    while(true) {
+        const int result = enet_socket_receive(query_socket, &address, &buffer, 1);
+        if(result <= 0)
+            break;
+        receive_status_reply(address, static_cast<std::size_t>(result));
+    }
 }
@@ -11,12 +11,14 @@
 constexpr static ImGuiWindowFlags WINDOW_FLAGS = ImGuiWindowFlags_NoBackground | ImGuiWindowFlags_NoDecoration;
 
 static std::string str_title = {};
+static std::string str_status = {};
 static std::string str_button = {};
 static ProgressBarAction button_action = {};
 
 void progress::init(void)
 {
     str_title = "Loading";
+    str_status = std::string();
     str_button = std::string();
     button_action = nullptr;
 }
@@ -37,6 +39,12 @@ void progress::layout(void)
         ImGui::SetCursorPosX(0.5f * (window_size.x - title_width));
         ImGui::TextUnformatted(str_title.c_str());
 
+        if(!str_status.empty()) {
+            const float status_width = ImGui::CalcTextSize(str_status.c_str()).x;
+            ImGui::SetCursorPosX(0.5f * (window_size.x - status_width));
+            ImGui::TextDisabled("%s", str_status.c_str());
+        }
+
         ImGui::Dummy(ImVec2(0.0f, 8.0f * globals::gui_scale));
 
         const ImVec2 cursor = ImGui::GetCursorPos();
@@ -95,6 +103,7 @@ void progress::layout(void)
 void progress::reset(void)
 {
     str_title.clear();
+    str_status.clear();
     str_button.clear();
     button_action = nullptr;
 }
@@ -104,6 +113,13 @@ void progress::set_title(const std::string &title)
     str_title = language::resolve(title);
 }
 
+void progress::set_status(const std::string &status)
+{
+    // Not a language key; this is
+    // meant for things like counters
+    str_status = status;
+}
+
 void progress::set_button(const std::string &text, const ProgressBarAction &action)
 {
     str_button = fmt::format("{}###ProgressBar_Button", language::resolve(text));
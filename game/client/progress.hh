@@ -15,5 +15,6 @@ namespace progress
 {
 void reset(void);
 void set_title(const std::string &title);
+void set_status(const std::string &status);
 void set_button(const std::string &text, const ProgressBarAction &action);
 } // namespace progress
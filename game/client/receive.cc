@@ -3,6 +3,8 @@
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/client/chat.hh>
+#include <game/client/chunk_cache.hh>
+#include <game/client/event/chunk_cached.hh>
 #include <game/client/globals.hh>
 #include <game/client/gui_screen.hh>
 #include <game/client/receive.hh>
@@ -30,25 +32,52 @@ static bool make_entity(entt::entity entity)
     return true;
 }
 
+static void emplace_chunk(entt::entity entity, const ChunkCoord &cpos, const VoxelStorage &voxels)
+{
+    if(!globals::registry.valid(entity)) {
+        entt::entity created = globals::registry.create(entity);
+
+        if(created != entity) {
+            globals::registry.destroy(created);
+            session::disconnect("protocol.chunk_entity_mismatch");
+            spdlog::critical("receive: chunk entity mismatch");
+            return;
+        }
+    }
+
+    Chunk *chunk = Chunk::create(ChunkType::Generic);
+    chunk->entity = entity;
+    chunk->voxels = voxels;
+
+    world::emplace_or_replace(cpos, chunk);
+}
+
 static void on_chunk_voxels_packet(const protocol::ChunkVoxels &packet)
 {
     if(globals::session_peer) {
-        if(!globals::registry.valid(packet.entity)) {
-            entt::entity created = globals::registry.create(packet.entity);
-
-            if(created != packet.entity) {
-                globals::registry.destroy(created);
-                session::disconnect("protocol.chunk_entity_mismatch");
-                spdlog::critical("receive: chunk entity mismatch");
-                return;
-            }
+        chunk_cache::store(packet.voxels);
+        emplace_chunk(packet.entity, packet.chunk, packet.voxels);
+    }
+}
+
+static void on_chunk_bundle_packet(const protocol::ChunkBundle &packet)
+{
+    for(const protocol::ChunkBundle::Entry &entry : packet.chunks) {
+        if(!globals::session_peer) {
+            // A chunk entity mismatch
+            // has disconnected us midway
+            return;
         }
 
-        Chunk *chunk = Chunk::create(ChunkType::Generic);
-        chunk->entity = packet.entity;
-        chunk->voxels = packet.voxels;
+        chunk_cache::store(entry.voxels);
+        emplace_chunk(entry.entity, entry.chunk, entry.voxels);
+    }
+}
 
-        world::emplace_or_replace(packet.chunk, chunk);
+static void on_chunk_cached(const ChunkCachedEvent &event)
+{
+    if(globals::session_peer) {
+        emplace_chunk(event.entity, event.chunk, event.voxels);
     }
 }
 
@@ -115,11 +144,15 @@ static void on_remove_entity_packet(const protocol::RemoveEntity &packet)
             globals::player = entt::null;
         globals::registry.destroy(packet.entity);
     }
+
+    protocol::reset_baselines(packet.entity);
 }
 
 void client_receive::init(void)
 {
     globals::dispatcher.sink<protocol::ChunkVoxels>().connect<&on_chunk_voxels_packet>();
+    globals::dispatcher.sink<protocol::ChunkBundle>().connect<&on_chunk_bundle_packet>();
+    globals::dispatcher.sink<ChunkCachedEvent>().connect<&on_chunk_cached>();
     globals::dispatcher.sink<protocol::EntityHead>().connect<&on_entity_head_packet>();
     globals::dispatcher.sink<protocol::EntityTransform>().connect<&on_entity_transform_packet>();
     globals::dispatcher.sink<protocol::EntityVelocity>().connect<&on_entity_velocity_packet>();
@@ -7,16 +7,36 @@
 #include <game/client/globals.hh>
 #include <game/client/gui_screen.hh>
 #include <game/client/message_box.hh>
+#include <game/client/network.hh>
 #include <game/client/progress.hh>
 #include <game/client/session.hh>
-#include <game/shared/event/chunk_update.hh>
-#include <game/shared/event/voxel_set.hh>
+#include <game/shared/event/voxel_batch.hh>
 #include <game/shared/chunk_coord.hh>
 #include <game/shared/local_coord.hh>
 #include <game/shared/protocol.hh>
 #include <game/shared/voxel_coord.hh>
 #include <game/shared/world.hh>
+#include <spdlog/fmt/fmt.h>
 #include <spdlog/spdlog.h>
+#include <vector>
+
+// Chunks of the spawn area that have been advertised
+// but are not in the world yet; the server doesn't spawn
+// the player until SpawnReady is sent, see session::update_late
+static std::vector<ChunkCoord> spawn_chunks = {};
+static std::size_t spawn_num_chunks = 0;
+static std::size_t spawn_num_advertised = 0;
+static bool spawn_is_loading = false;
+static bool spawn_is_complete = false;
+
+static void reset_spawn_area(void)
+{
+    spawn_chunks.clear();
+    spawn_num_chunks = 0;
+    spawn_num_advertised = 0;
+    spawn_is_loading = false;
+    spawn_is_complete = false;
+}
 
 static void on_login_response_packet(const protocol::LoginResponse &packet)
 {
@@ -29,12 +49,46 @@ static void on_login_response_packet(const protocol::LoginResponse &packet)
     globals::session_send_time = 0;
     globals::session_username = packet.username;
     
-    progress::set_title("connecting.loading_world");    
+    reset_spawn_area();
+
+    progress::set_title("connecting.loading_world");
+}
+
+static void on_spawn_area_packet(const protocol::SpawnArea &packet)
+{
+    if(packet.type == protocol::SpawnArea::STREAMING) {
+        spawn_chunks.clear();
+        spawn_num_chunks = packet.num_chunks;
+        spawn_num_advertised = 0;
+        spawn_is_loading = true;
+        spawn_is_complete = false;
+        return;
+    }
+
+    if(packet.type == protocol::SpawnArea::COMPLETE) {
+        spawn_num_chunks = packet.num_chunks;
+        spawn_is_complete = true;
+        return;
+    }
+}
+
+static void on_chunk_hash_packet(const protocol::ChunkHash &packet)
+{
+    // Everything advertised after the spawn
+    // area is the background fill; the player
+    // doesn't have to wait for any of it
+    if(spawn_is_loading && !spawn_is_complete) {
+        spawn_chunks.push_back(packet.chunk);
+        spawn_num_advertised += 1;
+    }
 }
 
 static void on_disconnect_packet(const protocol::Disconnect &packet)
 {
-    enet_peer_disconnect(globals::session_peer, 0);
+    // Nobody is going to service the host
+    // after this, so the disconnect has to be immediate
+    client_network::stop();
+    enet_peer_disconnect_now(globals::session_peer, 0);
 
     spdlog::info("session: disconnected: {}", packet.reason);
 
@@ -69,15 +123,11 @@ static void on_set_voxel_packet(const protocol::SetVoxel &packet)
         if(chunk->voxels[index] != packet.voxel) {
             chunk->voxels[index] = packet.voxel;
             
-            ChunkUpdateEvent event = {};
-            event.coord = cpos;
-            event.chunk = chunk;
-            
-            // Send a generic ChunkUpdate event to shake
+            // Queue a generic ChunkUpdate event to shake
             // up the mesher; directly calling world::set_voxel
             // here would result in a networked feedback loop
             // caused by event handler below tripping
-            globals::dispatcher.trigger(event);
+            world::invalidate(cpos);
         }
     }
 }
@@ -85,11 +135,13 @@ static void on_set_voxel_packet(const protocol::SetVoxel &packet)
 // NOTE: [session] is a good place for this since [receive]
 // handles entity data sent by the server and [session] handles
 // everything else network related that is not player movement
-static void on_voxel_set(const VoxelSetEvent &event)
+static void on_voxel_batch(const VoxelBatchEvent &event)
 {
     if(globals::session_peer) {
         // Propagate changes to the server
-        protocol::send_set_voxel(globals::session_peer, nullptr, event.vpos, event.voxel);
+        for(const VoxelSetEvent &voxel : event.voxels) {
+            protocol::send_set_voxel(globals::session_peer, nullptr, voxel.vpos, voxel.voxel);
+        }
     }
 }
 
@@ -104,8 +156,10 @@ void session::init(void)
     globals::dispatcher.sink<protocol::LoginResponse>().connect<&on_login_response_packet>();
     globals::dispatcher.sink<protocol::Disconnect>().connect<&on_disconnect_packet>();
     globals::dispatcher.sink<protocol::SetVoxel>().connect<&on_set_voxel_packet>();
+    globals::dispatcher.sink<protocol::SpawnArea>().connect<&on_spawn_area_packet>();
+    globals::dispatcher.sink<protocol::ChunkHash>().connect<&on_chunk_hash_packet>();
 
-    globals::dispatcher.sink<VoxelSetEvent>().connect<&on_voxel_set>();
+    globals::dispatcher.sink<VoxelBatchEvent>().connect<&on_voxel_batch>();
 }
 
 void session::deinit(void)
@@ -114,13 +168,43 @@ void session::deinit(void)
     globals::session_send_time = UINT64_MAX;
 }
 
+void session::update_late(void)
+{
+    if(!globals::session_peer || !spawn_is_loading)
+        return;
+
+    // Chunks arrive either from the cache or within
+    // bundles; either way they end up in the world
+    for(std::size_t i = 0; i < spawn_chunks.size();) {
+        if(world::find(spawn_chunks[i])) {
+            spawn_chunks[i] = spawn_chunks.back();
+            spawn_chunks.pop_back();
+        }
+        else ++i;
+    }
+
+    const std::size_t num_loaded = spawn_num_advertised - spawn_chunks.size();
+    progress::set_status(fmt::format("{}/{}", num_loaded, cxpr::max(num_loaded, spawn_num_chunks)));
+
+    if(spawn_is_complete && spawn_chunks.empty()) {
+        protocol::SpawnReady packet = {};
+        packet.num_chunks = static_cast<std::uint32_t>(num_loaded);
+        protocol::send(globals::session_peer, nullptr, packet);
+
+        spawn_chunks.shrink_to_fit();
+        spawn_is_loading = false;
+    }
+}
+
 void session::connect(const std::string &host, std::uint16_t port)
 {
     ENetAddress address = {};
     enet_address_set_host(&address, host.c_str());
     address.port = port;
+
+    client_network::stop();
     
-    globals::session_peer = enet_host_connect(globals::client_host, &address, 1, 0);
+    globals::session_peer = enet_host_connect(globals::client_host, &address, protocol::NUM_CHANNELS, 0);
     globals::session_id = UINT16_MAX;
     globals::session_tick_dt = UINT64_MAX;
     globals::session_send_time = UINT64_MAX;
@@ -139,10 +223,15 @@ void session::connect(const std::string &host, std::uint16_t port)
         return;
     }
 
+    client_network::start();
+
+    reset_spawn_area();
+
     progress::reset();
     progress::set_title("connecting.connecting");
     progress::set_button("connecting.cancel_button", [](void) {
-        enet_peer_disconnect(globals::session_peer, 0);
+        client_network::stop();
+        enet_peer_disconnect_now(globals::session_peer, 0);
 
         globals::session_peer = nullptr;
         globals::session_id = UINT16_MAX;
@@ -165,6 +254,10 @@ void session::disconnect(const std::string &reason)
     if(globals::session_peer) {
         protocol::send_disconnect(globals::session_peer, nullptr, reason);
 
+        // This makes sure the packet is passed
+        // to ENet before the host is flushed
+        client_network::stop();
+
         enet_host_flush(globals::client_host);
         enet_host_service(globals::client_host, nullptr, 50);
         enet_peer_reset(globals::session_peer);
@@ -197,6 +290,8 @@ void session::send_login_request(void)
 
 void session::invalidate(void)
 {
+    client_network::stop();
+
     if(globals::session_peer) {
         enet_peer_reset(globals::session_peer);
         
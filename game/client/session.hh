@@ -7,6 +7,7 @@ namespace session
 {
 void init(void);
 void deinit(void);
+void update_late(void);
 } // namespace session
 
 namespace session
@@ -1,5 +1,6 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/profiler.hh>
 #include <entt/signal/dispatcher.hpp>
 #include <game/client/event/glfw_key.hh>
 #include <game/client/globals.hh>
@@ -53,6 +54,18 @@ static void on_glfw_key(const GlfwKeyEvent &event)
             case GLFW_KEY_Z:
                 toggles::render_wireframe = !toggles::render_wireframe;
                 return;
+            case GLFW_KEY_P:
+                if(profiler::is_enabled()) {
+                    // Whatever has been recorded
+                    // so far is dumped right away
+                    profiler::disable();
+                    profiler::dump("profile.json");
+                    return;
+                }
+
+                profiler::clear();
+                profiler::enable();
+                return;
             case GLFW_KEY_L:
                 // This causes the language subsystem
                 // to re-parse the JSON file essentially
@@ -0,0 +1,465 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <common/cmdline.hh>
+#include <common/epoch.hh>
+#include <common/fstools.hh>
+#include <common/packet_buffer.hh>
+#include <csignal>
+#include <cstdlib>
+#include <game/replay/main.hh>
+#include <game/shared/capture.hh>
+#include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
+#include <spdlog/spdlog.h>
+#include <unordered_map>
+#include <vector>
+
+constexpr static enet_uint32 SERVICE_TIMEOUT_MS = 1;
+// With no delays between the records this many are
+// played at once before the host gets to be serviced
+constexpr static std::size_t MAX_RECORDS_PER_SERVICE = 256;
+// Peers are given this long to go away at the end
+constexpr static std::uint64_t LINGER_US = UINT64_C(2000000);
+
+struct ReplayPeer final {
+    ENetPeer *peer {};
+    bool is_connected {};
+    // What the server has spawned this connection as;
+    // recorded entity state is sent on behalf of it
+    entt::entity player {entt::null};
+    std::vector<CaptureRecord> pending {};
+};
+
+static bool is_running = false;
+static double speed = 1.0;
+
+static std::uint64_t num_packets = 0;
+static std::uint64_t num_bytes = 0;
+static std::uint64_t num_dropped = 0;
+static std::uint64_t num_unspawned = 0;
+
+static void on_sigint(int)
+{
+    spdlog::warn("replay: received SIGINT");
+    is_running = false;
+}
+
+static bool is_due(const CaptureRecord &record, std::uint64_t base_time, std::uint64_t start_time, std::uint64_t curtime)
+{
+    if(speed <= 0.0) {
+        // As fast as the
+        // network allows
+        return true;
+    }
+
+    const double offset = static_cast<double>(record.time - base_time) / speed;
+    return start_time + static_cast<std::uint64_t>(offset) <= curtime;
+}
+
+static void send_record(ENetPeer *peer, const CaptureRecord &record)
+{
+    // Channel numbers come from the file and ENet
+    // doesn't check them against the peer's channel count
+    if(record.channel >= peer->channelCount) {
+        num_dropped += 1;
+        return;
+    }
+
+    ENetPacket *packet = enet_packet_create(record.payload.data(), record.payload.size(), record.flags);
+    if(enet_peer_send(peer, record.channel, packet) < 0) {
+        enet_packet_destroy(packet);
+        num_dropped += 1;
+        return;
+    }
+
+    num_packets += 1;
+    num_bytes += record.payload.size();
+}
+
+static bool is_entity_state(const CaptureRecord &record)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, record.payload.data(), record.payload.size());
+
+    switch(PacketBuffer::read_UI16(buffer)) {
+        case protocol::EntityTransform::ID:
+        case protocol::EntityHead::ID:
+        case protocol::EntityVelocity::ID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Entity state is about the entity the recorded client was
+// playing as back then; the server at the other end has no
+// idea about it and drops the packet unless it's about the
+// entity the replayed connection has been spawned as now
+static void rewrite_entity(CaptureRecord &record, entt::entity entity)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, record.payload.data(), record.payload.size());
+
+    const std::uint16_t id = PacketBuffer::read_UI16(buffer);
+    static_cast<void>(PacketBuffer::read_VUI64(buffer));
+    const std::size_t offset = cxpr::min(buffer.read_position, record.payload.size());
+
+    PacketBuffer rewritten = {};
+    PacketBuffer::setup(rewritten);
+    PacketBuffer::write_UI16(rewritten, id);
+    PacketBuffer::write_VUI64(rewritten, static_cast<std::uint64_t>(entity));
+    rewritten.vector.insert(rewritten.vector.cend(), record.payload.cbegin() + offset, record.payload.cend());
+    record.payload = std::move(rewritten.vector);
+}
+
+// Records are held back until the peer is connected
+// and, for entity state, until it has been spawned;
+// whatever comes after a held record waits as well
+static void send_pending(ReplayPeer &replay_peer)
+{
+    std::size_t count = 0;
+
+    if(replay_peer.is_connected) {
+        for(CaptureRecord &record : replay_peer.pending) {
+            if(is_entity_state(record)) {
+                if(replay_peer.player == entt::null)
+                    break;
+                rewrite_entity(record, replay_peer.player);
+            }
+
+            send_record(replay_peer.peer, record);
+            count += 1;
+        }
+    }
+
+    replay_peer.pending.erase(replay_peer.pending.cbegin(), replay_peer.pending.cbegin() + count);
+}
+
+static bool next_record(PHYSFS_File *file, CaptureRecord &record, CaptureEvent ignored)
+{
+    while(capture::read_record(file, record)) {
+        if(record.event == ignored)
+            continue;
+        return true;
+    }
+
+    return false;
+}
+
+// Server-side captures: every recorded peer gets
+// a connection of its own and whatever the server
+// has received from it is sent again in the same order
+static void replay_to_server(PHYSFS_File *file)
+{
+    std::string value = {};
+    ENetAddress address = {};
+    address.port = protocol::PORT;
+
+    if(!cmdline::get_value("host", value) || value.empty())
+        value = "127.0.0.1";
+    enet_address_set_host(&address, value.c_str());
+
+    if(cmdline::get_value("port", value) && !value.empty())
+        address.port = static_cast<enet_uint16>(std::strtoul(value.c_str(), nullptr, 10));
+
+    ENetHost *host = enet_host_create(nullptr, ENET_PROTOCOL_MAXIMUM_PEER_ID, protocol::NUM_CHANNELS, 0, 0);
+
+    if(!host) {
+        spdlog::critical("replay: unable to setup an ENet host");
+        return;
+    }
+
+    std::unordered_map<std::uint16_t, ReplayPeer> peers = {};
+    std::uint64_t num_kicked = 0;
+
+    const auto find_or_connect = [&](std::uint16_t peer_id) -> ReplayPeer * {
+        const auto it = peers.find(peer_id);
+        if(it != peers.cend())
+            return &it->second;
+
+        ENetPeer *peer = enet_host_connect(host, &address, protocol::NUM_CHANNELS, 0);
+
+        if(!peer) {
+            spdlog::warn("replay: out of peers for peer {}", peer_id);
+            return nullptr;
+        }
+
+        ReplayPeer &replay_peer = peers[peer_id];
+        replay_peer.peer = peer;
+        peer->data = &replay_peer;
+        return &replay_peer;
+    };
+
+    const auto release = [&](std::uint16_t peer_id) {
+        const auto it = peers.find(peer_id);
+
+        if(it != peers.cend()) {
+            for(const CaptureRecord &pending : it->second.pending) {
+                if(is_entity_state(pending)) {
+                    // Never spawned while it
+                    // was still supposed to play
+                    num_unspawned += 1;
+                }
+            }
+
+            if(it->second.is_connected) {
+                // Unconnected ones are taken
+                // care of once they connect
+                enet_peer_disconnect_later(it->second.peer, 0);
+            }
+
+            // The connection lives on until ENet
+            // is done with it but a recorded reconnect
+            // is going to need a brand new one
+            it->second.peer->data = nullptr;
+            peers.erase(it);
+        }
+    };
+
+    CaptureRecord record = {};
+    bool has_record = next_record(file, record, CAPTURE_SEND);
+
+    const std::uint64_t base_time = record.time;
+    const std::uint64_t start_time = epoch::microseconds();
+    std::uint64_t end_time = UINT64_MAX;
+
+    while(is_running) {
+        const std::uint64_t curtime = epoch::microseconds();
+
+        for(std::size_t i = 0; has_record && (i < MAX_RECORDS_PER_SERVICE); ++i) {
+            if(!is_due(record, base_time, start_time, curtime))
+                break;
+
+            if(record.event == CAPTURE_CONNECT) {
+                // A capture that doesn't start with
+                // a connection gets one made up on demand
+                static_cast<void>(find_or_connect(record.peer_id));
+            }
+            else if(record.event == CAPTURE_DISCONNECT) {
+                release(record.peer_id);
+            }
+            else if(ReplayPeer *replay_peer = find_or_connect(record.peer_id)) {
+                replay_peer->pending.push_back(std::move(record));
+                send_pending(*replay_peer);
+            }
+
+            has_record = next_record(file, record, CAPTURE_SEND);
+        }
+
+        if(!has_record && (end_time == UINT64_MAX)) {
+            // Whoever is still around when the
+            // capture ends is let go right away
+            while(!peers.empty())
+                release(peers.cbegin()->first);
+            end_time = curtime;
+        }
+
+        if((end_time != UINT64_MAX) && ((curtime - end_time) >= LINGER_US))
+            break;
+
+        ENetEvent event = {};
+
+        while(enet_host_service(host, &event, SERVICE_TIMEOUT_MS) > 0) {
+            if(event.type == ENET_EVENT_TYPE_CONNECT) {
+                if(ReplayPeer *replay_peer = reinterpret_cast<ReplayPeer *>(event.peer->data)) {
+                    replay_peer->is_connected = true;
+                    send_pending(*replay_peer);
+                }
+                else {
+                    // Released before it got
+                    // the chance to connect
+                    enet_peer_disconnect_later(event.peer, 0);
+                }
+
+                continue;
+            }
+
+            if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+                if(ReplayPeer *replay_peer = reinterpret_cast<ReplayPeer *>(event.peer->data)) {
+                    // The server has let go of a peer that
+                    // was still supposed to be around; flooding
+                    // and timeouts usually end up like this
+                    replay_peer->is_connected = false;
+                    num_kicked += 1;
+                }
+
+                continue;
+            }
+
+            if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+                ReplayPeer *replay_peer = reinterpret_cast<ReplayPeer *>(event.peer->data);
+
+                if(replay_peer && (protocol::peek_id(event.packet) == protocol::SpawnPlayer::ID)) {
+                    PacketBuffer buffer = {};
+                    PacketBuffer::setup(buffer, event.packet->data, event.packet->dataLength);
+                    PacketBuffer::read_UI16(buffer);
+                    replay_peer->player = static_cast<entt::entity>(PacketBuffer::read_VUI64(buffer));
+                    send_pending(*replay_peer);
+                }
+
+                enet_packet_destroy(event.packet);
+                continue;
+            }
+        }
+    }
+
+    if(num_unspawned) {
+        spdlog::warn("replay: {} entity state packets were dropped; their peers were never spawned", num_unspawned);
+    }
+
+    if(num_kicked) {
+        spdlog::warn("replay: {} peers were disconnected by the server", num_kicked);
+    }
+
+    enet_host_flush(host);
+    enet_host_destroy(host);
+}
+
+// Client-side captures: the first client to connect
+// is fed whatever the client has received during the
+// first recorded session, responses or not
+static void replay_to_client(PHYSFS_File *file)
+{
+    std::string value = {};
+    ENetAddress address = {};
+    address.host = ENET_HOST_ANY;
+    address.port = protocol::PORT;
+
+    if(cmdline::get_value("port", value) && !value.empty())
+        address.port = static_cast<enet_uint16>(std::strtoul(value.c_str(), nullptr, 10));
+
+    ENetHost *host = enet_host_create(&address, 1, protocol::NUM_CHANNELS, 0, 0);
+
+    if(!host) {
+        spdlog::critical("replay: unable to setup an ENet host");
+        return;
+    }
+
+    spdlog::info("replay: waiting for a client on UDP port {}", address.port);
+
+    CaptureRecord record = {};
+    bool has_record = false;
+
+    // Skip to the beginning of the first session
+    while((has_record = next_record(file, record, CAPTURE_SEND)) && (record.event != CAPTURE_CONNECT));
+
+    ENetPeer *peer = nullptr;
+    const std::uint64_t base_time = record.time;
+    std::uint64_t start_time = UINT64_MAX;
+    std::uint64_t end_time = UINT64_MAX;
+
+    while(is_running) {
+        const std::uint64_t curtime = epoch::microseconds();
+
+        if(peer && (start_time != UINT64_MAX)) {
+            for(std::size_t i = 0; has_record && (i < MAX_RECORDS_PER_SERVICE); ++i) {
+                if(!is_due(record, base_time, start_time, curtime))
+                    break;
+
+                if(record.event == CAPTURE_DISCONNECT) {
+                    has_record = false;
+                    break;
+                }
+
+                if(record.event == CAPTURE_RECEIVE)
+                    send_record(peer, record);
+                has_record = next_record(file, record, CAPTURE_SEND);
+            }
+
+            if(!has_record && (end_time == UINT64_MAX)) {
+                enet_peer_disconnect_later(peer, 0);
+                end_time = curtime;
+            }
+        }
+
+        if((end_time != UINT64_MAX) && ((curtime - end_time) >= LINGER_US))
+            break;
+
+        ENetEvent event = {};
+
+        while(enet_host_service(host, &event, SERVICE_TIMEOUT_MS) > 0) {
+            if(event.type == ENET_EVENT_TYPE_CONNECT) {
+                if(!peer) {
+                    spdlog::info("replay: client connected");
+                    peer = event.peer;
+                    start_time = epoch::microseconds();
+                }
+
+                continue;
+            }
+
+            if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+                if(event.peer == peer) {
+                    spdlog::info("replay: client disconnected");
+                    is_running = false;
+                }
+
+                continue;
+            }
+
+            if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+                enet_packet_destroy(event.packet);
+                continue;
+            }
+        }
+    }
+
+    enet_host_flush(host);
+    enet_host_destroy(host);
+}
+
+void replay::main(void)
+{
+    std::string path = {};
+    std::string value = {};
+
+    if(!cmdline::get_value("replay", path) || path.empty()) {
+        spdlog::critical("replay: no capture file given (-replay <path>)");
+        return;
+    }
+
+    if(cmdline::get_value("speed", value) && !value.empty())
+        speed = std::strtod(value.c_str(), nullptr);
+
+    PHYSFS_File *file = PHYSFS_openRead(path.c_str());
+
+    if(!file) {
+        spdlog::critical("replay: {}: {}", path, fstools::error());
+        return;
+    }
+
+    CaptureHeader header = {};
+
+    if(!capture::read_header(file, header)) {
+        spdlog::critical("replay: {}: not a capture file", path);
+        PHYSFS_close(file);
+        return;
+    }
+
+    if(header.version != protocol::VERSION) {
+        // Packets are sent as they were recorded;
+        // nobody is going to make sense of them
+        spdlog::warn("replay: {}: recorded with protocol version {}, not {}", path, header.version, protocol::VERSION);
+    }
+
+    is_running = true;
+
+    std::signal(SIGINT, &on_sigint);
+
+    spdlog::info("replay: playing {} at {}x speed", path, speed);
+
+    const std::uint64_t start_time = epoch::microseconds();
+
+    if(header.side == CAPTURE_SERVER)
+        replay_to_server(file);
+    else replay_to_client(file);
+
+    const std::uint64_t elapsed = epoch::microseconds() - start_time;
+    spdlog::info("replay: sent {} packets ({} bytes) in {} ms", num_packets, num_bytes, elapsed / UINT64_C(1000));
+
+    if(num_dropped) {
+        spdlog::warn("replay: {} packets could not be sent", num_dropped);
+    }
+
+    PHYSFS_close(file);
+}
@@ -1,23 +1,89 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/config.hh>
+#include <common/strtools.hh>
 #include <entt/signal/dispatcher.hpp>
 #include <game/server/chat.hh>
 #include <game/server/globals.hh>
 #include <game/server/sessions.hh>
 #include <game/shared/protocol.hh>
 #include <spdlog/spdlog.h>
+#include <unordered_map>
+
+// Administrator commands are disabled
+// for as long as the password is empty
+static std::string admin_password = {};
+
+static std::unordered_map<std::string, ChatCommand> commands = {};
+
+static void on_admin_command(Session *session, const std::vector<std::string> &args)
+{
+    if(admin_password.empty() || (args.size() < 2) || (args[1] != admin_password)) {
+        spdlog::warn("chat: {} failed to authenticate as an administrator", session->username);
+        server_chat::send(session, "access denied");
+        return;
+    }
+
+    spdlog::info("chat: {} is now an administrator", session->username);
+    session->is_admin = true;
+    server_chat::send(session, "access granted");
+}
+
+static void handle_command(Session *session, const std::string &message)
+{
+    std::vector<std::string> args = {};
+
+    for(const std::string &arg : strtools::split(message.substr(1), " ")) {
+        if(!arg.empty()) {
+            // Multiple spaces in a row
+            // don't make empty arguments
+            args.push_back(arg);
+        }
+    }
+
+    if(args.empty()) {
+        // Just a slash
+        return;
+    }
+
+    if(args[0] == "admin") {
+        on_admin_command(session, args);
+        return;
+    }
+
+    const auto it = commands.find(args[0]);
+
+    if((it == commands.cend()) || !session->is_admin) {
+        // Don't let anyone find out which
+        // commands exist without logging in
+        server_chat::send(session, "unknown command: " + args[0]);
+        return;
+    }
+
+    spdlog::info("chat: {} issued {}", session->username, message);
+
+    it->second(session, args);
+}
 
 static void on_chat_message_packet(const protocol::ChatMessage &packet)
 {
     if(packet.type == protocol::ChatMessage::TEXT_MESSAGE) {
-        if(packet.peer->data)
-            server_chat::broadcast(packet.message, reinterpret_cast<const Session *>(packet.peer->data)->username);
-        else server_chat::broadcast(packet.message, packet.sender);
+        if(Session *session = sessions::find(packet.peer)) {
+            if(!packet.message.empty() && (packet.message[0] == '/'))
+                handle_command(session, packet.message);
+            else server_chat::broadcast(packet.message, session->username);
+        }
+        else {
+            // Not logged in yet
+            server_chat::broadcast(packet.message, packet.sender);
+        }
     }
 }
 
 void server_chat::init(void)
 {
+    Config::add(globals::server_config, "chat.admin_password", admin_password);
+
     globals::dispatcher.sink<protocol::ChatMessage>().connect<&on_chat_message_packet>();
 }
 
@@ -47,5 +113,10 @@ void server_chat::send(Session *session, const std::string &message, const std::
     packet.type = protocol::ChatMessage::TEXT_MESSAGE;
     packet.message = message;
     packet.sender = sender;
-    protocol::send(nullptr, globals::server_host, packet);
+    protocol::send(session->peer, nullptr, packet);
+}
+
+void server_chat::add_command(const std::string &name, ChatCommand command)
+{
+    commands.insert_or_assign(name, command);
 }
@@ -2,9 +2,14 @@
 // Copyright (C) 2024, Voxelius Contributors
 #pragma once
 #include <string>
+#include <vector>
 
 struct Session;
 
+// Chat messages starting with a slash are commands; all
+// of them except /admin are available to administrators only
+using ChatCommand = void (*)(Session *session, const std::vector<std::string> &args);
+
 namespace server_chat
 {
 void init(void);
@@ -13,3 +18,8 @@ void broadcast(const std::string &message, const std::string &sender);
 void send(Session *session, const std::string &message);
 void send(Session *session, const std::string &message, const std::string &sender);
 } // namespace server_chat
+
+namespace server_chat
+{
+void add_command(const std::string &name, ChatCommand command);
+} // namespace server_chat
@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <array>
+#include <common/config.hh>
+#include <common/epoch.hh>
+#include <common/telemetry.hh>
+#include <emhash/hash_table8.hpp>
+#include <game/server/flood.hh>
+#include <game/server/globals.hh>
+#include <game/server/sessions.hh>
+#include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+
+// Drops are counted within a window of this
+// length; exceeding flood.tolerance drops within a
+// single window gets the peer disconnected
+constexpr static std::uint64_t WINDOW_US = UINT64_C(1000000);
+
+constexpr static unsigned int POLICY_DROP = 0U;
+constexpr static unsigned int POLICY_DISCONNECT = 1U;
+
+struct ClassBudget final {
+    double rate {};
+    double burst {};
+};
+
+struct PeerBudget final {
+    std::array<double, NUM_PACKET_CLASSES> tokens {};
+    std::uint64_t refill_time {};
+    std::uint64_t window_time {};
+    unsigned int window_drops {};
+    bool is_kicked {};
+};
+
+static unsigned int policy = POLICY_DISCONNECT;
+static unsigned int tolerance = 256U;
+static unsigned int scale = 100U;
+
+static std::array<ClassBudget, NUM_PACKET_CLASSES> budgets = {};
+static std::array<TelemetryCounter, NUM_PACKET_CLASSES> num_admitted = {};
+static std::array<TelemetryCounter, NUM_PACKET_CLASSES> num_dropped = {};
+static TelemetryCounter num_kicked = {};
+
+// Only ever touched by the thread servicing the host
+static emhash8::HashMap<ENetPeer *, PeerBudget> peers = {};
+
+static PacketClass classify(std::uint16_t packet_id)
+{
+    switch(packet_id) {
+        case protocol::EntityTransform::ID:
+        case protocol::EntityHead::ID:
+        case protocol::EntityVelocity::ID:
+            return PACKET_MOVEMENT;
+        case protocol::SetVoxel::ID:
+            return PACKET_VOXELS;
+        case protocol::ChatMessage::ID:
+            return PACKET_CHAT;
+        case protocol::ChunkRequest::ID:
+            return PACKET_CHUNKS;
+        default:
+            return PACKET_GENERIC;
+    }
+}
+
+static PeerBudget &find_budget(ENetPeer *peer, std::uint64_t curtime)
+{
+    const auto it = peers.find(peer);
+
+    if(it == peers.cend()) {
+        // New peers start with a full bucket
+        PeerBudget &budget = peers[peer];
+        for(std::size_t i = 0; i < NUM_PACKET_CLASSES; ++i)
+            budget.tokens[i] = budgets[i].burst;
+        budget.refill_time = curtime;
+        budget.window_time = curtime;
+        return budget;
+    }
+
+    return it->second;
+}
+
+static void refill(PeerBudget &budget, std::uint64_t curtime)
+{
+    const double elapsed = static_cast<double>(curtime - budget.refill_time) / 1000000.0;
+
+    for(std::size_t i = 0; i < NUM_PACKET_CLASSES; ++i)
+        budget.tokens[i] = cxpr::min<double>(budget.tokens[i] + elapsed * budgets[i].rate, budgets[i].burst);
+    budget.refill_time = curtime;
+
+    if(curtime - budget.window_time >= WINDOW_US) {
+        budget.window_time = curtime;
+        budget.window_drops = 0U;
+    }
+}
+
+static void set_budget(PacketClass packet_class, double rate, double burst)
+{
+    const double factor = static_cast<double>(scale) / 100.0;
+    budgets[packet_class].rate = factor * rate;
+    budgets[packet_class].burst = cxpr::max<double>(1.0, factor * burst);
+}
+
+void flood::init(void)
+{
+    Config::add(globals::server_config, "flood.policy", policy);
+    Config::add(globals::server_config, "flood.tolerance", tolerance);
+    Config::add(globals::server_config, "flood.scale", scale);
+
+    for(PacketClass i = 0; i < NUM_PACKET_CLASSES; ++i) {
+        telemetry::add(fmt::format("flood.{}.admitted", flood::get_class_name(i)), num_admitted[i]);
+        telemetry::add(fmt::format("flood.{}.dropped", flood::get_class_name(i)), num_dropped[i]);
+    }
+
+    telemetry::add("flood.kicked", num_kicked);
+}
+
+void flood::init_late(void)
+{
+    policy = cxpr::clamp<unsigned int>(policy, POLICY_DROP, POLICY_DISCONNECT);
+    tolerance = cxpr::max<unsigned int>(tolerance, 1U);
+    scale = cxpr::clamp<unsigned int>(scale, 10U, 10000U);
+
+    // Clients send their movement once per server tick,
+    // that's up to three packets per tick; everything else is
+    // driven by player input or happens once per session
+    const double tickrate = static_cast<double>(globals::tickrate);
+    set_budget(PACKET_GENERIC, 8.0, 16.0);
+    set_budget(PACKET_MOVEMENT, 6.0 * tickrate, 3.0 * tickrate);
+    set_budget(PACKET_VOXELS, 32.0, 64.0);
+    set_budget(PACKET_CHAT, 4.0, 16.0);
+    set_budget(PACKET_CHUNKS, 1024.0, 8192.0);
+
+    // Clients request every spawn area chunk they don't have
+    // cached right away; dropping any of these would stall the
+    // session until it times out, so the scale doesn't apply here
+    const double spawn_area = static_cast<double>(sessions::get_spawn_area_size());
+    budgets[PACKET_CHUNKS].rate = cxpr::max<double>(budgets[PACKET_CHUNKS].rate, spawn_area);
+    budgets[PACKET_CHUNKS].burst = cxpr::max<double>(budgets[PACKET_CHUNKS].burst, spawn_area);
+}
+
+void flood::deinit(void)
+{
+    for(PacketClass i = 0; i < NUM_PACKET_CLASSES; ++i) {
+        if(const std::uint64_t dropped = flood::get_num_dropped(i)) {
+            spdlog::info("flood: {}: {} packets admitted, {} dropped", flood::get_class_name(i), flood::get_num_admitted(i), dropped);
+        }
+    }
+
+    if(const std::uint64_t kicked = flood::get_num_kicked()) {
+        spdlog::info("flood: {} peers disconnected for flooding", kicked);
+    }
+
+    peers.clear();
+}
+
+FloodVerdict flood::admit(ENetPeer *peer, std::uint16_t packet_id)
+{
+    const std::uint64_t curtime = epoch::microseconds();
+    const PacketClass packet_class = classify(packet_id);
+
+    PeerBudget &budget = find_budget(peer, curtime);
+
+    if(budget.is_kicked) {
+        // The peer is on its way out
+        num_dropped[packet_class].add();
+        return FLOOD_DROP;
+    }
+
+    refill(budget, curtime);
+
+    if(budget.tokens[packet_class] >= 1.0) {
+        budget.tokens[packet_class] -= 1.0;
+        num_admitted[packet_class].add();
+        return FLOOD_ADMIT;
+    }
+
+    num_dropped[packet_class].add();
+    budget.window_drops += 1U;
+
+    if((policy == POLICY_DISCONNECT) && (budget.window_drops > tolerance)) {
+        char address[64] = {};
+        enet_address_get_host_ip(&peer->address, address, sizeof(address));
+        spdlog::warn("flood: {}:{}: too many {} packets", address, peer->address.port, flood::get_class_name(packet_class));
+        num_kicked.add();
+        budget.is_kicked = true;
+        return FLOOD_KICK;
+    }
+
+    return FLOOD_DROP;
+}
+
+void flood::reset(ENetPeer *peer)
+{
+    peers.erase(peer);
+}
+
+const char *flood::get_class_name(PacketClass packet_class)
+{
+    switch(packet_class) {
+        case PACKET_MOVEMENT:
+            return "movement";
+        case PACKET_VOXELS:
+            return "voxels";
+        case PACKET_CHAT:
+            return "chat";
+        case PACKET_CHUNKS:
+            return "chunks";
+        default:
+            return "generic";
+    }
+}
+
+std::uint64_t flood::get_num_admitted(PacketClass packet_class)
+{
+    return num_admitted.at(packet_class).get();
+}
+
+std::uint64_t flood::get_num_dropped(PacketClass packet_class)
+{
+    return num_dropped.at(packet_class).get();
+}
+
+std::uint64_t flood::get_num_kicked(void)
+{
+    return num_kicked.get();
+}
@@ -0,0 +1,44 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+
+using PacketClass = unsigned int;
+constexpr static PacketClass PACKET_GENERIC = 0x0000;
+constexpr static PacketClass PACKET_MOVEMENT = 0x0001;
+constexpr static PacketClass PACKET_VOXELS = 0x0002;
+constexpr static PacketClass PACKET_CHAT = 0x0003;
+constexpr static PacketClass PACKET_CHUNKS = 0x0004;
+constexpr static std::size_t NUM_PACKET_CLASSES = 5;
+
+using FloodVerdict = unsigned int;
+constexpr static FloodVerdict FLOOD_ADMIT = 0x0000;
+constexpr static FloodVerdict FLOOD_DROP = 0x0001;
+constexpr static FloodVerdict FLOOD_KICK = 0x0002;
+
+namespace flood
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+} // namespace flood
+
+namespace flood
+{
+// Called by the thread that services the host for
+// every received packet before it's decoded. Packets
+// above the budget of their class are to be dropped; peers
+// that keep flooding are to be disconnected
+FloodVerdict admit(ENetPeer *peer, std::uint16_t packet_id);
+void reset(ENetPeer *peer);
+} // namespace flood
+
+namespace flood
+{
+// These are safe to call from any thread
+const char *get_class_name(PacketClass packet_class);
+std::uint64_t get_num_admitted(PacketClass packet_class);
+std::uint64_t get_num_dropped(PacketClass packet_class);
+std::uint64_t get_num_kicked(void);
+} // namespace flood
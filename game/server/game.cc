@@ -1,14 +1,22 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/cmdline.hh>
 #include <common/config.hh>
 #include <common/epoch.hh>
+#include <common/profiler.hh>
+#include <common/telemetry.hh>
 #include <entt/entity/registry.hpp>
 #include <game/server/chat.hh>
+#include <game/server/flood.hh>
 #include <game/server/game.hh>
 #include <game/server/globals.hh>
+#include <game/server/idle.hh>
+#include <game/server/netstats.hh>
+#include <game/server/network.hh>
 #include <game/server/receive.hh>
 #include <game/server/sessions.hh>
 #include <game/server/status.hh>
+#include <game/shared/capture.hh>
 #include <game/shared/entity/head.hh>
 #include <game/shared/entity/player.hh>
 #include <game/shared/entity/transform.hh>
@@ -24,35 +32,108 @@
 static unsigned int listen_port = protocol::PORT;
 static unsigned int status_peers = 4U;
 
+// Seconds between telemetry snapshots written
+// to stats.log; zero turns the stats file off
+static unsigned int telemetry_interval = 10U;
+static std::uint64_t telemetry_time = UINT64_C(0);
+
+// The watchdog may be recording zones in the background,
+// so profiling sessions are cut out of whatever there is
+static std::uint64_t profile_since_ns = UINT64_C(0);
+static std::uint64_t profile_until_ns = UINT64_MAX;
+
+static void on_profile_command(Session *session, const std::vector<std::string> &args)
+{
+    if((args.size() >= 2) && (args[1] == "start")) {
+        profile_since_ns = epoch::monotonic_nanoseconds();
+        profile_until_ns = UINT64_MAX;
+        profiler::enable();
+        server_chat::send(session, "profiler enabled");
+        return;
+    }
+
+    if((args.size() >= 2) && (args[1] == "stop")) {
+        profiler::disable();
+        profile_until_ns = epoch::monotonic_nanoseconds();
+        server_chat::send(session, "profiler disabled");
+        return;
+    }
+
+    if((args.size() >= 2) && (args[1] == "dump")) {
+        // Zones recorded so far are kept around
+        // and the profiler doesn't have to be stopped
+        const std::string path = (args.size() >= 3) ? args[2] : std::string("profile.json");
+        if(profiler::dump(path, profile_since_ns, profile_until_ns))
+            server_chat::send(session, "profile written to " + path);
+        else server_chat::send(session, "unable to write " + path);
+        return;
+    }
+
+    server_chat::send(session, "usage: /profile start|stop|dump [path]");
+}
+
+static void on_stats_command(Session *session, const std::vector<std::string> &args)
+{
+    const std::vector<std::string> lines = telemetry::format((args.size() >= 2) ? args[1] : std::string());
+
+    if(lines.empty()) {
+        server_chat::send(session, "no such variables");
+        return;
+    }
+
+    for(const std::string &line : lines) {
+        server_chat::send(session, line);
+    }
+}
+
 void server_game::init(void)
 {
     Config::add(globals::server_config, "game.listen_port", listen_port);
     Config::add(globals::server_config, "game.status_peers", status_peers);
+    Config::add(globals::server_config, "telemetry.interval", telemetry_interval);
 
     sessions::init();
 
     splash::init("texts/motds.txt");
     status::init();
 
+    flood::init();
+
     server_chat::init();
     server_recieve::init();
 
+    netstats::init();
+
+    server_chat::add_command("profile", &on_profile_command);
+    server_chat::add_command("stats", &on_stats_command);
+
     world::init();
     worldgen::init();
+
+    idle::init();
 }
 
 void server_game::init_late(void)
 {
+    // ENet can't have more peers than this and a few
+    // of them are set aside for status requests
+    sessions::max_players = cxpr::min<unsigned int>(sessions::max_players, ENET_PROTOCOL_MAXIMUM_PEER_ID - 16U);
+
     sessions::init_late();
 
+    flood::init_late();
+
+    netstats::init_late();
+
     listen_port = cxpr::clamp<unsigned int>(listen_port, 1024U, UINT16_MAX);
     status_peers = cxpr::clamp<unsigned int>(status_peers, 2U, 16U);
+    telemetry_interval = cxpr::min<unsigned int>(telemetry_interval, 3600U);
 
     ENetAddress address = {};
     address.host = ENET_HOST_ANY;
     address.port = listen_port;
 
-    globals::server_host = enet_host_create(&address, sessions::max_players + status_peers, 1, 0, 0);
+    globals::server_host = enet_host_create(&address, sessions::max_players + status_peers, protocol::NUM_CHANNELS, 0, 0);
 
     if(!globals::server_host) {
         spdlog::critical("game: unable to setup an ENet host");
@@ -62,10 +143,38 @@ void server_game::init_late(void)
     spdlog::info("game: host: {} player + {} status peers", sessions::max_players, status_peers);
     spdlog::info("game: host: listening on UDP port {}", address.port);
 
+    std::string capture_path = {};
+    if(cmdline::get_value("capture", capture_path)) {
+        // Everything the network thread gets
+        // to see is recorded from the very start
+        if(capture_path.empty())
+            capture_path = "capture.vcap";
+        capture::start(capture_path, CAPTURE_SERVER, cmdline::contains("capture_sent"));
+    }
+
+    // The intercept callback has to be in
+    // place before the network thread starts
+    status::init_late();
+
+    if(cmdline::contains("profile")) {
+        // Profile everything from the start; the
+        // zones are dumped to profile.json on shutdown
+        profiler::enable();
+    }
+
+    server_network::init_late();
+
+    if(telemetry_interval) {
+        telemetry::open("stats.log");
+        telemetry_time = globals::curtime;
+    }
+
     game_voxels::populate();
 
     worldgen::init_late(UINT64_C(42));
 
+    idle::init_late();
+
     constexpr int WSIZE = 16;
     for(int x = -WSIZE; x < WSIZE; x += 1) {
         for(int z = -WSIZE; z < WSIZE; z += 1) {
@@ -84,30 +193,55 @@ void server_game::deinit(void)
 
     sessions::deinit();
 
+    // This makes sure the disconnect packets
+    // are passed to ENet before we flush the host
+    server_network::deinit();
+
+    flood::deinit();
+
+    netstats::deinit();
+
+    // Whatever happened since the last snapshot
+    telemetry::write();
+    telemetry::close();
+
     enet_host_flush(globals::server_host);
     enet_host_service(globals::server_host, nullptr, 500);
     enet_host_destroy(globals::server_host);
+
+    capture::stop();
+
+    if(cmdline::contains("profile")) {
+        profiler::disable();
+        profiler::dump("profile.json");
+    }
 }
 
 void server_game::update(void)
 {
+    PROFILER_ZONE("server_game::update");
+
+    // Chunks have to be back in place before
+    // whoever has just connected gets to ask for them
+    idle::update();
+
+    status::update();
     worldgen::update();
 }
 
 void server_game::update_late(void)
-{    
-    ENetEvent event = {};
+{
+    PROFILER_ZONE("server_game::update_late");
 
-    while(enet_host_service(globals::server_host, &event, 0) > 0) {
-        if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
-            sessions::destroy(sessions::find(event.peer));
-            continue;
-        }
+    server_network::update();
 
-        if(event.type == ENET_EVENT_TYPE_RECEIVE) {
-            protocol::receive(event.packet, event.peer);
-            enet_packet_destroy(event.packet);
-            continue;
-        }
+    // Join streaming and chunks requested during this tick
+    sessions::update_late();
+
+    netstats::update_late();
+
+    if(telemetry_interval && ((globals::curtime - telemetry_time) >= UINT64_C(1000000) * telemetry_interval)) {
+        telemetry_time = globals::curtime;
+        telemetry::write();
     }
 }
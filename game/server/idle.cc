@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <common/config.hh>
+#include <common/epoch.hh>
+#include <common/telemetry.hh>
+#include <game/server/globals.hh>
+#include <game/server/idle.hh>
+#include <game/server/network.hh>
+#include <game/server/scheduler.hh>
+#include <game/shared/world.hh>
+#include <game/shared/worldgen.hh>
+#include <mathlib/constexpr.hh>
+#include <spdlog/spdlog.h>
+
+// Seconds without anyone connected before the
+// server goes idle; zero keeps it awake for good
+static unsigned int delay = 60U;
+// Ticks per second while idle
+static unsigned int tickrate = 1U;
+// Chunks are compressed while idle and
+// put back once somebody connects
+static bool pack_chunks = true;
+
+static bool is_idle = false;
+static std::uint64_t empty_time = UINT64_C(0);
+static TelemetryGauge idle_gauge = {};
+
+static void enter_idle(void)
+{
+    const std::uint64_t start = epoch::microseconds();
+
+    is_idle = true;
+    idle_gauge.set(1);
+
+    scheduler::set_interval(UINT64_C(1000000) / tickrate);
+    server_network::set_idle(true);
+
+    worldgen::evict();
+
+    if(pack_chunks) {
+        const std::size_t count = world::pack();
+        spdlog::info("idle: packed {} chunks in {} ms", count, (epoch::microseconds() - start) / UINT64_C(1000));
+    }
+
+    // Whatever chunks were destroyed
+    // above are not going to be reused
+    Chunk::trim();
+
+    spdlog::info("idle: nobody connected for {} s, slowing down to {} TPS", delay, tickrate);
+}
+
+static void leave_idle(void)
+{
+    const std::uint64_t start = epoch::microseconds();
+
+    is_idle = false;
+    idle_gauge.set(0);
+
+    scheduler::set_interval(globals::tickrate_dt);
+    server_network::set_idle(false);
+
+    if(pack_chunks) {
+        const std::size_t count = world::unpack();
+        spdlog::info("idle: unpacked {} chunks in {} ms", count, (epoch::microseconds() - start) / UINT64_C(1000));
+    }
+
+    spdlog::info("idle: somebody connected, back to {} TPS", globals::tickrate);
+}
+
+void idle::init(void)
+{
+    Config::add(globals::server_config, "idle.delay", delay);
+    Config::add(globals::server_config, "idle.tickrate", tickrate);
+    Config::add(globals::server_config, "idle.pack_chunks", pack_chunks);
+
+    telemetry::add("server.idle", idle_gauge);
+}
+
+void idle::init_late(void)
+{
+    delay = cxpr::min(delay, 86400U);
+    tickrate = cxpr::clamp(tickrate, 1U, globals::tickrate);
+
+    empty_time = globals::curtime;
+}
+
+void idle::update(void)
+{
+    // Counts whoever is connected, players
+    // and status requests made over ENet alike
+    const bool is_empty = !server_network::get_num_peers();
+
+    if(is_idle) {
+        if(!is_empty)
+            leave_idle();
+        return;
+    }
+
+    if(!delay || !is_empty || worldgen::is_generating()) {
+        empty_time = globals::curtime;
+        return;
+    }
+
+    if(globals::curtime - empty_time >= UINT64_C(1000000) * delay) {
+        enter_idle();
+    }
+}
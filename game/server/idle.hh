@@ -0,0 +1,10 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+
+namespace idle
+{
+void init(void);
+void init_late(void);
+void update(void);
+} // namespace idle
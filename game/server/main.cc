@@ -2,6 +2,7 @@
 // Copyright (C) 2024, Voxelius Contributors
 #include <common/config.hh>
 #include <common/epoch.hh>
+#include <common/profiler.hh>
 #include <config/cmake.hh>
 #include <csignal>
 #include <entt/signal/dispatcher.hpp>
@@ -9,9 +10,11 @@
 #include <game/server/globals.hh>
 #include <game/server/globals.hh>
 #include <game/server/main.hh>
+#include <game/server/scheduler.hh>
+#include <game/server/watchdog.hh>
+#include <game/shared/world.hh>
 #include <mathlib/constexpr.hh>
 #include <spdlog/spdlog.h>
-#include <thread>
 
 static void on_sigint(int)
 {
@@ -33,8 +36,13 @@ void server::main(void)
 
     std::signal(SIGINT, &on_sigint);
 
+    profiler::set_thread_name("simulation");
+
     server_game::init();
 
+    scheduler::init();
+    watchdog::init();
+
     Config::add(globals::server_config, "server.tickrate", globals::tickrate);
     Config::load(globals::server_config, "server.conf");
 
@@ -43,30 +51,46 @@ void server::main(void)
 
     server_game::init_late();
 
-    std::uint64_t last_curtime = globals::curtime;
+    // The simulation advances by exactly one tick's
+    // worth of time every tick, however late it runs
+    globals::frametime_us = globals::tickrate_dt;
+    globals::frametime = static_cast<float>(globals::frametime_us) / 1000000.0f;
+    globals::frametime_avg = globals::frametime;
+
+    scheduler::init_late();
+    watchdog::init_late();
     
     while(globals::is_running) {
+        // Network traffic is handled by
+        // its own thread while we're waiting
+        scheduler::wait();
+
+        watchdog::begin_tick();
+
+        PROFILER_ZONE("server::tick");
+
         globals::curtime = epoch::microseconds();
-        globals::frametime_us = globals::curtime - last_curtime;
-        globals::frametime = static_cast<float>(globals::frametime_us) / 1000000.0f;
-        globals::frametime_avg += globals::frametime;
-        globals::frametime_avg *= 0.5f;
-        
-        last_curtime = globals::curtime;
         
         server_game::update();
         server_game::update_late();
 
+        // World changes made during the tick
+        // are delivered along with everything else
+        world::flush_events();
+
+        watchdog::add_dispatched(globals::dispatcher.size());
         globals::dispatcher.update();
         
         globals::framecount += 1;
 
-        std::this_thread::sleep_for(std::chrono::microseconds(globals::tickrate_dt));
+        watchdog::end_tick();
+        scheduler::end_tick();
     }
 
     spdlog::info("server: shutdown after {} frames", globals::framecount);
-    spdlog::info("server: average framerate: {:.03f} TPS", 1.0f / globals::frametime_avg);
-    spdlog::info("server: average frametime: {:.03f} MSPT", 1000.0f * globals::frametime_avg);
+
+    watchdog::deinit();
+    scheduler::deinit();
 
     server_game::deinit();
     
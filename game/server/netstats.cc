@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <array>
+#include <common/config.hh>
+#include <common/telemetry.hh>
+#include <game/server/chat.hh>
+#include <game/server/globals.hh>
+#include <game/server/netstats.hh>
+#include <game/server/sessions.hh>
+#include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
+#include <spdlog/spdlog.h>
+
+// At most this many packet types are listed
+// in response to the /netstats chat command
+constexpr static std::size_t MAX_CHAT_LINES = 8;
+// Traffic totals are added up for telemetry this often
+constexpr static std::uint64_t TELEMETRY_INTERVAL_US = UINT64_C(1000000);
+
+struct TrafficEntry final {
+    std::uint16_t packet_id {};
+    protocol::TrafficStats stats {};
+};
+
+// Seconds between traffic dumps in the log;
+// zero turns the periodic dumps off entirely
+static unsigned int interval = 60U;
+
+static std::uint64_t dump_time = UINT64_C(0);
+static std::array<protocol::TrafficStats, protocol::NUM_PACKETS> dump_traffic = {};
+
+static std::uint64_t telemetry_time = UINT64_C(0);
+static std::uint64_t telemetry_sent = UINT64_C(0);
+static std::uint64_t telemetry_received = UINT64_C(0);
+static TelemetryCounter bytes_sent = {};
+static TelemetryCounter bytes_received = {};
+
+static double to_kib(std::uint64_t bytes)
+{
+    return static_cast<double>(bytes) / 1024.0;
+}
+
+// Compressed size as a percentage of
+// what it would've been without compression
+static double to_ratio(std::uint64_t bytes, std::uint64_t raw_bytes)
+{
+    if(raw_bytes == 0)
+        return 100.0;
+    return 100.0 * static_cast<double>(bytes) / static_cast<double>(raw_bytes);
+}
+
+static double to_us_per_packet(std::uint64_t ns, std::uint64_t packets)
+{
+    if(packets == 0)
+        return 0.0;
+    return static_cast<double>(ns) / static_cast<double>(packets) / 1000.0;
+}
+
+static std::string format_traffic(const TrafficEntry &entry)
+{
+    const protocol::TrafficStats &stats = entry.stats;
+    std::string result = protocol::get_packet_name(entry.packet_id);
+
+    if(stats.packets_sent) {
+        result += fmt::format(" tx {} ({:.1f} KiB, {:.0f}% of raw, {:.2f} us each)", stats.packets_sent,
+            to_kib(stats.bytes_sent), to_ratio(stats.bytes_sent, stats.raw_bytes_sent), to_us_per_packet(stats.encode_ns, stats.packets_sent));
+    }
+
+    if(stats.packets_received) {
+        result += fmt::format(" rx {} ({:.1f} KiB, {:.0f}% of raw, {:.2f} us each)", stats.packets_received,
+            to_kib(stats.bytes_received), to_ratio(stats.bytes_received, stats.raw_bytes_received), to_us_per_packet(stats.decode_ns, stats.packets_received));
+    }
+
+    return result;
+}
+
+static std::uint64_t get_total_bytes(const protocol::TrafficStats &stats)
+{
+    return stats.bytes_sent + stats.bytes_received;
+}
+
+// Packet types that have seen any traffic,
+// the most bandwidth-hungry ones first
+static std::vector<TrafficEntry> sort_traffic(const std::array<protocol::TrafficStats, protocol::NUM_PACKETS> &traffic)
+{
+    std::vector<TrafficEntry> entries = {};
+
+    for(std::uint16_t i = 0; i < protocol::NUM_PACKETS; ++i) {
+        if(traffic[i].packets_sent || traffic[i].packets_received) {
+            TrafficEntry entry = {};
+            entry.packet_id = i;
+            entry.stats = traffic[i];
+            entries.push_back(entry);
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const TrafficEntry &a, const TrafficEntry &b) {
+        return get_total_bytes(a.stats) > get_total_bytes(b.stats);
+    });
+
+    return entries;
+}
+
+static std::array<protocol::TrafficStats, protocol::NUM_PACKETS> get_all_traffic(void)
+{
+    std::array<protocol::TrafficStats, protocol::NUM_PACKETS> traffic = {};
+    for(std::uint16_t i = 0; i < protocol::NUM_PACKETS; ++i)
+        traffic[i] = protocol::get_traffic(i);
+    return traffic;
+}
+
+static void dump(void)
+{
+    const std::array<protocol::TrafficStats, protocol::NUM_PACKETS> traffic = get_all_traffic();
+    const double seconds = cxpr::max(1.0, static_cast<double>(globals::curtime - dump_time) / 1000000.0);
+
+    std::array<protocol::TrafficStats, protocol::NUM_PACKETS> delta = {};
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t bytes_received = 0;
+
+    for(std::size_t i = 0; i < protocol::NUM_PACKETS; ++i) {
+        delta[i].packets_sent = traffic[i].packets_sent - dump_traffic[i].packets_sent;
+        delta[i].bytes_sent = traffic[i].bytes_sent - dump_traffic[i].bytes_sent;
+        delta[i].raw_bytes_sent = traffic[i].raw_bytes_sent - dump_traffic[i].raw_bytes_sent;
+        delta[i].encode_ns = traffic[i].encode_ns - dump_traffic[i].encode_ns;
+        delta[i].packets_received = traffic[i].packets_received - dump_traffic[i].packets_received;
+        delta[i].bytes_received = traffic[i].bytes_received - dump_traffic[i].bytes_received;
+        delta[i].raw_bytes_received = traffic[i].raw_bytes_received - dump_traffic[i].raw_bytes_received;
+        delta[i].decode_ns = traffic[i].decode_ns - dump_traffic[i].decode_ns;
+        bytes_sent += delta[i].bytes_sent;
+        bytes_received += delta[i].bytes_received;
+    }
+
+    dump_time = globals::curtime;
+    dump_traffic = traffic;
+
+    if(bytes_sent || bytes_received) {
+        spdlog::info("netstats: last {:.0f}s: tx {:.1f} KiB/s, rx {:.1f} KiB/s", seconds, to_kib(bytes_sent) / seconds, to_kib(bytes_received) / seconds);
+
+        for(const TrafficEntry &entry : sort_traffic(delta)) {
+            spdlog::info("netstats: {}", format_traffic(entry));
+        }
+    }
+}
+
+static void update_telemetry(void)
+{
+    std::uint64_t sent = 0;
+    std::uint64_t received = 0;
+
+    for(const protocol::TrafficStats &stats : get_all_traffic()) {
+        sent += stats.bytes_sent;
+        received += stats.bytes_received;
+    }
+
+    bytes_sent.add(sent - telemetry_sent);
+    bytes_received.add(received - telemetry_received);
+    telemetry_sent = sent;
+    telemetry_received = received;
+}
+
+static void on_netstats_command(Session *session, const std::vector<std::string> &args)
+{
+    if(args.size() >= 2) {
+        const Session *target = sessions::find(args[1]);
+
+        if(!target) {
+            server_chat::send(session, "no such player: " + args[1]);
+            return;
+        }
+
+        const protocol::PeerTraffic traffic = protocol::get_traffic(target->peer);
+        server_chat::send(session, fmt::format("{}: tx {} ({:.1f} KiB); rx {} ({:.1f} KiB)", target->username,
+            traffic.packets_sent, to_kib(traffic.bytes_sent), traffic.packets_received, to_kib(traffic.bytes_received)));
+        return;
+    }
+
+    const std::vector<TrafficEntry> entries = sort_traffic(get_all_traffic());
+    const std::size_t count = cxpr::min(entries.size(), MAX_CHAT_LINES);
+
+    for(std::size_t i = 0; i < count; ++i) {
+        server_chat::send(session, format_traffic(entries[i]));
+    }
+}
+
+void netstats::init(void)
+{
+    Config::add(globals::server_config, "netstats.interval", interval);
+
+    server_chat::add_command("netstats", &on_netstats_command);
+
+    telemetry::add("network.bytes_sent", bytes_sent);
+    telemetry::add("network.bytes_received", bytes_received);
+}
+
+void netstats::init_late(void)
+{
+    dump_time = globals::curtime;
+    telemetry_time = globals::curtime;
+}
+
+void netstats::deinit(void)
+{
+    if(interval) {
+        // Whatever happened since the last dump
+        dump();
+    }
+}
+
+void netstats::update_late(void)
+{
+    if((globals::curtime - telemetry_time) >= TELEMETRY_INTERVAL_US) {
+        telemetry_time = globals::curtime;
+        update_telemetry();
+    }
+
+    if(interval && ((globals::curtime - dump_time) >= UINT64_C(1000000) * interval)) {
+        dump();
+    }
+}
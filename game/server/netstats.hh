@@ -0,0 +1,11 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+
+namespace netstats
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+void update_late(void);
+} // namespace netstats
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <atomic>
+#include <common/mpsc_queue.hh>
+#include <common/profiler.hh>
+#include <emhash/hash_table8.hpp>
+#include <common/telemetry.hh>
+#include <game/server/flood.hh>
+#include <game/server/globals.hh>
+#include <game/server/network.hh>
+#include <game/server/scheduler.hh>
+#include <game/server/sessions.hh>
+#include <game/shared/capture.hh>
+#include <game/shared/protocol.hh>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+// The network thread owns the ENet host: it services
+// it, decodes incoming packets and encodes outgoing ones.
+// The simulation thread only ever sees decoded messages
+constexpr static enet_uint32 SERVICE_TIMEOUT_MS = 1;
+// With nobody around there's nothing to send and
+// the thread can block until something arrives
+constexpr static enet_uint32 IDLE_SERVICE_TIMEOUT_MS = 1000;
+
+static std::atomic<bool> is_servicing = {};
+static std::atomic<bool> is_idle = {};
+static std::atomic<std::size_t> num_peers = {};
+static TelemetryCounter num_processed = {};
+static std::thread network_thread = {};
+
+// Network thread only; peers without
+// a player can't send any entity state
+static emhash8::HashMap<ENetPeer *, entt::entity> players = {};
+
+// Network thread -> simulation thread
+static MPSCQueue<protocol::Message> incoming = {};
+// Simulation thread -> network thread
+static MPSCQueue<protocol::Message> outgoing = {};
+
+static void push_outgoing(protocol::Message &&message)
+{
+    outgoing.push(std::move(message));
+}
+
+static void flush_outgoing(void)
+{
+    protocol::Message message = {};
+    while(outgoing.pop(message)) {
+        message();
+    }
+}
+
+static bool is_foreign_state(const ENetPacket *packet, ENetPeer *peer)
+{
+    const entt::entity entity = protocol::peek_entity(packet);
+
+    if(entity == entt::null) {
+        // Not entity state at all
+        return false;
+    }
+
+    const auto it = players.find(peer);
+    return (it == players.cend()) || (it->second != entity);
+}
+
+static void handle_event(const ENetEvent &event)
+{
+    if(event.type == ENET_EVENT_TYPE_CONNECT) {
+        capture::record(CAPTURE_CONNECT, event.peer);
+        protocol::reset_baselines(event.peer);
+        protocol::reset_traffic(event.peer);
+        protocol::add_peer(event.peer);
+        flood::reset(event.peer);
+
+        // An idle server has to be
+        // up to speed by the next tick
+        num_peers.store(globals::server_host->connectedPeers, std::memory_order_release);
+        scheduler::interrupt();
+
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_DISCONNECT) {
+        capture::record(CAPTURE_DISCONNECT, event.peer);
+        protocol::reset_baselines(event.peer);
+        protocol::reset_traffic(event.peer);
+        protocol::remove_peer(event.peer);
+        flood::reset(event.peer);
+        players.erase(event.peer);
+
+        num_peers.store(globals::server_host->connectedPeers, std::memory_order_release);
+
+        // Sessions belong to the simulation
+        ENetPeer *peer = event.peer;
+        incoming.push([peer](void) {
+            sessions::destroy(sessions::find(peer));
+        });
+
+        return;
+    }
+
+    if(event.type == ENET_EVENT_TYPE_RECEIVE) {
+        capture::record(CAPTURE_RECEIVE, event.peer, event.channelID, event.packet);
+
+        const FloodVerdict verdict = flood::admit(event.peer, protocol::peek_id(event.packet));
+
+        if(is_foreign_state(event.packet, event.peer)) {
+            // Every entity a client makes up would
+            // otherwise get its own decoding baseline
+            enet_packet_destroy(event.packet);
+            return;
+        }
+
+        if(verdict == FLOOD_ADMIT) {
+            if(protocol::Message message = protocol::decode(event.packet, event.peer))
+                incoming.push(std::move(message));
+            enet_packet_destroy(event.packet);
+            return;
+        }
+
+        if(verdict == FLOOD_KICK) {
+            // The disconnect packet is encoded through the
+            // queue as well; the peer is let go once it's out
+            ENetPeer *peer = event.peer;
+            protocol::send_disconnect(peer, nullptr, "protocol.kicked_flooding");
+            outgoing.push([peer](void) {
+                enet_peer_disconnect_later(peer, 0);
+            });
+        }
+
+        if((event.packet->flags & ENET_PACKET_FLAG_RELIABLE) && (protocol::peek_entity(event.packet) != entt::null)) {
+            // Reliable entity state is acknowledged and never sent
+            // again; these are the keyframes later deltas are decoded
+            // against, so the delta decoder still has to see them
+            static_cast<void>(protocol::decode(event.packet, event.peer));
+        }
+
+        enet_packet_destroy(event.packet);
+        return;
+    }
+}
+
+static void network_main(void)
+{
+    ENetEvent event = {};
+
+    profiler::set_thread_name("network");
+
+    while(is_servicing.load(std::memory_order_acquire)) {
+        flush_outgoing();
+
+        // Block for a little while; packets sent while
+        // we're waiting only wait for the timeout to run out
+        const enet_uint32 timeout = is_idle.load(std::memory_order_acquire) ? IDLE_SERVICE_TIMEOUT_MS : SERVICE_TIMEOUT_MS;
+
+        if(enet_host_service(globals::server_host, &event, timeout) > 0) {
+            handle_event(event);
+
+            while(enet_host_check_events(globals::server_host, &event) > 0) {
+                handle_event(event);
+            }
+        }
+    }
+
+    // Whatever the simulation has sent
+    // before shutting us down must still go out
+    flush_outgoing();
+    enet_host_flush(globals::server_host);
+}
+
+void server_network::init_late(void)
+{
+    telemetry::add("network.messages", num_processed);
+
+    protocol::set_send_queue(&push_outgoing);
+
+    is_servicing.store(true, std::memory_order_release);
+    network_thread = std::thread(&network_main);
+
+    spdlog::info("network: started the network thread");
+}
+
+void server_network::deinit(void)
+{
+    if(network_thread.joinable()) {
+        is_servicing.store(false, std::memory_order_release);
+        network_thread.join();
+    }
+
+    // Any packet sent from now on is
+    // encoded and sent on the calling thread
+    protocol::set_send_queue(nullptr);
+    players.clear();
+
+    protocol::Message message = {};
+    while(incoming.pop(message)) {
+        // Discard everything the
+        // simulation hasn't got to yet
+    }
+}
+
+void server_network::update(void)
+{
+    protocol::Message message = {};
+    while(incoming.pop(message)) {
+        num_processed.add();
+        message();
+    }
+
+    // Traffic counters belong to the network
+    // thread; they're merged once every tick
+    outgoing.push(&protocol::flush_traffic);
+}
+
+std::uint64_t server_network::get_num_processed(void)
+{
+    return num_processed.get();
+}
+
+void server_network::set_idle(bool idle)
+{
+    is_idle.store(idle, std::memory_order_release);
+}
+
+void server_network::set_player(ENetPeer *peer, entt::entity player)
+{
+    outgoing.push([peer, player](void) {
+        players[peer] = player;
+    });
+}
+
+std::size_t server_network::get_num_peers(void)
+{
+    return num_peers.load(std::memory_order_acquire);
+}
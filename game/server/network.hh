@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <enet/enet.h>
+#include <entt/entity/entity.hpp>
+
+namespace server_network
+{
+void init_late(void);
+void deinit(void);
+void update(void);
+} // namespace server_network
+
+namespace server_network
+{
+// Safe to call from any thread
+std::uint64_t get_num_processed(void);
+std::size_t get_num_peers(void);
+} // namespace server_network
+
+namespace server_network
+{
+// The network thread blocks for longer while
+// idle; connecting peers interrupt the scheduler
+void set_idle(bool idle);
+} // namespace server_network
+
+namespace server_network
+{
+// Entity state sent by a peer is only decoded
+// for its own player; anything else is dropped
+void set_player(ENetPeer *peer, entt::entity player);
+} // namespace server_network
@@ -0,0 +1,256 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <common/config.hh>
+#include <common/telemetry.hh>
+#include <game/server/chat.hh>
+#include <game/server/globals.hh>
+#include <game/server/scheduler.hh>
+#include <mathlib/constexpr.hh>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <vector>
+
+// Tick timings are kept for this long
+constexpr static std::uint64_t HISTORY_SECONDS = 10;
+// Warnings about the server falling behind
+// are logged at most this often
+constexpr static std::uint64_t WARNING_INTERVAL_US = UINT64_C(5000000);
+
+struct TickSample final {
+    std::uint64_t start {};
+    std::uint64_t duration {};
+};
+
+struct TickReport final {
+    double tps {};
+    double tps_low {};
+    double mspt[4] {}; // p50, p95, p99, max
+};
+
+// A server more than this many ticks behind
+// gives up on catching up and starts over from now
+static unsigned int max_catchup = 4U;
+
+// Time between two ticks; only ever differs
+// from the tickrate's while the server is idle
+static std::uint64_t tick_interval = UINT64_C(0);
+
+static std::uint64_t deadline = UINT64_C(0);
+static std::uint64_t tick_start = UINT64_C(0);
+static std::uint64_t warning_time = UINT64_C(0);
+
+static std::mutex wait_mutex = {};
+static std::condition_variable wait_cv = {};
+static bool is_interrupted = false;
+
+static std::vector<TickSample> history = {};
+static std::size_t history_next = 0;
+static std::size_t history_size = 0;
+
+static TelemetryCounter num_ticks = {};
+static TelemetryCounter num_overruns = {};
+static TelemetryCounter num_catchups = {};
+static TelemetryCounter num_skipped = {};
+static TelemetryHistogram tick_durations = {};
+
+// Deadlines are points on the monotonic clock; the
+// wall clock can be stepped back and forth at any time
+static std::uint64_t get_time(void)
+{
+    const auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(since_epoch).count());
+}
+
+static double to_ms(std::uint64_t us)
+{
+    return static_cast<double>(us) / 1000.0;
+}
+
+static std::uint64_t percentile(std::vector<std::uint64_t> &values, double fraction)
+{
+    const std::size_t index = static_cast<std::size_t>(fraction * static_cast<double>(values.size() - 1));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static TickReport make_report(void)
+{
+    TickReport report = {};
+
+    if(history_size < 2) {
+        // Not enough ticks
+        // to tell anything yet
+        return report;
+    }
+
+    std::vector<std::uint64_t> durations = {};
+    std::vector<std::uint64_t> intervals = {};
+    std::uint64_t first_start = UINT64_MAX;
+    std::uint64_t last_start = UINT64_C(0);
+
+    for(std::size_t i = 0; i < history_size; ++i) {
+        // Oldest sample first
+        const std::size_t index = (history_next + history.size() - history_size + i) % history.size();
+        const TickSample &sample = history[index];
+
+        if(i) {
+            const std::size_t previous = (index + history.size() - 1) % history.size();
+            intervals.push_back(sample.start - history[previous].start);
+        }
+
+        durations.push_back(sample.duration);
+        first_start = cxpr::min(first_start, sample.start);
+        last_start = cxpr::max(last_start, sample.start);
+    }
+
+    report.tps = 1000000.0 * static_cast<double>(history_size - 1) / static_cast<double>(cxpr::max<std::uint64_t>(1, last_start - first_start));
+    report.tps_low = 1000000.0 / static_cast<double>(cxpr::max<std::uint64_t>(1, percentile(intervals, 0.99)));
+    report.mspt[0] = to_ms(percentile(durations, 0.50));
+    report.mspt[1] = to_ms(percentile(durations, 0.95));
+    report.mspt[2] = to_ms(percentile(durations, 0.99));
+    report.mspt[3] = to_ms(*std::max_element(durations.cbegin(), durations.cend()));
+
+    return report;
+}
+
+static std::string format_report(const TickReport &report)
+{
+    return fmt::format("{:.2f} TPS ({:.2f} 1% low), {:.2f}/{:.2f}/{:.2f}/{:.2f} MSPT p50/p95/p99/max",
+        report.tps, report.tps_low, report.mspt[0], report.mspt[1], report.mspt[2], report.mspt[3]);
+}
+
+static void on_tps_command(Session *session, const std::vector<std::string> &)
+{
+    server_chat::send(session, format_report(make_report()));
+    server_chat::send(session, fmt::format("{} ticks, {} overruns, {} caught up, {} skipped", num_ticks.get(), num_overruns.get(), num_catchups.get(), num_skipped.get()));
+}
+
+void scheduler::init(void)
+{
+    Config::add(globals::server_config, "server.max_catchup", max_catchup);
+
+    server_chat::add_command("tps", &on_tps_command);
+
+    telemetry::add("server.ticks", num_ticks);
+    telemetry::add("server.overruns", num_overruns);
+    telemetry::add("server.catchups", num_catchups);
+    telemetry::add("server.skipped", num_skipped);
+    telemetry::add("server.tick_us", tick_durations);
+}
+
+void scheduler::init_late(void)
+{
+    max_catchup = cxpr::clamp(max_catchup, 1U, 100U);
+
+    tick_interval = globals::tickrate_dt;
+
+    history.resize(HISTORY_SECONDS * globals::tickrate);
+    history_next = 0;
+    history_size = 0;
+
+    deadline = get_time();
+}
+
+void scheduler::deinit(void)
+{
+    spdlog::info("scheduler: last {}s: {}", HISTORY_SECONDS, format_report(make_report()));
+    spdlog::info("scheduler: {} ticks, {} overruns, {} caught up, {} skipped", num_ticks.get(), num_overruns.get(), num_catchups.get(), num_skipped.get());
+}
+
+void scheduler::wait(void)
+{
+    std::uint64_t curtime = get_time();
+
+    if(curtime < deadline) {
+        std::unique_lock<std::mutex> lock(wait_mutex);
+
+        // Only a heartbeat can be cut short; a
+        // regular tick is going to be due soon anyway
+        const bool is_interruptible = (tick_interval > globals::tickrate_dt);
+
+        // Sleeping towards a fixed point in time means
+        // oversleeping once doesn't delay every tick after
+        const auto wakeup = std::chrono::steady_clock::time_point(std::chrono::microseconds(deadline));
+        wait_cv.wait_until(lock, wakeup, [is_interruptible](void) {
+            return is_interruptible && is_interrupted;
+        });
+
+        const bool was_interrupted = is_interruptible && is_interrupted;
+        is_interrupted = false;
+        lock.unlock();
+
+        curtime = get_time();
+
+        if(was_interrupted && (curtime < deadline)) {
+            // Ticks are due starting
+            // from now on instead
+            deadline = curtime;
+        }
+    }
+    else if(num_ticks.get() && (curtime - deadline >= globals::tickrate_dt)) {
+        // Running a tick that was
+        // due some time ago already
+        num_catchups.add();
+    }
+
+    tick_start = curtime;
+}
+
+void scheduler::end_tick(void)
+{
+    const std::uint64_t curtime = get_time();
+    const std::uint64_t duration = curtime - tick_start;
+
+    history[history_next].start = tick_start;
+    history[history_next].duration = duration;
+    history_next = (history_next + 1) % history.size();
+    history_size = cxpr::min(history_size + 1, history.size());
+
+    num_ticks.add();
+    tick_durations.record(duration);
+
+    if(duration > globals::tickrate_dt) {
+        num_overruns.add();
+
+        if(curtime - warning_time >= WARNING_INTERVAL_US) {
+            spdlog::warn("scheduler: tick took {:.2f} ms, {:.2f} ms budget", to_ms(duration), to_ms(globals::tickrate_dt));
+            warning_time = curtime;
+        }
+    }
+
+    deadline += tick_interval;
+
+    if(curtime > deadline) {
+        const std::uint64_t behind = (curtime - deadline) / tick_interval;
+
+        if(behind > max_catchup) {
+            // Catching up on everything would take the
+            // server even further behind; missed ticks are lost
+            if(curtime - warning_time >= WARNING_INTERVAL_US) {
+                spdlog::warn("scheduler: {:.2f} ms behind, skipping {} ticks", to_ms(curtime - deadline), behind);
+                warning_time = curtime;
+            }
+
+            num_skipped.add(behind);
+            deadline = curtime;
+        }
+    }
+}
+
+void scheduler::set_interval(std::uint64_t interval)
+{
+    tick_interval = cxpr::max(interval, globals::tickrate_dt);
+}
+
+void scheduler::interrupt(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        is_interrupted = true;
+    }
+
+    wait_cv.notify_one();
+}
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstdint>
+
+namespace scheduler
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+} // namespace scheduler
+
+namespace scheduler
+{
+// Ticks are due at fixed points in time; wait sleeps
+// until the next one is and returns right away when the
+// server is behind, so missed ticks are run back to back
+void wait(void);
+void end_tick(void);
+} // namespace scheduler
+
+namespace scheduler
+{
+// Ticks are further apart while the server is
+// idle; interrupt wakes up a waiting heartbeat
+// right away and is safe to call from any thread
+void set_interval(std::uint64_t interval);
+void interrupt(void);
+} // namespace scheduler
@@ -1,42 +1,89 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
 #include <common/config.hh>
+#include <common/epoch.hh>
+#include <common/telemetry.hh>
+#include <emhash/hash_table8.hpp>
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/server/globals.hh>
+#include <game/server/network.hh>
 #include <game/server/sessions.hh>
 #include <game/shared/chunk.hh>
+#include <game/shared/entity/chunk.hh>
 #include <game/shared/entity/head.hh>
 #include <game/shared/entity/player.hh>
 #include <game/shared/entity/transform.hh>
 #include <game/shared/entity/velocity.hh>
 #include <game/shared/event/chunk_create.hh>
 #include <game/shared/event/chunk_update.hh>
-#include <game/shared/event/voxel_set.hh>
+#include <game/shared/event/voxel_batch.hh>
 #include <game/shared/protocol.hh>
+#include <game/shared/world.hh>
 #include <mathlib/constexpr.hh>
 #include <spdlog/fmt/fmt.h>
 #include <spdlog/spdlog.h>
-#include <unordered_map>
 #include <vector>
 
 unsigned int sessions::max_players = 16U;
 unsigned int sessions::num_players = 0U;
 
-static std::unordered_map<std::uint64_t, Session *> sessions_map = {};
+// The client is not waited for
+// any longer than this after logging in
+constexpr static std::uint64_t SPAWN_TIMEOUT_US = UINT64_C(30000000);
+// A chunk with more voxels changed during a tick
+// than this is sent as a whole instead of voxel by voxel
+constexpr static std::size_t MAX_VOXELS_PER_BATCH = 128;
+
+static unsigned int spawn_radius = 4U;
+static unsigned int spawn_rate = 4096U;
+static unsigned int fill_rate = 512U;
+static std::size_t spawn_chunks_per_tick = 0;
+static std::size_t fill_chunks_per_tick = 0;
+
+// Players still going through the join stages
+// are counted as players and as joining ones
+static TelemetryGauge telemetry_players = {};
+static TelemetryGauge telemetry_joining = {};
+static TelemetryGauge telemetry_requests = {};
+
+// Sessions live in slots indexed by session_id; free
+// slots are kept on a stack and the sessions in use are
+// listed separately so that nothing has to walk every slot
 static std::vector<Session> sessions_vector = {};
+static std::vector<std::uint16_t> free_slots = {};
+static std::vector<Session *> connected = {};
+static emhash8::HashMap<std::uint64_t, Session *> sessions_map = {};
+static emhash8::HashMap<std::string, Session *> usernames = {};
 
-static std::string make_unique_username(const std::string &username)
+// Chunk checksums are only ever needed when someone
+// logs in, so they are computed lazily and dropped as
+// soon as the chunk is changed in any way
+static emhash8::HashMap<entt::entity, std::uint64_t> chunk_hashes = {};
+
+static void send_chunk_hash(ENetPeer *peer, entt::entity entity)
 {
-    for(const Session &session : sessions_vector) {
-        if(session.peer) {
-            if(session.username.compare(username))
-                continue;
-            return make_unique_username(username + std::string("(1)"));
-        }
+    if(const ChunkComponent *component = globals::registry.try_get<ChunkComponent>(entity)) {
+        auto it = chunk_hashes.find(entity);
+
+        if(it == chunk_hashes.cend())
+            it = chunk_hashes.emplace(entity, Chunk::checksum(component->chunk->voxels)).first;
+
+        protocol::ChunkHash packet = {};
+        packet.entity = entity;
+        packet.chunk = component->coord;
+        packet.hash = it->second;
+        protocol::send(peer, nullptr, packet);
     }
+}
 
-    return username;
+static std::string make_unique_username(const std::string &username)
+{
+    std::string result = username;
+    for(unsigned int i = 1U; usernames.find(result) != usernames.cend(); ++i)
+        result = fmt::format("{}({})", username, i);
+    return result;
 }
 
 static void on_login_request_packet(const protocol::LoginRequest &packet)
@@ -60,39 +107,10 @@ static void on_login_request_packet(const protocol::LoginRequest &packet)
 
         spdlog::info("sessions: {} [{}] logged in with session_id={}", session->username, session->player_uid, session->session_id);
 
-        // FIXME: this is not a good idea
-        for(auto entity : globals::registry.view<entt::entity>()) {
-            protocol::send_chunk_voxels(session->peer, nullptr, entity);
-            protocol::send_entity_head(session->peer, nullptr, entity);
-            protocol::send_entity_transform(session->peer, nullptr, entity);
-            protocol::send_entity_velocity(session->peer, nullptr, entity);
-            protocol::send_entity_player(session->peer, nullptr, entity);
-        }
-
-        session->player = globals::registry.create();
-        globals::registry.emplace<HeadComponent>(session->player, HeadComponent());
-        globals::registry.emplace<PlayerComponent>(session->player, PlayerComponent());
-        globals::registry.emplace<TransformComponent>(session->player, TransformComponent());
-        globals::registry.emplace<VelocityComponent>(session->player, VelocityComponent());
-
-        // The player entity is to be spawned in the world the last;
-        // We don't want to interact with the still not-loaded world!
-        protocol::send_entity_head(nullptr, globals::server_host, session->player);
-        protocol::send_entity_transform(nullptr, globals::server_host, session->player);
-        protocol::send_entity_velocity(nullptr, globals::server_host, session->player);
-        protocol::send_entity_player(nullptr, globals::server_host, session->player);
-
-        // SpawnPlayer serves a different purpose compared to EntityPlayer
-        // The latter is used to construct entities (as in "attach a component")
-        // whilst the SpawnPlayer packet is used to notify client-side that the
-        // entity identifier in the packet is to be treated as the local player entity
-        protocol::send_spawn_player(session->peer, nullptr, session->player);
-
-        protocol::ChatMessage message = {};
-        message.type = protocol::ChatMessage::PLAYER_JOIN;
-        message.sender = session->username;
-        message.message = std::string();
-        protocol::send(nullptr, globals::server_host, message);
+        // The world is streamed starting
+        // with the next sessions::update_late
+        session->join_stage = JOIN_HANDSHAKE;
+        session->join_time = epoch::microseconds();
 
         return;
     }
@@ -103,11 +121,15 @@ static void on_login_request_packet(const protocol::LoginRequest &packet)
 static void on_disconnect_packet(const protocol::Disconnect &packet)
 {
     if(Session *session = sessions::find(packet.peer)) {
-        protocol::ChatMessage message = {};
-        message.type = protocol::ChatMessage::PLAYER_LEAVE;
-        message.sender = session->username;
-        message.message = packet.reason;
-        protocol::send(session->peer, globals::server_host, message);
+        if(globals::registry.valid(session->player)) {
+            // Nobody has seen the player
+            // join if it never got spawned
+            protocol::ChatMessage message = {};
+            message.type = protocol::ChatMessage::PLAYER_LEAVE;
+            message.sender = session->username;
+            message.message = packet.reason;
+            protocol::send(session->peer, globals::server_host, message);
+        }
 
         spdlog::info("{} disconnected ({})", session->username, packet.reason);
 
@@ -115,11 +137,212 @@ static void on_disconnect_packet(const protocol::Disconnect &packet)
     }
 }
 
+static void on_chunk_request_packet(const protocol::ChunkRequest &packet)
+{
+    if(Session *session = sessions::find(packet.peer)) {
+        session->chunk_requests.push_back(packet.chunk);
+    }
+}
+
+static void spawn_player(Session *session)
+{
+    session->player = globals::registry.create();
+    globals::registry.emplace<HeadComponent>(session->player, HeadComponent());
+    globals::registry.emplace<PlayerComponent>(session->player, PlayerComponent());
+    globals::registry.emplace<TransformComponent>(session->player, TransformComponent());
+    globals::registry.emplace<VelocityComponent>(session->player, VelocityComponent());
+    server_network::set_player(session->peer, session->player);
+
+    protocol::send_entity_head(nullptr, globals::server_host, session->player);
+    protocol::send_entity_transform(nullptr, globals::server_host, session->player);
+    protocol::send_entity_velocity(nullptr, globals::server_host, session->player);
+    protocol::send_entity_player(nullptr, globals::server_host, session->player);
+
+    // SpawnPlayer serves a different purpose compared to EntityPlayer
+    // The latter is used to construct entities (as in "attach a component")
+    // whilst the SpawnPlayer packet is used to notify client-side that the
+    // entity identifier in the packet is to be treated as the local player entity
+    protocol::send_spawn_player(session->peer, nullptr, session->player);
+
+    protocol::ChatMessage message = {};
+    message.type = protocol::ChatMessage::PLAYER_JOIN;
+    message.sender = session->username;
+    message.message = std::string();
+    protocol::send(nullptr, globals::server_host, message);
+
+    session->join_stage = JOIN_FILL;
+}
+
+static void on_spawn_ready_packet(const protocol::SpawnReady &packet)
+{
+    if(Session *session = sessions::find(packet.peer)) {
+        if(session->join_stage == JOIN_SPAWN_WAIT) {
+            const std::uint64_t elapsed = epoch::microseconds() - session->join_time;
+            spdlog::info("sessions: {} spawned after {} ms ({} chunks loaded)", session->username, elapsed / UINT64_C(1000), packet.num_chunks);
+            spawn_player(session);
+        }
+    }
+}
+
+static void begin_join(Session *session)
+{
+    // Players are spawned wherever
+    // a default transform puts them
+    const ChunkCoord spawn = TransformComponent().position.chunk;
+    const auto distance = [&spawn](const ChunkCoord &cpos) {
+        const std::int64_t dx = static_cast<std::int64_t>(cpos[0]) - spawn[0];
+        const std::int64_t dy = static_cast<std::int64_t>(cpos[1]) - spawn[1];
+        const std::int64_t dz = static_cast<std::int64_t>(cpos[2]) - spawn[2];
+        return dx * dx + dy * dy + dz * dz;
+    };
+
+    session->join_chunks.clear();
+    for(const auto [entity, component] : globals::registry.view<ChunkComponent>().each())
+        session->join_chunks.push_back(component.coord);
+
+    std::sort(session->join_chunks.begin(), session->join_chunks.end(), [&distance](const ChunkCoord &a, const ChunkCoord &b) {
+        return distance(a) > distance(b);
+    });
+
+    const std::int64_t radius = static_cast<std::int64_t>(spawn_radius) * static_cast<std::int64_t>(spawn_radius);
+    session->join_spawn_left = static_cast<std::size_t>(std::count_if(session->join_chunks.cbegin(), session->join_chunks.cend(), [&](const ChunkCoord &cpos) {
+        return distance(cpos) <= radius;
+    }));
+
+    session->join_spawn_sent = 0;
+
+    // Other entities are few and cheap
+    // to send compared to the world itself
+    for(const auto entity : globals::registry.view<entt::entity>()) {
+        if(globals::registry.all_of<ChunkComponent>(entity))
+            continue;
+        protocol::send_entity_head(session->peer, nullptr, entity);
+        protocol::send_entity_transform(session->peer, nullptr, entity);
+        protocol::send_entity_velocity(session->peer, nullptr, entity);
+        protocol::send_entity_player(session->peer, nullptr, entity);
+    }
+
+    protocol::SpawnArea packet = {};
+    packet.type = protocol::SpawnArea::STREAMING;
+    packet.num_chunks = static_cast<std::uint32_t>(session->join_spawn_left);
+    protocol::send(session->peer, nullptr, packet);
+
+    session->join_stage = JOIN_SPAWN_AREA;
+}
+
+static std::size_t advertise_chunks(Session *session, std::size_t count)
+{
+    std::size_t num_sent = 0;
+
+    for(; count && !session->join_chunks.empty(); --count) {
+        // Chunks that are gone by now
+        // are not worth telling anyone about
+        if(const Chunk *chunk = world::find(session->join_chunks.back())) {
+            send_chunk_hash(session->peer, chunk->entity);
+            num_sent += 1;
+        }
+
+        session->join_chunks.pop_back();
+    }
+
+    return num_sent;
+}
+
+static void update_join(Session *session)
+{
+    if(session->join_stage == JOIN_HANDSHAKE) {
+        // Fall through to streaming
+        begin_join(session);
+    }
+
+    if(session->join_stage == JOIN_SPAWN_AREA) {
+        const std::size_t count = cxpr::min<std::size_t>(session->join_spawn_left, spawn_chunks_per_tick);
+        session->join_spawn_sent += advertise_chunks(session, count);
+        session->join_spawn_left -= count;
+
+        if(!session->join_spawn_left) {
+            protocol::SpawnArea packet = {};
+            packet.type = protocol::SpawnArea::COMPLETE;
+            packet.num_chunks = static_cast<std::uint32_t>(session->join_spawn_sent);
+            protocol::send(session->peer, nullptr, packet);
+
+            session->join_stage = JOIN_SPAWN_WAIT;
+        }
+
+        return;
+    }
+
+    if(session->join_stage == JOIN_SPAWN_WAIT) {
+        if(epoch::microseconds() - session->join_time >= SPAWN_TIMEOUT_US) {
+            // The client might as well fall through the
+            // world but holding the player back forever is worse
+            spdlog::warn("sessions: {} didn't load the spawn area in time", session->username);
+            spawn_player(session);
+        }
+
+        return;
+    }
+
+    if(session->join_stage == JOIN_FILL) {
+        advertise_chunks(session, fill_chunks_per_tick);
+
+        if(session->join_chunks.empty()) {
+            session->join_chunks.shrink_to_fit();
+            session->join_stage = JOIN_DONE;
+        }
+
+        return;
+    }
+}
+
+static void send_chunk_bundles(Session *session)
+{
+    // Sorting puts chunks of the same column next to
+    // each other, which is where most of the similarity is
+    std::sort(session->chunk_requests.begin(), session->chunk_requests.end(), [](const ChunkCoord &a, const ChunkCoord &b) {
+        if(a[0] != b[0])
+            return a[0] < b[0];
+        if(a[2] != b[2])
+            return a[2] < b[2];
+        return a[1] < b[1];
+    });
+
+    const auto last = std::unique(session->chunk_requests.begin(), session->chunk_requests.end());
+    session->chunk_requests.erase(last, session->chunk_requests.end());
+
+    protocol::ChunkBundle packet = {};
+    packet.chunks.reserve(protocol::ChunkBundle::MAX_CHUNKS);
+
+    for(const ChunkCoord &cpos : session->chunk_requests) {
+        if(const Chunk *chunk = world::find(cpos)) {
+            protocol::ChunkBundle::Entry entry = {};
+            entry.entity = chunk->entity;
+            entry.chunk = cpos;
+            entry.voxels = chunk->voxels;
+            packet.chunks.push_back(entry);
+
+            if(packet.chunks.size() >= protocol::ChunkBundle::MAX_CHUNKS) {
+                protocol::send(session->peer, nullptr, packet);
+                packet.chunks.clear();
+            }
+        }
+    }
+
+    if(!packet.chunks.empty()) {
+        // Whatever didn't fill up a whole bundle
+        protocol::send(session->peer, nullptr, packet);
+    }
+
+    session->chunk_requests.clear();
+}
+
 // NOTE: [sessions] is a good place for this since [receive]
 // handles entity data sent by players and [sessions] handles
 // everything else network related that is not player movement
 static void on_chunk_create(const ChunkCreateEvent &event)
 {
+    chunk_hashes.erase(event.chunk->entity);
+
     protocol::ChunkVoxels packet = {};
     packet.entity = event.chunk->entity;
     packet.chunk = event.coord;
@@ -129,6 +352,8 @@ static void on_chunk_create(const ChunkCreateEvent &event)
 
 static void on_chunk_update(const ChunkUpdateEvent &event)
 {
+    chunk_hashes.erase(event.chunk->entity);
+
     protocol::ChunkVoxels packet = {};
     packet.entity = event.chunk->entity;
     packet.chunk = event.coord;
@@ -136,9 +361,18 @@ static void on_chunk_update(const ChunkUpdateEvent &event)
     protocol::send(nullptr, globals::server_host, packet);
 }
 
-static void on_voxel_set(const VoxelSetEvent &event)
+static void on_voxel_batch(const VoxelBatchEvent &event)
 {
-    protocol::send_set_voxel(nullptr, globals::server_host, event.vpos, event.voxel);
+    chunk_hashes.erase(event.chunk->entity);
+
+    if(event.voxels.size() > MAX_VOXELS_PER_BATCH) {
+        protocol::send_chunk_voxels(nullptr, globals::server_host, event.chunk->entity);
+        return;
+    }
+
+    for(const VoxelSetEvent &voxel : event.voxels) {
+        protocol::send_set_voxel(nullptr, globals::server_host, voxel.vpos, voxel.voxel);
+    }
 }
 
 static void on_destroy_entity(const entt::registry &registry, entt::entity entity)
@@ -146,28 +380,52 @@ static void on_destroy_entity(const entt::registry &registry, entt::entity entit
     protocol::RemoveEntity packet = {};
     packet.entity = entity;
     protocol::send(nullptr, globals::server_host, packet);
+    protocol::reset_baselines(entity);
+    chunk_hashes.erase(entity);
 }
 
 void sessions::init(void)
 {
     Config::add(globals::server_config, "sessions.max_players", sessions::max_players);
+    Config::add(globals::server_config, "sessions.spawn_radius", spawn_radius);
+    Config::add(globals::server_config, "sessions.spawn_rate", spawn_rate);
+    Config::add(globals::server_config, "sessions.fill_rate", fill_rate);
 
     globals::dispatcher.sink<protocol::LoginRequest>().connect<&on_login_request_packet>();
     globals::dispatcher.sink<protocol::Disconnect>().connect<&on_disconnect_packet>();
+    globals::dispatcher.sink<protocol::ChunkRequest>().connect<&on_chunk_request_packet>();
+    globals::dispatcher.sink<protocol::SpawnReady>().connect<&on_spawn_ready_packet>();
 
     globals::dispatcher.sink<ChunkCreateEvent>().connect<&on_chunk_create>();
     globals::dispatcher.sink<ChunkUpdateEvent>().connect<&on_chunk_update>();
-    globals::dispatcher.sink<VoxelSetEvent>().connect<&on_voxel_set>();
+    globals::dispatcher.sink<VoxelBatchEvent>().connect<&on_voxel_batch>();
 
     globals::registry.on_destroy<entt::entity>().connect<&on_destroy_entity>();
+
+    telemetry::add("sessions.players", telemetry_players);
+    telemetry::add("sessions.joining", telemetry_joining);
+    telemetry::add("sessions.chunk_requests", telemetry_requests);
 }
 
 void sessions::init_late(void)
 {
-    sessions::max_players = cxpr::clamp<unsigned int>(sessions::max_players, 1U, UINT16_MAX);
+    // Session identifiers are 16-bit and
+    // UINT16_MAX is what marks a free slot
+    sessions::max_players = cxpr::clamp<unsigned int>(sessions::max_players, 1U, UINT16_MAX - 1U);
     sessions::num_players = 0U;
 
+    // Rates are in chunks per second; the client requests
+    // whatever it doesn't have cached, so the fill rate has to
+    // stay well within the chunk request flood budget
+    spawn_radius = cxpr::clamp<unsigned int>(spawn_radius, 1U, 8U);
+    spawn_rate = cxpr::max<unsigned int>(spawn_rate, 1U);
+    fill_rate = cxpr::clamp<unsigned int>(fill_rate, 1U, 1024U);
+    spawn_chunks_per_tick = cxpr::max<std::size_t>(1, spawn_rate / globals::tickrate);
+    fill_chunks_per_tick = cxpr::max<std::size_t>(1, fill_rate / globals::tickrate);
+
     sessions_vector.resize(sessions::max_players, Session());
+    free_slots.resize(sessions::max_players);
+    connected.reserve(sessions::max_players);
 
     for(unsigned int i = 0U; i < sessions::max_players; ++i) {
         sessions_vector[i].session_id = UINT16_MAX;
@@ -175,36 +433,69 @@ void sessions::init_late(void)
         sessions_vector[i].username = std::string();
         sessions_vector[i].player = entt::null;
         sessions_vector[i].peer = nullptr;
+
+        // Lowest session identifiers
+        // are handed out first
+        free_slots[i] = static_cast<std::uint16_t>(sessions::max_players - i - 1U);
     }
 }
 
 void sessions::deinit(void)
 {
+    chunk_hashes.clear();
     sessions_map.clear();
+    usernames.clear();
+    connected.clear();
+    free_slots.clear();
     sessions_vector.clear();
 }
 
+void sessions::update_late(void)
+{
+    std::int64_t joining = 0;
+    std::int64_t requests = 0;
+
+    for(Session *session : connected) {
+        if(session->join_stage != JOIN_DONE) {
+            update_join(session);
+            joining += 1;
+        }
+
+        if(!session->chunk_requests.empty()) {
+            requests += static_cast<std::int64_t>(session->chunk_requests.size());
+            send_chunk_bundles(session);
+        }
+    }
+
+    telemetry_players.set(sessions::num_players);
+    telemetry_joining.set(joining);
+    telemetry_requests.set(requests);
+}
+
 Session *sessions::create(ENetPeer *peer, std::uint64_t player_uid, const std::string &username)
 {
-    for(unsigned int i = 0U; i < sessions::max_players; ++i) {
-        if(!sessions_vector[i].peer) {
-            sessions_vector[i].session_id = i;
-            sessions_vector[i].player_uid = player_uid;
-            sessions_vector[i].username = make_unique_username(username);
-            sessions_vector[i].player = entt::null;
-            sessions_vector[i].peer = peer;        
+    if(free_slots.empty())
+        return nullptr;
 
-            sessions_map[player_uid] = &sessions_vector[i];
+    Session *session = &sessions_vector[free_slots.back()];
+    session->session_id = free_slots.back();
+    session->player_uid = player_uid;
+    session->username = make_unique_username(username);
+    session->player = entt::null;
+    session->peer = peer;
+    session->join_stage = JOIN_HANDSHAKE;
+    session->connected_index = connected.size();
 
-            peer->data = &sessions_vector[i];
+    free_slots.pop_back();
+    connected.push_back(session);
+    sessions_map[player_uid] = session;
+    usernames[session->username] = session;
 
-            sessions::num_players += 1U;
+    peer->data = session;
 
-            return &sessions_vector[i];
-        }
-    }
+    sessions::num_players += 1U;
 
-    return nullptr;
+    return session;
 }
 
 Session *sessions::find(std::uint16_t session_id)
@@ -231,23 +522,67 @@ Session *sessions::find(ENetPeer *peer)
     return reinterpret_cast<Session *>(peer->data);
 }
 
+Session *sessions::find(const std::string &username)
+{
+    const auto it = usernames.find(username);
+    if(it != usernames.cend())
+        return it->second;
+    return nullptr;
+}
+
+const std::vector<Session *> &sessions::get_connected(void)
+{
+    return connected;
+}
+
+std::size_t sessions::get_spawn_area_size(void)
+{
+    const std::size_t diameter = 2U * static_cast<std::size_t>(spawn_radius) + 1U;
+    return diameter * diameter * diameter;
+}
+
 void sessions::destroy(Session *session)
 {
-    if(session) {
+    // Free slots are on the free list already
+    if(session && (session->session_id != UINT16_MAX)) {
         if(session->peer) {
             // Make sure we don't leave a mark
             session->peer->data = nullptr;
         }
         
-        globals::registry.destroy(session->player);
+        if(globals::registry.valid(session->player)) {
+            // Still loading the world
+            globals::registry.destroy(session->player);
+        }
+
+        const auto it = sessions_map.find(session->player_uid);
+        if((it != sessions_map.cend()) && (it->second == session)) {
+            // Someone else might have logged
+            // in with the same player_uid since
+            sessions_map.erase(it);
+        }
+
+        usernames.erase(session->username);
+
+        // The last connected session takes the place
+        // of this one so that the list stays contiguous
+        connected[session->connected_index] = connected.back();
+        connected[session->connected_index]->connected_index = session->connected_index;
+        connected.pop_back();
 
-        sessions_map.erase(session->player_uid);
+        free_slots.push_back(session->session_id);
 
         session->session_id = UINT16_MAX;
         session->player_uid = UINT64_MAX;
         session->username = std::string();
         session->player = entt::null;
         session->peer = nullptr;
+        session->is_admin = false;
+        session->chunk_requests.clear();
+        session->join_stage = JOIN_HANDSHAKE;
+        session->join_chunks.clear();
+        session->join_spawn_left = 0;
+        session->join_spawn_sent = 0;
 
         sessions::num_players -= 1U;
     }
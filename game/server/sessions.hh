@@ -4,7 +4,18 @@
 #include <cstdint>
 #include <enet/enet.h>
 #include <entt/entity/entity.hpp>
+#include <game/shared/chunk_coord.hh>
 #include <string>
+#include <vector>
+
+// Every session goes through these in order; the world
+// is streamed over several ticks, nearest chunks first
+using JoinStage = unsigned int;
+constexpr static JoinStage JOIN_HANDSHAKE   = 0U; // Logged in, nothing streamed yet
+constexpr static JoinStage JOIN_SPAWN_AREA  = 1U; // Advertising chunks around the spawn point
+constexpr static JoinStage JOIN_SPAWN_WAIT  = 2U; // Waiting for SpawnReady from the client
+constexpr static JoinStage JOIN_FILL        = 3U; // Spawned, advertising the rest of the world
+constexpr static JoinStage JOIN_DONE        = 4U;
 
 struct Session final {
     std::uint16_t session_id {};
@@ -12,6 +23,24 @@ struct Session final {
     std::string username {};
     entt::entity player {};
     ENetPeer *peer {};
+
+    // Granted by the /admin chat command
+    bool is_admin {};
+
+    // Position in sessions::get_connected
+    std::size_t connected_index {};
+
+    // Requested chunks are sent out in
+    // bundles once per tick; see sessions::update_late
+    std::vector<ChunkCoord> chunk_requests {};
+
+    // Chunks yet to be advertised are stored farthest
+    // first, so the nearest one is always at the back
+    JoinStage join_stage {};
+    std::vector<ChunkCoord> join_chunks {};
+    std::size_t join_spawn_left {};
+    std::size_t join_spawn_sent {};
+    std::uint64_t join_time {};
 };
 
 namespace sessions
@@ -25,6 +54,7 @@ namespace sessions
 void init(void);
 void init_late(void);
 void deinit(void);
+void update_late(void);
 } // namespace sessions
 
 namespace sessions
@@ -33,5 +63,17 @@ Session *create(ENetPeer *peer, std::uint64_t player_uid, const std::string &use
 Session *find(std::uint16_t session_id);
 Session *find(std::uint64_t player_uid);
 Session *find(ENetPeer *peer);
+Session *find(const std::string &username);
 void destroy(Session *session);
 } // namespace sessions
+
+namespace sessions
+{
+// Sessions in use, in no particular order; creating
+// or destroying a session invalidates any iterators
+const std::vector<Session *> &get_connected(void);
+
+// Upper bound on the number of chunks a
+// session is advertised before it can spawn
+std::size_t get_spawn_area_size(void);
+} // namespace sessions
@@ -1,11 +1,37 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/config.hh>
+#include <common/epoch.hh>
+#include <emhash/hash_table8.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/server/globals.hh>
 #include <game/server/sessions.hh>
 #include <game/server/status.hh>
 #include <game/shared/protocol.hh>
 #include <game/shared/splash.hh>
+#include <mathlib/constexpr.hh>
+#include <mutex>
+
+// How often the reply snapshot is rebuilt; the
+// network thread never looks at the sessions directly
+constexpr static std::uint64_t SNAPSHOT_INTERVAL_US = UINT64_C(1000000);
+// Forget about an address after this long
+constexpr static std::uint64_t ADDRESS_EXPIRE_US = UINT64_C(10000000);
+constexpr static std::size_t MAX_TRACKED_ADDRESSES = 4096;
+
+static unsigned int query_rate = 64U;
+static unsigned int query_interval = 250U;
+
+static std::mutex snapshot_mutex = {};
+static protocol::StatusQueryReply snapshot = {};
+static std::uint64_t snapshot_time = UINT64_C(0);
+
+// Everything below is only touched by
+// the thread that services the ENet host
+static double query_tokens = 0.0;
+static std::uint64_t query_tokens_time = UINT64_C(0);
+static emhash8::HashMap<enet_uint32, std::uint64_t> last_queries = {};
+static PacketBuffer query_buffer = {};
 
 static void on_status_request_packet(const protocol::StatusRequest &packet)
 {
@@ -17,7 +43,127 @@ static void on_status_request_packet(const protocol::StatusRequest &packet)
     protocol::send(packet.peer, nullptr, response);
 }
 
+static bool consume_query_token(std::uint64_t curtime)
+{
+    const double elapsed = static_cast<double>(curtime - query_tokens_time) / 1000000.0;
+    query_tokens = cxpr::min<double>(query_tokens + elapsed * query_rate, query_rate);
+    query_tokens_time = curtime;
+
+    if(query_tokens >= 1.0) {
+        query_tokens -= 1.0;
+        return true;
+    }
+
+    return false;
+}
+
+static bool check_query_address(const ENetAddress &address, std::uint64_t curtime)
+{
+    if(last_queries.size() >= MAX_TRACKED_ADDRESSES) {
+        for(auto it = last_queries.begin(); it != last_queries.end();) {
+            if(curtime - it->second >= ADDRESS_EXPIRE_US)
+                it = last_queries.erase(it);
+            else ++it;
+        }
+
+        if(last_queries.size() >= MAX_TRACKED_ADDRESSES) {
+            // Whoever is flooding us from this many
+            // addresses at once is not getting any replies
+            return false;
+        }
+    }
+
+    const auto it = last_queries.find(address.host);
+
+    if(it == last_queries.cend()) {
+        last_queries[address.host] = curtime;
+        return true;
+    }
+
+    if(curtime - it->second >= UINT64_C(1000) * query_interval) {
+        it->second = curtime;
+        return true;
+    }
+
+    return false;
+}
+
+static int ENET_CALLBACK on_intercept(ENetHost *host, ENetEvent *)
+{
+    if(host->receivedDataLength < sizeof(std::uint32_t))
+        return 0;
+    if(host->receivedData[0] != 0xFF || host->receivedData[1] != 0xFF || host->receivedData[2] != 0xFF || host->receivedData[3] != 0xFF)
+        return 0;
+
+    // From here on the datagram is ours; whatever
+    // happens to it, ENet should not be looking at it
+    PacketBuffer::setup(query_buffer, host->receivedData, host->receivedDataLength);
+
+    protocol::StatusQuery query = {};
+    if(!protocol::read_status_query(query_buffer, query))
+        return 1;
+
+    const std::uint64_t curtime = epoch::microseconds();
+    if(!check_query_address(host->receivedAddress, curtime))
+        return 1;
+    if(!consume_query_token(curtime))
+        return 1;
+
+    protocol::StatusQueryReply reply = {};
+
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        reply = snapshot;
+    }
+
+    reply.token = query.token;
+    protocol::write_status_query_reply(query_buffer, reply);
+
+    ENetBuffer buffer = {};
+    buffer.data = query_buffer.vector.data();
+    buffer.dataLength = query_buffer.vector.size();
+    enet_socket_send(host->socket, &host->receivedAddress, &buffer, 1);
+
+    return 1;
+}
+
+static void update_snapshot(void)
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    snapshot.version = protocol::VERSION;
+    snapshot.max_players = sessions::max_players;
+    snapshot.num_players = sessions::num_players;
+    snapshot.motd = splash::get();
+}
+
 void status::init(void)
 {
+    Config::add(globals::server_config, "status.query_rate", query_rate);
+    Config::add(globals::server_config, "status.query_interval", query_interval);
+
     globals::dispatcher.sink<protocol::StatusRequest>().connect<&on_status_request_packet>();
 }
+
+void status::init_late(void)
+{
+    query_rate = cxpr::clamp<unsigned int>(query_rate, 1U, 4096U);
+    query_interval = cxpr::clamp<unsigned int>(query_interval, 0U, 60000U);
+
+    query_tokens = query_rate;
+    query_tokens_time = epoch::microseconds();
+
+    update_snapshot();
+    snapshot_time = epoch::microseconds();
+
+    globals::server_host->intercept = &on_intercept;
+}
+
+void status::update(void)
+{
+    const std::uint64_t curtime = epoch::microseconds();
+
+    if(curtime - snapshot_time >= SNAPSHOT_INTERVAL_US) {
+        snapshot_time = curtime;
+        update_snapshot();
+    }
+}
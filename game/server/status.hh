@@ -5,4 +5,6 @@
 namespace status
 {
 void init(void);
+void init_late(void);
+void update(void);
 } // namespace status
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <atomic>
+#include <chrono>
+#include <common/config.hh>
+#include <common/epoch.hh>
+#include <common/profiler.hh>
+#include <common/telemetry.hh>
+#include <game/server/globals.hh>
+#include <game/server/network.hh>
+#include <game/server/watchdog.hh>
+#include <game/shared/worldgen.hh>
+#include <mathlib/constexpr.hh>
+#include <spdlog/spdlog.h>
+#include <thread>
+
+// Traces cover this much time before the stall ended
+constexpr static std::uint64_t TRACE_WINDOW_US = UINT64_C(5000000);
+// Traces are written at most this often
+constexpr static std::uint64_t TRACE_INTERVAL_US = UINT64_C(60000000);
+
+struct TickCounters final {
+    std::uint64_t generated {};
+    std::uint64_t processed {};
+    std::uint64_t dispatched {};
+};
+
+static bool is_enabled = true;
+// Ticks taking this many times longer
+// than they should are reported as stalls
+static unsigned int threshold = 4U;
+// Every this many stalls a trace is written;
+// zero keeps the profiler from recording at all
+static unsigned int trace_after = 3U;
+
+static std::atomic<bool> is_watching = {};
+static std::thread watchdog_thread = {};
+static TelemetryCounter num_stalls = {};
+
+// Written by the simulation thread
+static std::atomic<std::uint64_t> tick_start = {};
+static std::atomic<std::uint64_t> tick_number = {};
+static TelemetryCounter num_dispatched = {};
+static std::atomic<std::uint64_t> start_generated = {};
+static std::atomic<std::uint64_t> start_processed = {};
+static std::atomic<std::uint64_t> start_dispatched = {};
+static std::atomic<std::uint64_t> last_generated = {};
+static std::atomic<std::uint64_t> last_processed = {};
+static std::atomic<std::uint64_t> last_dispatched = {};
+
+static TickCounters get_counters(void)
+{
+    TickCounters counters = {};
+    counters.generated = worldgen::get_num_generated();
+    counters.processed = server_network::get_num_processed();
+    counters.dispatched = num_dispatched.get();
+    return counters;
+}
+
+static void report_stall(std::uint64_t number, std::uint64_t elapsed)
+{
+    const TickCounters counters = get_counters();
+    std::string stack = {};
+
+    for(const std::string &zone : profiler::get_zone_stack("simulation")) {
+        if(!stack.empty())
+            stack.append(" > ");
+        stack.append(zone);
+    }
+
+    spdlog::warn("watchdog: tick {} has been running for {:.1f} ms in {}", number, static_cast<double>(elapsed) / 1000.0,
+        stack.empty() ? std::string("an unknown place") : stack);
+    spdlog::warn("watchdog: this tick: {} chunks generated, {} packets processed, {} events dispatched",
+        counters.generated - start_generated.load(std::memory_order_relaxed),
+        counters.processed - start_processed.load(std::memory_order_relaxed),
+        counters.dispatched - start_dispatched.load(std::memory_order_relaxed));
+    spdlog::warn("watchdog: last tick: {} chunks generated, {} packets processed, {} events dispatched",
+        last_generated.load(std::memory_order_relaxed),
+        last_processed.load(std::memory_order_relaxed),
+        last_dispatched.load(std::memory_order_relaxed));
+}
+
+static void watchdog_main(void)
+{
+    const std::uint64_t limit = threshold * globals::tickrate_dt;
+    const auto poll_interval = std::chrono::microseconds(cxpr::max<std::uint64_t>(1000, globals::tickrate_dt / 4));
+
+    std::uint64_t reported_number = UINT64_MAX;
+    std::uint64_t trace_time = UINT64_C(0);
+    bool is_trace_pending = false;
+
+    while(is_watching.load(std::memory_order_acquire)) {
+        std::this_thread::sleep_for(poll_interval);
+
+        const std::uint64_t start = tick_start.load(std::memory_order_acquire);
+        const std::uint64_t number = tick_number.load(std::memory_order_acquire);
+        const std::uint64_t curtime = epoch::monotonic_microseconds();
+
+        if(start && (number != reported_number) && (curtime - start >= limit)) {
+            report_stall(number, curtime - start);
+            reported_number = number;
+            num_stalls.add();
+
+            if(trace_after && !(num_stalls.get() % trace_after) && (!trace_time || (curtime - trace_time >= TRACE_INTERVAL_US))) {
+                // The zones that have taken so long
+                // are only recorded once they end
+                is_trace_pending = true;
+            }
+
+            continue;
+        }
+
+        if(is_trace_pending && (!start || (number != reported_number))) {
+            const std::string path = fmt::format("watchdog-{}.json", epoch::seconds());
+            spdlog::warn("watchdog: {} stalls so far, writing a trace to {}", num_stalls.get(), path);
+            profiler::dump(path, UINT64_C(1000) * (curtime - cxpr::min(curtime, TRACE_WINDOW_US)));
+            is_trace_pending = false;
+            trace_time = curtime;
+        }
+    }
+}
+
+void watchdog::init(void)
+{
+    Config::add(globals::server_config, "watchdog.enabled", is_enabled);
+    Config::add(globals::server_config, "watchdog.threshold", threshold);
+    Config::add(globals::server_config, "watchdog.trace_after", trace_after);
+
+    telemetry::add("watchdog.stalls", num_stalls);
+    telemetry::add("server.dispatched", num_dispatched);
+}
+
+void watchdog::init_late(void)
+{
+    threshold = cxpr::clamp(threshold, 2U, 1000U);
+
+    if(is_enabled) {
+        profiler::enable_tracking();
+
+        if(trace_after) {
+            // Traces need zones to be recorded all
+            // the time, whatever /profile is up to
+            profiler::enable_background();
+        }
+
+        is_watching.store(true, std::memory_order_release);
+        watchdog_thread = std::thread(&watchdog_main);
+
+        spdlog::info("watchdog: reporting ticks longer than {:.1f} ms", static_cast<double>(threshold * globals::tickrate_dt) / 1000.0);
+    }
+}
+
+void watchdog::deinit(void)
+{
+    if(watchdog_thread.joinable()) {
+        is_watching.store(false, std::memory_order_release);
+        watchdog_thread.join();
+    }
+}
+
+void watchdog::begin_tick(void)
+{
+    const TickCounters counters = get_counters();
+
+    last_generated.store(counters.generated - start_generated.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    last_processed.store(counters.processed - start_processed.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    last_dispatched.store(counters.dispatched - start_dispatched.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    start_generated.store(counters.generated, std::memory_order_relaxed);
+    start_processed.store(counters.processed, std::memory_order_relaxed);
+    start_dispatched.store(counters.dispatched, std::memory_order_relaxed);
+
+    tick_number.fetch_add(1, std::memory_order_release);
+    tick_start.store(epoch::monotonic_microseconds(), std::memory_order_release);
+}
+
+void watchdog::end_tick(void)
+{
+    tick_start.store(UINT64_C(0), std::memory_order_release);
+}
+
+void watchdog::add_dispatched(std::size_t count)
+{
+    num_dispatched.add(count);
+}
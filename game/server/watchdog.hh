@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstddef>
+
+namespace watchdog
+{
+void init(void);
+void init_late(void);
+void deinit(void);
+} // namespace watchdog
+
+namespace watchdog
+{
+// Called by the simulation thread; the watchdog
+// thread keeps an eye on how long ticks take
+void begin_tick(void);
+void end_tick(void);
+void add_dispatched(std::size_t count);
+} // namespace watchdog
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <atomic>
+#include <common/epoch.hh>
+#include <common/fstools.hh>
+#include <common/packet_buffer.hh>
+#include <game/shared/capture.hh>
+#include <game/shared/protocol.hh>
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+// Capture files are a header followed by records,
+// all the integers are big-endian; see docs/01-protocol.md
+constexpr static std::uint32_t CAPTURE_MAGIC = UINT32_C(0x56434150);
+constexpr static std::uint32_t CAPTURE_FORMAT = UINT32_C(1);
+constexpr static std::size_t HEADER_SIZE = 13;
+constexpr static std::size_t RECORD_SIZE = 20;
+constexpr static PHYSFS_uint64 FILE_BUFFER_SIZE = 65536;
+
+// Flags that make any difference on the receiving
+// end; anything else is ENet's own bookkeeping
+constexpr static std::uint32_t KEPT_FLAGS = ENET_PACKET_FLAG_RELIABLE | ENET_PACKET_FLAG_UNSEQUENCED | ENET_PACKET_FLAG_UNRELIABLE_FRAGMENT;
+
+static std::atomic<bool> is_active = {};
+static std::mutex file_mutex = {};
+static PHYSFS_File *file = nullptr;
+static std::uint64_t start_time = UINT64_C(0);
+static bool record_sent = false;
+static PacketBuffer write_buffer = {};
+static PacketBuffer read_buffer = {};
+
+static void write_record(CaptureEvent event, const ENetPeer *peer, std::uint8_t channel, std::uint32_t flags, const void *data, std::size_t size)
+{
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    if(!file) {
+        // Stopped while we
+        // were waiting for the lock
+        return;
+    }
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI64(write_buffer, epoch::microseconds() - start_time);
+    PacketBuffer::write_UI16(write_buffer, peer ? peer->incomingPeerID : CAPTURE_BROADCAST);
+    PacketBuffer::write_UI8(write_buffer, static_cast<std::uint8_t>(event));
+    PacketBuffer::write_UI8(write_buffer, channel);
+    PacketBuffer::write_UI32(write_buffer, flags & KEPT_FLAGS);
+    PacketBuffer::write_UI32(write_buffer, static_cast<std::uint32_t>(size));
+
+    PHYSFS_writeBytes(file, write_buffer.vector.data(), write_buffer.vector.size());
+    PHYSFS_writeBytes(file, data, size);
+}
+
+bool capture::start(const std::string &path, CaptureSide side, bool with_sent)
+{
+    capture::stop();
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    if(!(file = PHYSFS_openWrite(path.c_str()))) {
+        spdlog::warn("capture: {}: {}", path, fstools::error());
+        return false;
+    }
+
+    PHYSFS_setBuffer(file, FILE_BUFFER_SIZE);
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI32(write_buffer, CAPTURE_MAGIC);
+    PacketBuffer::write_UI32(write_buffer, CAPTURE_FORMAT);
+    PacketBuffer::write_UI32(write_buffer, protocol::VERSION);
+    PacketBuffer::write_UI8(write_buffer, static_cast<std::uint8_t>(side));
+    PHYSFS_writeBytes(file, write_buffer.vector.data(), write_buffer.vector.size());
+
+    start_time = epoch::microseconds();
+    record_sent = with_sent;
+    is_active.store(true, std::memory_order_release);
+
+    spdlog::info("capture: recording to {}", path);
+
+    return true;
+}
+
+void capture::stop(void)
+{
+    is_active.store(false, std::memory_order_release);
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    if(file) {
+        PHYSFS_close(file);
+        file = nullptr;
+    }
+}
+
+bool capture::is_recording(void)
+{
+    return is_active.load(std::memory_order_acquire);
+}
+
+void capture::record(CaptureEvent event, const ENetPeer *peer)
+{
+    if(is_active.load(std::memory_order_acquire)) {
+        write_record(event, peer, 0, 0, nullptr, 0);
+    }
+}
+
+void capture::record(CaptureEvent event, const ENetPeer *peer, std::uint8_t channel, const ENetPacket *packet)
+{
+    if(!is_active.load(std::memory_order_acquire))
+        return;
+    if((event == CAPTURE_SEND) && !record_sent)
+        return;
+    write_record(event, peer, channel, packet->flags, packet->data, packet->dataLength);
+}
+
+bool capture::read_header(PHYSFS_File *file, CaptureHeader &header)
+{
+    read_buffer.vector.resize(HEADER_SIZE);
+
+    if(PHYSFS_readBytes(file, read_buffer.vector.data(), HEADER_SIZE) != static_cast<PHYSFS_sint64>(HEADER_SIZE))
+        return false;
+    read_buffer.read_position = 0;
+
+    if(PacketBuffer::read_UI32(read_buffer) != CAPTURE_MAGIC)
+        return false;
+    header.format = PacketBuffer::read_UI32(read_buffer);
+    header.version = PacketBuffer::read_UI32(read_buffer);
+    header.side = PacketBuffer::read_UI8(read_buffer);
+
+    return header.format == CAPTURE_FORMAT;
+}
+
+bool capture::read_record(PHYSFS_File *file, CaptureRecord &record)
+{
+    read_buffer.vector.resize(RECORD_SIZE);
+
+    if(PHYSFS_readBytes(file, read_buffer.vector.data(), RECORD_SIZE) != static_cast<PHYSFS_sint64>(RECORD_SIZE))
+        return false;
+    read_buffer.read_position = 0;
+
+    record.time = PacketBuffer::read_UI64(read_buffer);
+    record.peer_id = PacketBuffer::read_UI16(read_buffer);
+    record.event = PacketBuffer::read_UI8(read_buffer);
+    record.channel = PacketBuffer::read_UI8(read_buffer);
+    record.flags = PacketBuffer::read_UI32(read_buffer);
+
+    const std::uint32_t size = PacketBuffer::read_UI32(read_buffer);
+
+    if(size > ENET_HOST_DEFAULT_MAXIMUM_PACKET_SIZE) {
+        // Either a broken file or
+        // something that isn't a capture
+        return false;
+    }
+
+    record.payload.resize(size);
+    return PHYSFS_readBytes(file, record.payload.data(), size) == static_cast<PHYSFS_sint64>(size);
+}
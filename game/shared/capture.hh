@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+#include <physfs.h>
+#include <string>
+#include <vector>
+
+using CaptureEvent = unsigned int;
+constexpr static CaptureEvent CAPTURE_CONNECT       = 0U;
+constexpr static CaptureEvent CAPTURE_DISCONNECT    = 1U;
+constexpr static CaptureEvent CAPTURE_RECEIVE       = 2U;
+constexpr static CaptureEvent CAPTURE_SEND          = 3U;
+
+using CaptureSide = unsigned int;
+constexpr static CaptureSide CAPTURE_SERVER = 0U;
+constexpr static CaptureSide CAPTURE_CLIENT = 1U;
+
+// Peer identifier of packets sent to every peer at once
+constexpr static std::uint16_t CAPTURE_BROADCAST = UINT16_MAX;
+
+struct CaptureHeader final {
+    std::uint32_t format {};
+    std::uint32_t version {};
+    CaptureSide side {};
+};
+
+struct CaptureRecord final {
+    std::uint64_t time {};
+    std::uint16_t peer_id {};
+    CaptureEvent event {};
+    std::uint8_t channel {};
+    std::uint32_t flags {};
+    std::vector<std::uint8_t> payload {};
+};
+
+namespace capture
+{
+// Starts writing a capture file in the user directory;
+// sent packets are only recorded when asked for since
+// the server sends a lot more than it receives
+bool start(const std::string &path, CaptureSide side, bool with_sent);
+void stop(void);
+bool is_recording(void);
+} // namespace capture
+
+namespace capture
+{
+// Safe to call from any thread; does
+// nothing unless a capture is being recorded
+void record(CaptureEvent event, const ENetPeer *peer);
+void record(CaptureEvent event, const ENetPeer *peer, std::uint8_t channel, const ENetPacket *packet);
+} // namespace capture
+
+namespace capture
+{
+bool read_header(PHYSFS_File *file, CaptureHeader &header);
+bool read_record(PHYSFS_File *file, CaptureRecord &record);
+} // namespace capture
@@ -1,10 +1,48 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <common/crc64.hh>
+#include <common/telemetry.hh>
 #include <game/shared/chunk.hh>
+#include <mutex>
+#include <vector>
+
+// Chunks come and go in large numbers when
+// the world is streamed in; destroyed chunks are kept
+// around for reuse instead of going back to the heap
+constexpr static std::size_t MAX_POOLED_CHUNKS = 1024;
+
+static std::mutex pool_mutex = {};
+static std::vector<Chunk *> pool = {};
+
+// Allocated counts chunks on the heap whether
+// they're in use or not, pooled counts the latter
+static TelemetryGauge num_allocated = {};
+static TelemetryGauge num_pooled = {};
+
+static Chunk *allocate(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    if(pool.empty()) {
+        num_allocated.add(1);
+        return new Chunk();
+    }
+
+    Chunk *object = pool.back();
+    pool.pop_back();
+    num_pooled.set(static_cast<std::int64_t>(pool.size()));
+    return object;
+}
+
+void Chunk::init(void)
+{
+    telemetry::add("chunk.allocated", num_allocated);
+    telemetry::add("chunk.pooled", num_pooled);
+}
 
 Chunk *Chunk::create(ChunkType type)
 {
-    Chunk *object = new Chunk();
+    Chunk *object = allocate();
     object->voxels.fill(NULL_VOXEL);
     object->entity = entt::null;
     object->type = type;
@@ -13,7 +51,7 @@ Chunk *Chunk::create(ChunkType type)
 
 Chunk *Chunk::create(ChunkType type, entt::entity entity)
 {
-    Chunk *object = new Chunk();
+    Chunk *object = allocate();
     object->voxels.fill(NULL_VOXEL);
     object->entity = entity;
     object->type = type;
@@ -22,5 +60,42 @@ Chunk *Chunk::create(ChunkType type, entt::entity entity)
 
 void Chunk::destroy(Chunk *chunk)
 {
-    delete chunk;
+    if(chunk) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+
+        if(pool.size() < MAX_POOLED_CHUNKS) {
+            pool.push_back(chunk);
+            num_pooled.set(static_cast<std::int64_t>(pool.size()));
+            return;
+        }
+
+        num_allocated.add(-1);
+        delete chunk;
+    }
+}
+
+void Chunk::trim(void)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    for(Chunk *chunk : pool) {
+        num_allocated.add(-1);
+        delete chunk;
+    }
+
+    pool.clear();
+    pool.shrink_to_fit();
+    num_pooled.set(0);
+}
+
+std::uint64_t Chunk::checksum(const VoxelStorage &voxels)
+{
+    std::array<std::uint8_t, sizeof(VoxelStorage)> bytes = {};
+
+    for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+        bytes[2 * i + 0] = static_cast<std::uint8_t>(voxels[i] & 0xFF);
+        bytes[2 * i + 1] = static_cast<std::uint8_t>(voxels[i] >> 8);
+    }
+
+    return crc64::get(bytes.data(), bytes.size());
 }
@@ -21,8 +21,23 @@ public:
     entt::entity entity {};
     VoxelStorage voxels {};
 
+public:
+    // Registers the allocator's telemetry; called
+    // by world::init, chunks work fine without it
+    static void init(void);
+
 public:
     static Chunk *create(ChunkType type);
     static Chunk *create(ChunkType type, entt::entity entity);
     static void destroy(Chunk *chunk);
+
+public:
+    // Chunks kept around for reuse are
+    // given back to the heap for good
+    static void trim(void);
+
+public:
+    // CRC64 of the voxel data in little-endian byte order;
+    // the value is the same regardless of the host platform
+    static std::uint64_t checksum(const VoxelStorage &voxels);
 };
@@ -0,0 +1,16 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#pragma once
+#include <game/shared/chunk.hh>
+#include <game/shared/chunk_coord.hh>
+#include <game/shared/event/voxel_set.hh>
+#include <vector>
+
+// Voxels of a single chunk changed during one tick;
+// every voxel is listed once with its latest value,
+// in no particular order. See world::flush_events
+struct VoxelBatchEvent final {
+    ChunkCoord cpos {};
+    Chunk *chunk {};
+    std::vector<VoxelSetEvent> voxels {};
+};
@@ -69,6 +69,14 @@ void overworld::init_late(std::uint64_t seed)
     fnl_caves_b.frequency = 0.0075f;
 }
 
+void overworld::evict(void)
+{
+    // Heightmaps are only of any use to the
+    // chunks of a column still being generated
+    metadata_map.clear();
+    metadata_map.shrink_to_fit();
+}
+
 void overworld::generate_terrain(const ChunkCoord &cpos, VoxelStorage &voxels)
 {
     Metadata &metadata = get_metadata(ChunkCoord2D(cpos[0], cpos[2]));
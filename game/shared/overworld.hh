@@ -7,6 +7,7 @@
 namespace overworld
 {
 void init_late(std::uint64_t seed);
+void evict(void);
 } // namespace overworld
 
 namespace overworld
@@ -1,6 +1,11 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <array>
+#include <cmath>
+#include <common/epoch.hh>
 #include <common/packet_buffer.hh>
+#include <common/profiler.hh>
+#include <emhash/hash_table8.hpp>
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
 #include <game/shared/entity/chunk.hh>
@@ -8,14 +13,407 @@
 #include <game/shared/entity/transform.hh>
 #include <game/shared/entity/velocity.hh>
 #include <game/shared/globals.hh>
+#include <game/shared/capture.hh>
 #include <game/shared/protocol.hh>
+#include <mathlib/constexpr.hh>
 #include <mathlib/floathacks.hh>
 #include <miniz.h>
+#include <mutex>
 
 static PacketBuffer read_buffer = {};
 static PacketBuffer write_buffer = {};
 static std::vector<std::uint8_t> read_zdata = {};
 static std::vector<std::uint8_t> write_zdata = {};
+static std::vector<Voxel> bundle_voxels = {};
+
+// How many bytes the packet being encoded or decoded
+// would take up without compression, on top of its size
+static std::int64_t write_inflation = 0;
+static std::int64_t read_inflation = 0;
+
+struct LocalTraffic final {
+    std::array<protocol::TrafficStats, protocol::NUM_PACKETS> packets {};
+    emhash8::HashMap<ENetPeer *, protocol::PeerTraffic> peers {};
+};
+
+// Counted without any synchronization and
+// added up to the totals by protocol::flush_traffic
+static thread_local LocalTraffic local_traffic = {};
+
+// Peers that broadcasts are sent to; only ever
+// touched by the thread that services the ENet host
+static std::vector<ENetPeer *> broadcast_peers = {};
+static emhash8::HashMap<ENetPeer *, std::size_t> broadcast_indices = {};
+
+static std::mutex traffic_mutex = {};
+static std::array<protocol::TrafficStats, protocol::NUM_PACKETS> traffic_totals = {};
+static emhash8::HashMap<ENetPeer *, protocol::PeerTraffic> peer_totals = {};
+
+// Entity state fields; each packet carries a bitmask
+// of fields that differ from the peer's keyframe
+constexpr static std::uint8_t TRANSFORM_CHUNK   = 0x01;
+constexpr static std::uint8_t TRANSFORM_LOCAL_X = 0x02;
+constexpr static std::uint8_t TRANSFORM_LOCAL_Y = 0x04;
+constexpr static std::uint8_t TRANSFORM_LOCAL_Z = 0x08;
+constexpr static std::uint8_t TRANSFORM_ANGLE_X = 0x10;
+constexpr static std::uint8_t TRANSFORM_ANGLE_Y = 0x20;
+constexpr static std::uint8_t TRANSFORM_ANGLE_Z = 0x40;
+constexpr static std::uint8_t HEAD_ANGLE_X      = 0x01;
+constexpr static std::uint8_t HEAD_ANGLE_Y      = 0x02;
+constexpr static std::uint8_t HEAD_ANGLE_Z      = 0x04;
+constexpr static std::uint8_t VELOCITY_ANGULAR_X = 0x01;
+constexpr static std::uint8_t VELOCITY_ANGULAR_Y = 0x02;
+constexpr static std::uint8_t VELOCITY_ANGULAR_Z = 0x04;
+constexpr static std::uint8_t VELOCITY_LINEAR_X  = 0x08;
+constexpr static std::uint8_t VELOCITY_LINEAR_Y  = 0x10;
+constexpr static std::uint8_t VELOCITY_LINEAR_Z  = 0x20;
+constexpr static std::uint8_t STATE_KEYFRAME     = 0x80;
+
+// Fixed-point scales for the quantized entity state;
+// local coordinates get 1/4096th of a voxel precision,
+// linear velocity is good for 256 voxels per second and
+// angular velocity is good for 32 radians per second
+constexpr static float LOCAL_SCALE = 65536.0f / static_cast<float>(CHUNK_SIZE);
+constexpr static float ANGLE_SCALE = 32768.0f / cxpr::radians(180.0f);
+constexpr static float LINEAR_SCALE = 128.0f;
+constexpr static float ANGULAR_SCALE = 1024.0f;
+
+struct TransformState final {
+    std::int32_t chunk[3] {};
+    std::uint16_t local[3] {};
+    std::int16_t angles[3] {};
+};
+
+struct HeadState final {
+    std::int16_t angles[3] {};
+};
+
+struct VelocityState final {
+    std::int16_t angular[3] {};
+    std::int16_t linear[3] {};
+};
+
+// Entity state goes over an unreliable channel so deltas
+// are never chained; every update is encoded against a keyframe
+// which is sent reliably on the very same channel. ENet does not
+// deliver unreliable packets before the reliable ones sent earlier
+// on the channel, so by the time a delta is read the peer has
+// already acknowledged and stored the keyframe it refers to
+template<typename state_type>
+struct Baseline final {
+    bool valid {false};
+    state_type keyframe {};
+    state_type last_sent {};
+};
+
+struct EntityBaseline final {
+    Baseline<TransformState> transform {};
+    Baseline<HeadState> head {};
+    Baseline<VelocityState> velocity {};
+};
+
+struct PeerBaselines final {
+    emhash8::HashMap<entt::entity, EntityBaseline> outgoing {};
+    emhash8::HashMap<entt::entity, EntityBaseline> incoming {};
+};
+
+static emhash8::HashMap<ENetPeer *, PeerBaselines> baselines = {};
+
+static std::int16_t quantize(float value, float scale)
+{
+    return static_cast<std::int16_t>(cxpr::clamp<float>(std::round(value * scale), INT16_MIN, INT16_MAX));
+}
+
+static std::int16_t quantize_angle(float angle)
+{
+    // Wrapping into [-180, 180] keeps the value within range
+    return quantize(std::remainder(angle, cxpr::radians(360.0f)), ANGLE_SCALE);
+}
+
+static void quantize_state(const protocol::EntityTransform &packet, TransformState &state)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        // Make sure the local coordinate is within the chunk;
+        // the value is not always normalized by the time it's sent
+        const float carry = std::floor(packet.coord.local[i] / static_cast<float>(CHUNK_SIZE));
+        const float value = std::round((packet.coord.local[i] - carry * static_cast<float>(CHUNK_SIZE)) * LOCAL_SCALE);
+        const std::int32_t qvalue = static_cast<std::int32_t>(value);
+
+        if(qvalue >= 65536) {
+            // Rounding up got us into the next chunk
+            state.chunk[i] = packet.coord.chunk[i] + static_cast<std::int32_t>(carry) + 1;
+            state.local[i] = 0;
+        }
+        else {
+            state.chunk[i] = packet.coord.chunk[i] + static_cast<std::int32_t>(carry);
+            state.local[i] = static_cast<std::uint16_t>(cxpr::max<std::int32_t>(0, qvalue));
+        }
+
+        state.angles[i] = quantize_angle(packet.angles[i]);
+    }
+}
+
+static void quantize_state(const protocol::EntityHead &packet, HeadState &state)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        state.angles[i] = quantize_angle(packet.angles[i]);
+    }
+}
+
+static void quantize_state(const protocol::EntityVelocity &packet, VelocityState &state)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        state.angular[i] = quantize(packet.angular[i], ANGULAR_SCALE);
+        state.linear[i] = quantize(packet.linear[i], LINEAR_SCALE);
+    }
+}
+
+static void dequantize_state(const TransformState &state, protocol::EntityTransform &packet)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        packet.coord.chunk[i] = state.chunk[i];
+        packet.coord.local[i] = static_cast<float>(state.local[i]) / LOCAL_SCALE;
+        packet.angles[i] = static_cast<float>(state.angles[i]) / ANGLE_SCALE;
+    }
+}
+
+static void dequantize_state(const HeadState &state, protocol::EntityHead &packet)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        packet.angles[i] = static_cast<float>(state.angles[i]) / ANGLE_SCALE;
+    }
+}
+
+static void dequantize_state(const VelocityState &state, protocol::EntityVelocity &packet)
+{
+    for(std::size_t i = 0; i < 3; ++i) {
+        packet.angular[i] = static_cast<float>(state.angular[i]) / ANGULAR_SCALE;
+        packet.linear[i] = static_cast<float>(state.linear[i]) / LINEAR_SCALE;
+    }
+}
+
+static std::uint8_t diff_state(const TransformState &state, const TransformState &base)
+{
+    std::uint8_t flags = 0x00;
+    if(state.chunk[0] != base.chunk[0] || state.chunk[1] != base.chunk[1] || state.chunk[2] != base.chunk[2])
+        flags |= TRANSFORM_CHUNK;
+    if(state.local[0] != base.local[0])
+        flags |= TRANSFORM_LOCAL_X;
+    if(state.local[1] != base.local[1])
+        flags |= TRANSFORM_LOCAL_Y;
+    if(state.local[2] != base.local[2])
+        flags |= TRANSFORM_LOCAL_Z;
+    if(state.angles[0] != base.angles[0])
+        flags |= TRANSFORM_ANGLE_X;
+    if(state.angles[1] != base.angles[1])
+        flags |= TRANSFORM_ANGLE_Y;
+    if(state.angles[2] != base.angles[2])
+        flags |= TRANSFORM_ANGLE_Z;
+    return flags;
+}
+
+static std::uint8_t diff_state(const HeadState &state, const HeadState &base)
+{
+    std::uint8_t flags = 0x00;
+    if(state.angles[0] != base.angles[0])
+        flags |= HEAD_ANGLE_X;
+    if(state.angles[1] != base.angles[1])
+        flags |= HEAD_ANGLE_Y;
+    if(state.angles[2] != base.angles[2])
+        flags |= HEAD_ANGLE_Z;
+    return flags;
+}
+
+static std::uint8_t diff_state(const VelocityState &state, const VelocityState &base)
+{
+    std::uint8_t flags = 0x00;
+    if(state.angular[0] != base.angular[0])
+        flags |= VELOCITY_ANGULAR_X;
+    if(state.angular[1] != base.angular[1])
+        flags |= VELOCITY_ANGULAR_Y;
+    if(state.angular[2] != base.angular[2])
+        flags |= VELOCITY_ANGULAR_Z;
+    if(state.linear[0] != base.linear[0])
+        flags |= VELOCITY_LINEAR_X;
+    if(state.linear[1] != base.linear[1])
+        flags |= VELOCITY_LINEAR_Y;
+    if(state.linear[2] != base.linear[2])
+        flags |= VELOCITY_LINEAR_Z;
+    return flags;
+}
+
+// State fields are written as differences from the keyframe
+// the receiver has; the difference is zig-zag encoded and packed
+// into the smallest of four bit widths, prefixed by the width class
+constexpr static unsigned int FIELD_WIDTHS[4] = { 4U, 8U, 12U, 16U };
+
+static void write_field(PacketBuffer &buffer, std::uint16_t value, std::uint16_t base)
+{
+    // Wrapping arithmetic makes angles crossing
+    // the [-180, 180] boundary a small difference too
+    const std::int16_t delta = static_cast<std::int16_t>(static_cast<std::uint16_t>(value - base));
+    const std::uint16_t zigzag = static_cast<std::uint16_t>((static_cast<std::uint16_t>(delta) << 1U) ^ (delta < 0 ? UINT16_MAX : UINT16_C(0)));
+
+    for(unsigned int i = 0U; i < 4U; ++i) {
+        if((i == 3U) || (zigzag < (1U << FIELD_WIDTHS[i]))) {
+            PacketBuffer::write_bits(buffer, i, 2U);
+            PacketBuffer::write_bits(buffer, zigzag, FIELD_WIDTHS[i]);
+            return;
+        }
+    }
+}
+
+static std::uint16_t read_field(PacketBuffer &buffer, std::uint16_t base)
+{
+    const std::uint32_t width = PacketBuffer::read_bits(buffer, 2U);
+    const std::uint16_t zigzag = static_cast<std::uint16_t>(PacketBuffer::read_bits(buffer, FIELD_WIDTHS[width]));
+    const std::uint16_t delta = (zigzag >> 1U) ^ static_cast<std::uint16_t>(~(zigzag & 1U) + 1U);
+    return static_cast<std::uint16_t>(base + delta);
+}
+
+static void write_field(PacketBuffer &buffer, std::int16_t value, std::int16_t base)
+{
+    write_field(buffer, static_cast<std::uint16_t>(value), static_cast<std::uint16_t>(base));
+}
+
+static void read_field(PacketBuffer &buffer, std::int16_t &value, std::int16_t base)
+{
+    value = static_cast<std::int16_t>(read_field(buffer, static_cast<std::uint16_t>(base)));
+}
+
+static void read_field(PacketBuffer &buffer, std::uint16_t &value, std::uint16_t base)
+{
+    value = read_field(buffer, base);
+}
+
+static void write_state(PacketBuffer &buffer, const TransformState &state, const TransformState &base, std::uint8_t flags)
+{
+    if(flags & TRANSFORM_CHUNK) {
+        PacketBuffer::write_VI64(buffer, state.chunk[0]);
+        PacketBuffer::write_VI64(buffer, state.chunk[1]);
+        PacketBuffer::write_VI64(buffer, state.chunk[2]);
+    }
+
+    if(flags & TRANSFORM_LOCAL_X)
+        write_field(buffer, state.local[0], base.local[0]);
+    if(flags & TRANSFORM_LOCAL_Y)
+        write_field(buffer, state.local[1], base.local[1]);
+    if(flags & TRANSFORM_LOCAL_Z)
+        write_field(buffer, state.local[2], base.local[2]);
+    if(flags & TRANSFORM_ANGLE_X)
+        write_field(buffer, state.angles[0], base.angles[0]);
+    if(flags & TRANSFORM_ANGLE_Y)
+        write_field(buffer, state.angles[1], base.angles[1]);
+    if(flags & TRANSFORM_ANGLE_Z)
+        write_field(buffer, state.angles[2], base.angles[2]);
+}
+
+static void write_state(PacketBuffer &buffer, const HeadState &state, const HeadState &base, std::uint8_t flags)
+{
+    if(flags & HEAD_ANGLE_X)
+        write_field(buffer, state.angles[0], base.angles[0]);
+    if(flags & HEAD_ANGLE_Y)
+        write_field(buffer, state.angles[1], base.angles[1]);
+    if(flags & HEAD_ANGLE_Z)
+        write_field(buffer, state.angles[2], base.angles[2]);
+}
+
+static void write_state(PacketBuffer &buffer, const VelocityState &state, const VelocityState &base, std::uint8_t flags)
+{
+    if(flags & VELOCITY_ANGULAR_X)
+        write_field(buffer, state.angular[0], base.angular[0]);
+    if(flags & VELOCITY_ANGULAR_Y)
+        write_field(buffer, state.angular[1], base.angular[1]);
+    if(flags & VELOCITY_ANGULAR_Z)
+        write_field(buffer, state.angular[2], base.angular[2]);
+    if(flags & VELOCITY_LINEAR_X)
+        write_field(buffer, state.linear[0], base.linear[0]);
+    if(flags & VELOCITY_LINEAR_Y)
+        write_field(buffer, state.linear[1], base.linear[1]);
+    if(flags & VELOCITY_LINEAR_Z)
+        write_field(buffer, state.linear[2], base.linear[2]);
+}
+
+// The state passed in is expected to
+// be a copy of the keyframe the fields refer to
+static void read_state(PacketBuffer &buffer, TransformState &state, std::uint8_t flags)
+{
+    if(flags & TRANSFORM_CHUNK) {
+        state.chunk[0] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+        state.chunk[1] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+        state.chunk[2] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+    }
+
+    if(flags & TRANSFORM_LOCAL_X)
+        read_field(buffer, state.local[0], state.local[0]);
+    if(flags & TRANSFORM_LOCAL_Y)
+        read_field(buffer, state.local[1], state.local[1]);
+    if(flags & TRANSFORM_LOCAL_Z)
+        read_field(buffer, state.local[2], state.local[2]);
+    if(flags & TRANSFORM_ANGLE_X)
+        read_field(buffer, state.angles[0], state.angles[0]);
+    if(flags & TRANSFORM_ANGLE_Y)
+        read_field(buffer, state.angles[1], state.angles[1]);
+    if(flags & TRANSFORM_ANGLE_Z)
+        read_field(buffer, state.angles[2], state.angles[2]);
+}
+
+static void read_state(PacketBuffer &buffer, HeadState &state, std::uint8_t flags)
+{
+    if(flags & HEAD_ANGLE_X)
+        read_field(buffer, state.angles[0], state.angles[0]);
+    if(flags & HEAD_ANGLE_Y)
+        read_field(buffer, state.angles[1], state.angles[1]);
+    if(flags & HEAD_ANGLE_Z)
+        read_field(buffer, state.angles[2], state.angles[2]);
+}
+
+static void read_state(PacketBuffer &buffer, VelocityState &state, std::uint8_t flags)
+{
+    if(flags & VELOCITY_ANGULAR_X)
+        read_field(buffer, state.angular[0], state.angular[0]);
+    if(flags & VELOCITY_ANGULAR_Y)
+        read_field(buffer, state.angular[1], state.angular[1]);
+    if(flags & VELOCITY_ANGULAR_Z)
+        read_field(buffer, state.angular[2], state.angular[2]);
+    if(flags & VELOCITY_LINEAR_X)
+        read_field(buffer, state.linear[0], state.linear[0]);
+    if(flags & VELOCITY_LINEAR_Y)
+        read_field(buffer, state.linear[1], state.linear[1]);
+    if(flags & VELOCITY_LINEAR_Z)
+        read_field(buffer, state.linear[2], state.linear[2]);
+}
+
+// Fields that are never sent unreliably
+static std::uint8_t keyframe_fields(const TransformState &)
+{
+    return TRANSFORM_CHUNK;
+}
+
+static std::uint8_t keyframe_fields(const HeadState &)
+{
+    return 0x00;
+}
+
+static std::uint8_t keyframe_fields(const VelocityState &)
+{
+    return 0x00;
+}
+
+static Baseline<TransformState> &select_baseline(EntityBaseline &baseline, const protocol::EntityTransform &)
+{
+    return baseline.transform;
+}
+
+static Baseline<HeadState> &select_baseline(EntityBaseline &baseline, const protocol::EntityHead &)
+{
+    return baseline.head;
+}
+
+static Baseline<VelocityState> &select_baseline(EntityBaseline &baseline, const protocol::EntityVelocity &)
+{
+    return baseline.velocity;
+}
 
 static void write_voxel_storage(PacketBuffer &buffer, const VoxelStorage &storage)
 {
@@ -30,18 +428,20 @@ static void write_voxel_storage(PacketBuffer &buffer, const VoxelStorage &storag
 
     write_zdata.resize(bound);
     mz_compress(write_zdata.data(), &bound, reinterpret_cast<const unsigned char *>(net_storage.data()), sizeof(VoxelStorage));
-    PacketBuffer::write_UI64(buffer, static_cast<std::uint64_t>(bound));
-    for(mz_ulong i = 0; i < bound; PacketBuffer::write_UI8(buffer, write_zdata[i++]));
+    write_inflation += static_cast<std::int64_t>(sizeof(VoxelStorage)) - static_cast<std::int64_t>(bound);
+    PacketBuffer::write_VUI64(buffer, static_cast<std::uint64_t>(bound));
+    buffer.vector.insert(buffer.vector.end(), write_zdata.cbegin(), write_zdata.cbegin() + bound);
 }
 
 static void read_voxel_storage(PacketBuffer &buffer, VoxelStorage &storage)
 {
     mz_ulong size = static_cast<mz_ulong>(sizeof(VoxelStorage));
-    mz_ulong bound = static_cast<mz_ulong>(PacketBuffer::read_UI64(buffer));
+    mz_ulong bound = static_cast<mz_ulong>(cxpr::min<std::uint64_t>(PacketBuffer::read_VUI64(buffer), mz_compressBound(sizeof(VoxelStorage))));
 
     read_zdata.resize(bound);
     for(mz_ulong i = 0; i < bound; read_zdata[i++] = PacketBuffer::read_UI8(buffer));
     mz_uncompress(reinterpret_cast<unsigned char *>(storage.data()), &size, read_zdata.data(), bound);
+    read_inflation += static_cast<std::int64_t>(sizeof(VoxelStorage)) - static_cast<std::int64_t>(bound);
 
     for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
         // Convert voxel storage to host byte order in-situ
@@ -50,17 +450,62 @@ static void read_voxel_storage(PacketBuffer &buffer, VoxelStorage &storage)
     }
 }
 
+static std::uint16_t get_packet_id(const ENetPacket *packet)
+{
+    if(packet->dataLength < sizeof(std::uint16_t))
+        return UINT16_MAX;
+    return static_cast<std::uint16_t>((packet->data[0] << 8) | packet->data[1]);
+}
+
+static void count_sent(ENetPeer *peer, const ENetPacket *packet)
+{
+    const std::uint16_t packet_id = get_packet_id(packet);
+
+    if(packet_id < protocol::NUM_PACKETS) {
+        protocol::TrafficStats &stats = local_traffic.packets[packet_id];
+        stats.packets_sent += 1;
+        stats.bytes_sent += packet->dataLength;
+        stats.raw_bytes_sent += static_cast<std::uint64_t>(static_cast<std::int64_t>(packet->dataLength) + write_inflation);
+
+        protocol::PeerTraffic &peer_stats = local_traffic.peers[peer];
+        peer_stats.packets_sent += 1;
+        peer_stats.bytes_sent += packet->dataLength;
+    }
+}
+
+static void count_received(ENetPeer *peer, const ENetPacket *packet, std::uint64_t decode_ns)
+{
+    const std::uint16_t packet_id = get_packet_id(packet);
+
+    if(packet_id < protocol::NUM_PACKETS) {
+        protocol::TrafficStats &stats = local_traffic.packets[packet_id];
+        stats.packets_received += 1;
+        stats.bytes_received += packet->dataLength;
+        stats.raw_bytes_received += static_cast<std::uint64_t>(static_cast<std::int64_t>(packet->dataLength) + read_inflation);
+        stats.decode_ns += decode_ns;
+
+        if(peer) {
+            protocol::PeerTraffic &peer_stats = local_traffic.peers[peer];
+            peer_stats.packets_received += 1;
+            peer_stats.bytes_received += packet->dataLength;
+        }
+    }
+}
+
 // [peer], [NULL] - send to one specific peer
 // [NULL], [host] - broadcast to all the host peers
 // [peer], [host] - broadcast to all the peers except one
-static void basic_send(ENetPeer *peer, ENetHost *host, ENetPacket *packet)
+static void basic_send(ENetPeer *peer, ENetHost *host, std::uint8_t channel, ENetPacket *packet)
 {
+    capture::record(CAPTURE_SEND, host ? nullptr : peer, channel, packet);
+
     if(host) {
-        for(std::size_t i = 0; i < host->peerCount; ++i) {
-            if(host->peers[i].state == ENET_PEER_STATE_CONNECTED) {
-                if(&host->peers[i] == peer)
+        for(ENetPeer *other : broadcast_peers) {
+            if((other->host == host) && (other->state == ENET_PEER_STATE_CONNECTED)) {
+                if(other == peer)
                     continue;
-                enet_peer_send(&host->peers[i], 0, packet);
+                count_sent(other, packet);
+                enet_peer_send(other, channel, packet);
             }
         }
 
@@ -71,30 +516,103 @@ static void basic_send(ENetPeer *peer, ENetHost *host, ENetPacket *packet)
     }
     else if(peer) {
         // Send to just one peer
-        enet_peer_send(peer, 0, packet);
+        count_sent(peer, packet);
+        enet_peer_send(peer, channel, packet);
     }
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusRequest &packet)
+template<typename packet_type>
+static void delta_write(ENetPeer *peer, const packet_type &packet)
+{
+    auto &baseline = select_baseline(baselines[peer].outgoing[packet.entity], packet);
+    auto state = baseline.keyframe;
+
+    quantize_state(packet, state);
+
+    std::uint8_t flags = diff_state(state, baseline.keyframe);
+
+    if(baseline.valid && (flags == 0x00)) {
+        // The peer is up to date
+        return;
+    }
+
+    // A new keyframe is due when there is none yet, when the
+    // entity crosses a chunk border and when the state has settled
+    // down; the latter makes sure the peer doesn't miss the final
+    // position because the last unreliable update got lost
+    const bool settled = !diff_state(state, baseline.last_sent);
+    const bool keyframe = !baseline.valid || settled || (flags & keyframe_fields(state));
+
+    if(keyframe) {
+        flags |= STATE_KEYFRAME;
+    }
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, packet_type::ID);
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    PacketBuffer::write_UI8(write_buffer, flags);
+    write_state(write_buffer, state, baseline.keyframe, flags);
+
+    baseline.last_sent = state;
+
+    ENetPacket *enet_packet = nullptr;
+
+    if(keyframe) {
+        baseline.valid = true;
+        baseline.keyframe = state;
+        enet_packet = enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE);
+    }
+    else {
+        // Unreliable packets are sequenced by ENet, anything
+        // older than the latest received update gets dropped
+        enet_packet = enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), 0);
+    }
+
+    count_sent(peer, enet_packet);
+    enet_peer_send(peer, protocol::CHANNEL_ENTITY, enet_packet);
+}
+
+// Same semantics as basic_send; entity state is encoded
+// against the baseline of each receiving peer so the packet
+// has to be built separately for every single one of them
+template<typename packet_type>
+static void delta_send(ENetPeer *peer, ENetHost *host, const packet_type &packet)
+{
+    if(host) {
+        for(ENetPeer *other : broadcast_peers) {
+            if((other->host == host) && (other->state == ENET_PEER_STATE_CONNECTED)) {
+                if(other == peer)
+                    continue;
+                delta_write(other, packet);
+            }
+        }
+    }
+    else if(peer) {
+        // Send to just one peer
+        delta_write(peer, packet);
+    }
+}
+
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::StatusRequest &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::StatusRequest::ID);
     PacketBuffer::write_UI32(write_buffer, packet.version);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusResponse &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::StatusResponse &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::StatusResponse::ID);
     PacketBuffer::write_UI32(write_buffer, packet.version);
-    PacketBuffer::write_UI16(write_buffer, packet.max_players);
-    PacketBuffer::write_UI16(write_buffer, packet.num_players);
+    PacketBuffer::write_VUI64(write_buffer, packet.max_players);
+    PacketBuffer::write_VUI64(write_buffer, packet.num_players);
     PacketBuffer::write_string(write_buffer, packet.motd);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::LoginRequest::ID);
@@ -103,128 +621,380 @@ void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest
     PacketBuffer::write_UI64(write_buffer, packet.vdef_checksum);
     PacketBuffer::write_UI64(write_buffer, packet.player_uid);
     PacketBuffer::write_string(write_buffer, packet.username.substr(0, protocol::MAX_USERNAME));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginResponse &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::LoginResponse &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::LoginResponse::ID);
-    PacketBuffer::write_UI16(write_buffer, packet.session_id);
-    PacketBuffer::write_UI16(write_buffer, packet.tickrate);
+    PacketBuffer::write_VUI64(write_buffer, packet.session_id);
+    PacketBuffer::write_VUI64(write_buffer, packet.tickrate);
     PacketBuffer::write_string(write_buffer, packet.username.substr(0, protocol::MAX_USERNAME));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::Disconnect &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::Disconnect &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::Disconnect::ID);
     PacketBuffer::write_string(write_buffer, packet.reason);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkVoxels &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::ChunkVoxels &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::ChunkVoxels::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_I32(write_buffer, packet.chunk[0]);
-    PacketBuffer::write_I32(write_buffer, packet.chunk[1]);
-    PacketBuffer::write_I32(write_buffer, packet.chunk[2]);
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[0]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[1]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[2]);
     write_voxel_storage(write_buffer, packet.voxels);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityTransform &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::EntityTransform &packet)
 {
-    PacketBuffer::setup(write_buffer);
-    PacketBuffer::write_UI16(write_buffer, protocol::EntityTransform::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[0]);
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[1]);
-    PacketBuffer::write_I32(write_buffer, packet.coord.chunk[2]);
-    PacketBuffer::write_FP32(write_buffer, packet.coord.local[0]);
-    PacketBuffer::write_FP32(write_buffer, packet.coord.local[1]);
-    PacketBuffer::write_FP32(write_buffer, packet.coord.local[2]);
-    PacketBuffer::write_FP32(write_buffer, packet.angles[0]);
-    PacketBuffer::write_FP32(write_buffer, packet.angles[1]);
-    PacketBuffer::write_FP32(write_buffer, packet.angles[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    delta_send(peer, host, packet);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityHead &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::EntityHead &packet)
 {
-    PacketBuffer::setup(write_buffer);
-    PacketBuffer::write_UI16(write_buffer, protocol::EntityHead::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_FP32(write_buffer, packet.angles[0]);
-    PacketBuffer::write_FP32(write_buffer, packet.angles[1]);
-    PacketBuffer::write_FP32(write_buffer, packet.angles[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    delta_send(peer, host, packet);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityVelocity &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::EntityVelocity &packet)
 {
-    PacketBuffer::setup(write_buffer);
-    PacketBuffer::write_UI16(write_buffer, protocol::EntityVelocity::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    PacketBuffer::write_FP32(write_buffer, packet.angular[0]);
-    PacketBuffer::write_FP32(write_buffer, packet.angular[1]);
-    PacketBuffer::write_FP32(write_buffer, packet.angular[2]);
-    PacketBuffer::write_FP32(write_buffer, packet.linear[0]);
-    PacketBuffer::write_FP32(write_buffer, packet.linear[1]);
-    PacketBuffer::write_FP32(write_buffer, packet.linear[2]);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    delta_send(peer, host, packet);
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnPlayer &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::SpawnPlayer &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::SpawnPlayer::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));    
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+
+    // The player is spawned after the world has been
+    // loaded client-side, so the packet is queued behind
+    // chunk data instead of going out with entity data
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChatMessage &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::ChatMessage &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::ChatMessage::ID);
-    PacketBuffer::write_UI16(write_buffer, packet.type);
+    PacketBuffer::write_VUI64(write_buffer, packet.type);
     PacketBuffer::write_string(write_buffer, packet.sender.substr(0, protocol::MAX_USERNAME));
     PacketBuffer::write_string(write_buffer, packet.message.substr(0, protocol::MAX_CHAT));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    basic_send(peer, host, protocol::CHANNEL_GENERIC, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SetVoxel &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::SetVoxel &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::SetVoxel::ID);
-    PacketBuffer::write_I64(write_buffer, packet.coord[0]);
-    PacketBuffer::write_I64(write_buffer, packet.coord[1]);
-    PacketBuffer::write_I64(write_buffer, packet.coord[2]);
-    PacketBuffer::write_UI16(write_buffer, packet.voxel);
-    PacketBuffer::write_UI16(write_buffer, packet.flags);
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    PacketBuffer::write_VI64(write_buffer, packet.coord[0]);
+    PacketBuffer::write_VI64(write_buffer, packet.coord[1]);
+    PacketBuffer::write_VI64(write_buffer, packet.coord[2]);
+    PacketBuffer::write_VUI64(write_buffer, packet.voxel);
+    PacketBuffer::write_VUI64(write_buffer, packet.flags);
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RemoveEntity &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::RemoveEntity &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::RemoveEntity::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    basic_send(peer, host, protocol::CHANNEL_ENTITY, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityPlayer &packet)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::EntityPlayer &packet)
 {
     PacketBuffer::setup(write_buffer);
     PacketBuffer::write_UI16(write_buffer, protocol::EntityPlayer::ID);
-    PacketBuffer::write_UI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
-    basic_send(peer, host, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    basic_send(peer, host, protocol::CHANNEL_ENTITY, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
 }
 
-void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::ChunkHash &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkHash::ID);
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.entity));
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[0]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[1]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[2]);
+    PacketBuffer::write_UI64(write_buffer, packet.hash);
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::ChunkRequest &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkRequest::ID);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[0]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[1]);
+    PacketBuffer::write_VI64(write_buffer, packet.chunk[2]);
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::ChunkBundle &packet)
+{
+    const std::size_t count = cxpr::min<std::size_t>(packet.chunks.size(), protocol::ChunkBundle::MAX_CHUNKS);
+
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::ChunkBundle::ID);
+    PacketBuffer::write_VUI64(write_buffer, count);
+
+    for(std::size_t i = 0; i < count; ++i) {
+        PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(packet.chunks[i].entity));
+        PacketBuffer::write_VI64(write_buffer, packet.chunks[i].chunk[0]);
+        PacketBuffer::write_VI64(write_buffer, packet.chunks[i].chunk[1]);
+        PacketBuffer::write_VI64(write_buffer, packet.chunks[i].chunk[2]);
+    }
+
+    // Chunk N's voxels start at N * sizeof(VoxelStorage)
+    // within the decompressed payload
+    bundle_voxels.resize(count * CHUNK_VOLUME);
+    for(std::size_t i = 0; i < count; ++i) {
+        for(std::size_t j = 0; j < CHUNK_VOLUME; ++j) {
+            // Convert voxel data into network byte order
+            bundle_voxels[i * CHUNK_VOLUME + j] = ENET_HOST_TO_NET_16(packet.chunks[i].voxels[j]);
+        }
+    }
+
+    const mz_ulong size = static_cast<mz_ulong>(count * sizeof(VoxelStorage));
+    mz_ulong bound = mz_compressBound(size);
+
+    write_zdata.resize(bound);
+    mz_compress(write_zdata.data(), &bound, reinterpret_cast<const unsigned char *>(bundle_voxels.data()), size);
+    write_inflation += static_cast<std::int64_t>(size) - static_cast<std::int64_t>(bound);
+    PacketBuffer::write_VUI64(write_buffer, static_cast<std::uint64_t>(bound));
+    write_buffer.vector.insert(write_buffer.vector.end(), write_zdata.cbegin(), write_zdata.cbegin() + bound);
+
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::SpawnArea &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::SpawnArea::ID);
+    PacketBuffer::write_VUI64(write_buffer, packet.type);
+    PacketBuffer::write_VUI64(write_buffer, packet.num_chunks);
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+static void encode(ENetPeer *peer, ENetHost *host, const protocol::SpawnReady &packet)
+{
+    PacketBuffer::setup(write_buffer);
+    PacketBuffer::write_UI16(write_buffer, protocol::SpawnReady::ID);
+    PacketBuffer::write_VUI64(write_buffer, packet.num_chunks);
+    basic_send(peer, host, protocol::CHANNEL_CHUNKS, enet_packet_create(write_buffer.vector.data(), write_buffer.vector.size(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+static bool read_chunk_bundle(PacketBuffer &buffer, protocol::ChunkBundle &packet)
+{
+    const std::uint64_t count = PacketBuffer::read_VUI64(buffer);
+
+    if(count > protocol::ChunkBundle::MAX_CHUNKS)
+        return false;
+    packet.chunks.resize(static_cast<std::size_t>(count));
+
+    for(protocol::ChunkBundle::Entry &entry : packet.chunks) {
+        entry.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(buffer));
+        entry.chunk[0] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+        entry.chunk[1] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+        entry.chunk[2] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+    }
+
+    const mz_ulong expected = static_cast<mz_ulong>(packet.chunks.size() * sizeof(VoxelStorage));
+    mz_ulong bound = static_cast<mz_ulong>(cxpr::min<std::uint64_t>(PacketBuffer::read_VUI64(buffer), mz_compressBound(expected)));
+    mz_ulong size = expected;
+
+    if(buffer.read_position + bound > buffer.vector.size())
+        return false;
+
+    bundle_voxels.resize(packet.chunks.size() * CHUNK_VOLUME);
+    if(mz_uncompress(reinterpret_cast<unsigned char *>(bundle_voxels.data()), &size, buffer.vector.data() + buffer.read_position, bound) != MZ_OK)
+        return false;
+    if(size != expected)
+        return false;
+    buffer.read_position += bound;
+    read_inflation += static_cast<std::int64_t>(expected) - static_cast<std::int64_t>(bound);
+
+    for(std::size_t i = 0; i < packet.chunks.size(); ++i) {
+        for(std::size_t j = 0; j < CHUNK_VOLUME; ++j) {
+            // Convert voxel storage to host byte order
+            packet.chunks[i].voxels[j] = ENET_NET_TO_HOST_16(bundle_voxels[i * CHUNK_VOLUME + j]);
+        }
+    }
+
+    return true;
+}
+
+// Outgoing packets are handed over to the queue
+// when it's set; see protocol::set_send_queue
+static void (*send_queue)(protocol::Message &&message) = nullptr;
+
+template<typename packet_type>
+static void timed_encode(ENetPeer *peer, ENetHost *host, const packet_type &packet)
+{
+    PROFILER_ZONE("protocol::send");
+
+    const std::uint64_t start_ns = epoch::nanoseconds();
+    write_inflation = 0;
+    encode(peer, host, packet);
+    local_traffic.packets[packet_type::ID].encode_ns += epoch::nanoseconds() - start_ns;
+}
+
+template<typename packet_type>
+static void send_or_defer(ENetPeer *peer, ENetHost *host, const packet_type &packet)
+{
+    if(send_queue) {
+        send_queue([peer, host, packet](void) {
+            timed_encode(peer, host, packet);
+        });
+    }
+    else {
+        // Encode and send right away
+        timed_encode(peer, host, packet);
+    }
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusRequest &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::StatusResponse &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginRequest &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::LoginResponse &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::Disconnect &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkVoxels &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityTransform &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityHead &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityVelocity &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnPlayer &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChatMessage &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SetVoxel &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::RemoveEntity &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::EntityPlayer &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkHash &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkRequest &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::ChunkBundle &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnArea &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+void protocol::send(ENetPeer *peer, ENetHost *host, const protocol::SpawnReady &packet)
+{
+    send_or_defer(peer, host, packet);
+}
+
+template<typename packet_type>
+static protocol::Message make_message(const packet_type &packet)
+{
+    return [packet](void) {
+        globals::dispatcher.trigger(packet);
+    };
+}
+
+template<typename packet_type>
+static void delta_read(PacketBuffer &buffer, ENetPeer *peer, packet_type &packet)
+{
+    auto &baseline = select_baseline(baselines[peer].incoming[packet.entity], packet);
+    auto state = baseline.keyframe;
+
+    const std::uint8_t flags = PacketBuffer::read_UI8(buffer);
+    read_state(buffer, state, flags);
+
+    if(flags & STATE_KEYFRAME) {
+        baseline.valid = true;
+        baseline.keyframe = state;
+    }
+
+    dequantize_state(state, packet);
+}
+
+static void read_chunk_hash(PacketBuffer &buffer, ENetPeer *peer, protocol::ChunkHash &packet)
+{
+    packet.peer = peer;
+    packet.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(buffer));
+    packet.chunk[0] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+    packet.chunk[1] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+    packet.chunk[2] = static_cast<std::int32_t>(PacketBuffer::read_VI64(buffer));
+    packet.hash = PacketBuffer::read_UI64(buffer);
+}
+
+static protocol::Message decode_packet(const ENetPacket *packet, ENetPeer *peer)
 {
     PacketBuffer::setup(read_buffer, packet->data, packet->dataLength);
 
@@ -242,21 +1012,24 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
     protocol::SetVoxel set_voxel = {};
     protocol::RemoveEntity remove_entity = {};
     protocol::EntityPlayer entity_player = {};
-    
+    protocol::ChunkHash chunk_hash = {};
+    protocol::ChunkRequest chunk_request = {};
+    protocol::ChunkBundle chunk_bundle = {};
+    protocol::SpawnArea spawn_area = {};
+    protocol::SpawnReady spawn_ready = {};
+
     switch(PacketBuffer::read_UI16(read_buffer)) {
         case protocol::StatusRequest::ID:
             status_request.peer = peer;
             status_request.version = PacketBuffer::read_UI32(read_buffer);
-            globals::dispatcher.trigger(status_request);
-            break;
+            return make_message(status_request);
         case protocol::StatusResponse::ID:
             status_response.peer = peer;
             status_response.version = PacketBuffer::read_UI32(read_buffer);
-            status_response.max_players = PacketBuffer::read_UI16(read_buffer);
-            status_response.num_players = PacketBuffer::read_UI16(read_buffer);
+            status_response.max_players = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
+            status_response.num_players = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
             status_response.motd = PacketBuffer::read_string(read_buffer);
-            globals::dispatcher.trigger(status_response);
-            break;
+            return make_message(status_response);
         case protocol::LoginRequest::ID:
             login_request.peer = peer;
             login_request.version = PacketBuffer::read_UI32(read_buffer);
@@ -264,92 +1037,371 @@ void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
             login_request.vdef_checksum = PacketBuffer::read_UI64(read_buffer);
             login_request.player_uid = PacketBuffer::read_UI64(read_buffer);
             login_request.username = PacketBuffer::read_string(read_buffer);
-            globals::dispatcher.trigger(login_request);
-            break;
+            return make_message(login_request);
         case protocol::LoginResponse::ID:
             login_response.peer = peer;
-            login_response.session_id = PacketBuffer::read_UI16(read_buffer);
-            login_response.tickrate = PacketBuffer::read_UI16(read_buffer);
+            login_response.session_id = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
+            login_response.tickrate = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
             login_response.username = PacketBuffer::read_string(read_buffer);
-            globals::dispatcher.trigger(login_response);
-            break;
+            return make_message(login_response);
         case protocol::Disconnect::ID:
             disconnect.peer = peer;
             disconnect.reason = PacketBuffer::read_string(read_buffer);
-            globals::dispatcher.trigger(disconnect);
-            break;
+            return make_message(disconnect);
         case protocol::ChunkVoxels::ID:
             chunk_voxels.peer = peer;
-            chunk_voxels.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            chunk_voxels.chunk[0] = PacketBuffer::read_I32(read_buffer);
-            chunk_voxels.chunk[1] = PacketBuffer::read_I32(read_buffer);
-            chunk_voxels.chunk[2] = PacketBuffer::read_I32(read_buffer);
+            chunk_voxels.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            chunk_voxels.chunk[0] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
+            chunk_voxels.chunk[1] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
+            chunk_voxels.chunk[2] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
             read_voxel_storage(read_buffer, chunk_voxels.voxels);
-            globals::dispatcher.trigger(chunk_voxels);
-            break;
+            return make_message(chunk_voxels);
         case protocol::EntityTransform::ID:
             entity_transform.peer = peer;
-            entity_transform.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            entity_transform.coord.chunk[0] = PacketBuffer::read_I32(read_buffer);
-            entity_transform.coord.chunk[1] = PacketBuffer::read_I32(read_buffer);
-            entity_transform.coord.chunk[2] = PacketBuffer::read_I32(read_buffer);
-            entity_transform.coord.local[0] = PacketBuffer::read_FP32(read_buffer);
-            entity_transform.coord.local[1] = PacketBuffer::read_FP32(read_buffer);
-            entity_transform.coord.local[2] = PacketBuffer::read_FP32(read_buffer);
-            entity_transform.angles[0] = PacketBuffer::read_FP32(read_buffer);
-            entity_transform.angles[1] = PacketBuffer::read_FP32(read_buffer);
-            entity_transform.angles[2] = PacketBuffer::read_FP32(read_buffer);
-            globals::dispatcher.trigger(entity_transform);
-            break;
+            entity_transform.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            delta_read(read_buffer, peer, entity_transform);
+            return make_message(entity_transform);
         case protocol::EntityHead::ID:
             entity_head.peer = peer;
-            entity_head.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            entity_head.angles[0] = PacketBuffer::read_FP32(read_buffer);
-            entity_head.angles[1] = PacketBuffer::read_FP32(read_buffer);
-            entity_head.angles[2] = PacketBuffer::read_FP32(read_buffer);
-            globals::dispatcher.trigger(entity_head);
-            break;
+            entity_head.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            delta_read(read_buffer, peer, entity_head);
+            return make_message(entity_head);
         case protocol::EntityVelocity::ID:
             entity_velocity.peer = peer;
-            entity_velocity.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            entity_velocity.angular[0] = PacketBuffer::read_FP32(read_buffer);
-            entity_velocity.angular[1] = PacketBuffer::read_FP32(read_buffer);
-            entity_velocity.angular[2] = PacketBuffer::read_FP32(read_buffer);
-            entity_velocity.linear[0] = PacketBuffer::read_FP32(read_buffer);
-            entity_velocity.linear[1] = PacketBuffer::read_FP32(read_buffer);
-            entity_velocity.linear[2] = PacketBuffer::read_FP32(read_buffer);
-            globals::dispatcher.trigger(entity_velocity);
-            break;
+            entity_velocity.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            delta_read(read_buffer, peer, entity_velocity);
+            return make_message(entity_velocity);
         case protocol::SpawnPlayer::ID:
             spawn_player.peer = peer;
-            spawn_player.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            globals::dispatcher.trigger(spawn_player);
-            break;
+            spawn_player.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(spawn_player);
         case protocol::ChatMessage::ID:
             chat_message.peer = peer;
-            chat_message.type = PacketBuffer::read_UI16(read_buffer);
+            chat_message.type = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
             chat_message.sender = PacketBuffer::read_string(read_buffer);
             chat_message.message = PacketBuffer::read_string(read_buffer);
-            globals::dispatcher.trigger(chat_message);
-            break;
+            return make_message(chat_message);
         case protocol::SetVoxel::ID:
             set_voxel.peer = peer;
-            set_voxel.coord[0] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.coord[1] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.coord[2] = PacketBuffer::read_I64(read_buffer);
-            set_voxel.voxel = PacketBuffer::read_UI16(read_buffer);
-            set_voxel.flags = PacketBuffer::read_UI16(read_buffer);
-            globals::dispatcher.trigger(set_voxel);
-            break;
+            set_voxel.coord[0] = PacketBuffer::read_VI64(read_buffer);
+            set_voxel.coord[1] = PacketBuffer::read_VI64(read_buffer);
+            set_voxel.coord[2] = PacketBuffer::read_VI64(read_buffer);
+            set_voxel.voxel = static_cast<Voxel>(PacketBuffer::read_VUI64(read_buffer));
+            set_voxel.flags = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(set_voxel);
         case protocol::RemoveEntity::ID:
-            remove_entity.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            globals::dispatcher.trigger(remove_entity);
-            break;
+            remove_entity.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(remove_entity);
         case protocol::EntityPlayer::ID:
-            entity_player.entity = static_cast<entt::entity>(PacketBuffer::read_UI64(read_buffer));
-            globals::dispatcher.trigger(entity_player);
-            break;
+            entity_player.entity = static_cast<entt::entity>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(entity_player);
+        case protocol::ChunkHash::ID:
+            read_chunk_hash(read_buffer, peer, chunk_hash);
+            return make_message(chunk_hash);
+        case protocol::ChunkRequest::ID:
+            chunk_request.peer = peer;
+            chunk_request.chunk[0] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
+            chunk_request.chunk[1] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
+            chunk_request.chunk[2] = static_cast<std::int32_t>(PacketBuffer::read_VI64(read_buffer));
+            return make_message(chunk_request);
+        case protocol::ChunkBundle::ID:
+            chunk_bundle.peer = peer;
+            if(!read_chunk_bundle(read_buffer, chunk_bundle))
+                return nullptr;
+            return make_message(chunk_bundle);
+        case protocol::SpawnArea::ID:
+            spawn_area.peer = peer;
+            spawn_area.type = static_cast<std::uint16_t>(PacketBuffer::read_VUI64(read_buffer));
+            spawn_area.num_chunks = static_cast<std::uint32_t>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(spawn_area);
+        case protocol::SpawnReady::ID:
+            spawn_ready.peer = peer;
+            spawn_ready.num_chunks = static_cast<std::uint32_t>(PacketBuffer::read_VUI64(read_buffer));
+            return make_message(spawn_ready);
     }
+
+    return nullptr;
+}
+
+protocol::Message protocol::decode(const ENetPacket *packet, ENetPeer *peer)
+{
+    PROFILER_ZONE("protocol::receive");
+
+    const std::uint64_t start_ns = epoch::nanoseconds();
+    read_inflation = 0;
+    protocol::Message message = decode_packet(packet, peer);
+    count_received(peer, packet, epoch::nanoseconds() - start_ns);
+    return message;
+}
+
+bool protocol::decode(const ENetPacket *packet, ENetPeer *peer, protocol::ChunkHash &chunk_hash)
+{
+    PROFILER_ZONE("protocol::receive");
+
+    if(get_packet_id(packet) != protocol::ChunkHash::ID)
+        return false;
+
+    const std::uint64_t start_ns = epoch::nanoseconds();
+    PacketBuffer::setup(read_buffer, packet->data, packet->dataLength);
+    PacketBuffer::read_UI16(read_buffer);
+    read_chunk_hash(read_buffer, peer, chunk_hash);
+    count_received(peer, packet, epoch::nanoseconds() - start_ns);
+    return true;
+}
+
+std::uint16_t protocol::peek_id(const ENetPacket *packet)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, packet->data, cxpr::min<std::size_t>(packet->dataLength, sizeof(std::uint16_t)));
+    return PacketBuffer::read_UI16(buffer);
+}
+
+std::size_t protocol::peek_num_chunks(const ENetPacket *packet)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, packet->data, cxpr::min<std::size_t>(packet->dataLength, 16U));
+
+    switch(PacketBuffer::read_UI16(buffer)) {
+        case protocol::ChunkVoxels::ID:
+        case protocol::ChunkHash::ID:
+            return 1;
+        case protocol::ChunkBundle::ID:
+            return static_cast<std::size_t>(cxpr::min<std::uint64_t>(PacketBuffer::read_VUI64(buffer), protocol::ChunkBundle::MAX_CHUNKS));
+        default:
+            return 0;
+    }
+}
+
+entt::entity protocol::peek_entity(const ENetPacket *packet)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer, packet->data, cxpr::min<std::size_t>(packet->dataLength, 16U));
+
+    switch(PacketBuffer::read_UI16(buffer)) {
+        case protocol::EntityTransform::ID:
+        case protocol::EntityHead::ID:
+        case protocol::EntityVelocity::ID:
+            return static_cast<entt::entity>(PacketBuffer::read_VUI64(buffer));
+        default:
+            return entt::null;
+    }
+}
+
+void protocol::receive(const ENetPacket *packet, ENetPeer *peer)
+{
+    if(const protocol::Message message = protocol::decode(packet, peer)) {
+        // Trigger the dispatcher right away
+        message();
+    }
+}
+
+void protocol::set_send_queue(void (*queue)(protocol::Message &&message))
+{
+    send_queue = queue;
+}
+
+void protocol::reset_baselines(ENetPeer *peer)
+{
+    baselines.erase(peer);
+}
+
+static void erase_baselines(entt::entity entity)
+{
+    for(auto &it : baselines) {
+        it.second.outgoing.erase(entity);
+        it.second.incoming.erase(entity);
+    }
+}
+
+void protocol::reset_baselines(entt::entity entity)
+{
+    if(send_queue) {
+        // Baselines belong to whoever sends packets;
+        // this also keeps the reset ordered with RemoveEntity
+        send_queue([entity](void) {
+            erase_baselines(entity);
+        });
+    }
+    else {
+        // Erase right away
+        erase_baselines(entity);
+    }
+}
+
+void protocol::add_peer(ENetPeer *peer)
+{
+    if(broadcast_indices.find(peer) == broadcast_indices.cend()) {
+        broadcast_indices[peer] = broadcast_peers.size();
+        broadcast_peers.push_back(peer);
+    }
+}
+
+void protocol::remove_peer(ENetPeer *peer)
+{
+    const auto it = broadcast_indices.find(peer);
+
+    if(it != broadcast_indices.cend()) {
+        // The last peer takes the place of the
+        // removed one so that the list stays contiguous
+        const std::size_t index = it->second;
+        broadcast_peers[index] = broadcast_peers.back();
+        broadcast_indices[broadcast_peers[index]] = index;
+        broadcast_peers.pop_back();
+        broadcast_indices.erase(peer);
+    }
+}
+
+static void add_traffic(protocol::TrafficStats &stats, const protocol::TrafficStats &other)
+{
+    stats.packets_sent += other.packets_sent;
+    stats.bytes_sent += other.bytes_sent;
+    stats.raw_bytes_sent += other.raw_bytes_sent;
+    stats.encode_ns += other.encode_ns;
+    stats.packets_received += other.packets_received;
+    stats.bytes_received += other.bytes_received;
+    stats.raw_bytes_received += other.raw_bytes_received;
+    stats.decode_ns += other.decode_ns;
+}
+
+static void add_traffic(protocol::PeerTraffic &stats, const protocol::PeerTraffic &other)
+{
+    stats.packets_sent += other.packets_sent;
+    stats.bytes_sent += other.bytes_sent;
+    stats.packets_received += other.packets_received;
+    stats.bytes_received += other.bytes_received;
+}
+
+const char *protocol::get_packet_name(std::uint16_t packet_id)
+{
+    switch(packet_id) {
+        case protocol::StatusRequest::ID:   return "StatusRequest";
+        case protocol::StatusResponse::ID:  return "StatusResponse";
+        case protocol::LoginRequest::ID:    return "LoginRequest";
+        case protocol::LoginResponse::ID:   return "LoginResponse";
+        case protocol::Disconnect::ID:      return "Disconnect";
+        case protocol::ChunkVoxels::ID:     return "ChunkVoxels";
+        case protocol::EntityTransform::ID: return "EntityTransform";
+        case protocol::EntityHead::ID:      return "EntityHead";
+        case protocol::EntityVelocity::ID:  return "EntityVelocity";
+        case protocol::SpawnPlayer::ID:     return "SpawnPlayer";
+        case protocol::ChatMessage::ID:     return "ChatMessage";
+        case protocol::SetVoxel::ID:        return "SetVoxel";
+        case protocol::RemoveEntity::ID:    return "RemoveEntity";
+        case protocol::EntityPlayer::ID:    return "EntityPlayer";
+        case protocol::ChunkHash::ID:       return "ChunkHash";
+        case protocol::ChunkRequest::ID:    return "ChunkRequest";
+        case protocol::ChunkBundle::ID:     return "ChunkBundle";
+        case protocol::SpawnArea::ID:       return "SpawnArea";
+        case protocol::SpawnReady::ID:      return "SpawnReady";
+        default:                            return "Unknown";
+    }
+}
+
+void protocol::flush_traffic(void)
+{
+    std::lock_guard<std::mutex> lock(traffic_mutex);
+
+    for(std::size_t i = 0; i < protocol::NUM_PACKETS; ++i) {
+        add_traffic(traffic_totals[i], local_traffic.packets[i]);
+        local_traffic.packets[i] = protocol::TrafficStats();
+    }
+
+    for(const auto &it : local_traffic.peers)
+        add_traffic(peer_totals[it.first], it.second);
+    local_traffic.peers.clear();
+}
+
+void protocol::reset_traffic(ENetPeer *peer)
+{
+    std::lock_guard<std::mutex> lock(traffic_mutex);
+    local_traffic.peers.erase(peer);
+    peer_totals.erase(peer);
+}
+
+protocol::TrafficStats protocol::get_traffic(std::uint16_t packet_id)
+{
+    std::lock_guard<std::mutex> lock(traffic_mutex);
+
+    if(packet_id < protocol::NUM_PACKETS)
+        return traffic_totals[packet_id];
+    return protocol::TrafficStats();
+}
+
+protocol::PeerTraffic protocol::get_traffic(ENetPeer *peer)
+{
+    std::lock_guard<std::mutex> lock(traffic_mutex);
+
+    const auto it = peer_totals.find(peer);
+    if(it != peer_totals.cend())
+        return it->second;
+    return protocol::PeerTraffic();
+}
+
+void protocol::write_status_query(PacketBuffer &buffer, const protocol::StatusQuery &query)
+{
+    PacketBuffer::setup(buffer);
+    PacketBuffer::write_UI32(buffer, protocol::QUERY_MAGIC);
+    PacketBuffer::write_UI8(buffer, protocol::QUERY_STATUS);
+    PacketBuffer::write_UI32(buffer, query.version);
+    PacketBuffer::write_UI32(buffer, query.token);
+    buffer.vector.resize(protocol::QUERY_SIZE, UINT8_C(0x00));
+}
+
+void protocol::write_status_query_reply(PacketBuffer &buffer, const protocol::StatusQueryReply &reply)
+{
+    PacketBuffer::setup(buffer);
+    PacketBuffer::write_UI32(buffer, protocol::QUERY_MAGIC);
+    PacketBuffer::write_UI8(buffer, protocol::QUERY_STATUS_REPLY);
+    PacketBuffer::write_UI32(buffer, reply.token);
+    PacketBuffer::write_UI32(buffer, reply.version);
+    PacketBuffer::write_UI16(buffer, reply.max_players);
+    PacketBuffer::write_UI16(buffer, reply.num_players);
+
+    // Query datagrams are meant to be understood by any
+    // version out there, so their layout doesn't follow the
+    // wire format changes; the MOTD has a fixed 16-bit length
+    std::size_t motd_size = cxpr::min<std::size_t>(reply.motd.size(), protocol::QUERY_MAX_MOTD);
+
+    if(motd_size < reply.motd.size()) {
+        // Don't cut a UTF-8 sequence in half
+        while(motd_size && ((static_cast<std::uint8_t>(reply.motd[motd_size]) & 0xC0) == 0x80)) {
+            motd_size -= 1;
+        }
+    }
+
+    PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(motd_size));
+    buffer.vector.insert(buffer.vector.end(), reply.motd.cbegin(), reply.motd.cbegin() + motd_size);
+}
+
+bool protocol::read_status_query(PacketBuffer &buffer, protocol::StatusQuery &query)
+{
+    if(buffer.vector.size() < protocol::QUERY_SIZE)
+        return false;
+    if(PacketBuffer::read_UI32(buffer) != protocol::QUERY_MAGIC)
+        return false;
+    if(PacketBuffer::read_UI8(buffer) != protocol::QUERY_STATUS)
+        return false;
+    query.version = PacketBuffer::read_UI32(buffer);
+    query.token = PacketBuffer::read_UI32(buffer);
+    return true;
+}
+
+bool protocol::read_status_query_reply(PacketBuffer &buffer, protocol::StatusQueryReply &reply)
+{
+    if(PacketBuffer::read_UI32(buffer) != protocol::QUERY_MAGIC)
+        return false;
+    if(PacketBuffer::read_UI8(buffer) != protocol::QUERY_STATUS_REPLY)
+        return false;
+    reply.token = PacketBuffer::read_UI32(buffer);
+    reply.version = PacketBuffer::read_UI32(buffer);
+    reply.max_players = PacketBuffer::read_UI16(buffer);
+    reply.num_players = PacketBuffer::read_UI16(buffer);
+
+    const std::size_t motd_size = PacketBuffer::read_UI16(buffer);
+    if(buffer.read_position + motd_size > buffer.vector.size())
+        return false;
+    reply.motd.assign(buffer.vector.cbegin() + buffer.read_position, buffer.vector.cbegin() + buffer.read_position + motd_size);
+    return true;
 }
 
 void protocol::send_disconnect(ENetPeer *peer, ENetHost *host, const std::string &reason)
@@ -1,8 +1,10 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
 #pragma once
+#include <common/packet_buffer.hh>
 #include <cstdint>
 #include <enet/enet.h>
+#include <functional>
 #include <mathlib/vec3angles.hh>
 #include <game/shared/chunk.hh>
 #include <game/shared/world_coord.hh>
@@ -12,7 +14,62 @@ namespace protocol
 constexpr static std::size_t MAX_CHAT = 16384;
 constexpr static std::size_t MAX_USERNAME = 64;
 constexpr static std::uint16_t PORT = 43103;
-constexpr static std::uint32_t VERSION = 3;
+constexpr static std::uint32_t VERSION = 9;
+} // namespace protocol
+
+namespace protocol
+{
+// Reliable and ordered; status, login, chat and the like
+constexpr static std::uint8_t CHANNEL_GENERIC = 0;
+// Reliable and ordered; chunk streaming and voxel edits
+constexpr static std::uint8_t CHANNEL_CHUNKS = 1;
+// Unreliable sequenced entity state updates with
+// reliable keyframes and entity lifetime packets
+constexpr static std::uint8_t CHANNEL_ENTITY = 2;
+constexpr static std::size_t NUM_CHANNELS = 3;
+} // namespace protocol
+
+namespace protocol
+{
+// Connectionless status queries are raw datagrams sent
+// to the server port outside of any ENet connection; they
+// start with four 0xFF bytes, which ENet's own packets never
+// do since that would have them flagged as compressed
+constexpr static std::uint32_t QUERY_MAGIC = UINT32_C(0xFFFFFFFF);
+constexpr static std::uint8_t QUERY_STATUS = 0x01;
+constexpr static std::uint8_t QUERY_STATUS_REPLY = 0x02;
+// Queries are padded to this size and replies never
+// exceed it, so nobody can use the server to amplify traffic;
+// the MOTD gets whatever room the rest of the reply leaves
+constexpr static std::size_t QUERY_SIZE = 64;
+constexpr static std::size_t QUERY_REPLY_HEADER = 19;
+constexpr static std::size_t QUERY_MAX_MOTD = QUERY_SIZE - QUERY_REPLY_HEADER;
+} // namespace protocol
+
+namespace protocol
+{
+struct StatusQuery final {
+    std::uint32_t version {};
+    std::uint32_t token {};
+};
+
+struct StatusQueryReply final {
+    std::uint32_t token {};
+    std::uint32_t version {};
+    std::uint16_t max_players {};
+    std::uint16_t num_players {};
+    std::string motd {};
+};
+} // namespace protocol
+
+namespace protocol
+{
+// These don't touch any internal state
+// and are safe to call from any thread
+void write_status_query(PacketBuffer &buffer, const StatusQuery &query);
+void write_status_query_reply(PacketBuffer &buffer, const StatusQueryReply &reply);
+bool read_status_query(PacketBuffer &buffer, StatusQuery &query);
+bool read_status_query_reply(PacketBuffer &buffer, StatusQueryReply &reply);
 } // namespace protocol
 
 namespace protocol
@@ -41,6 +98,11 @@ struct ChatMessage;
 struct SetVoxel;
 struct RemoveEntity;
 struct EntityPlayer;
+struct ChunkHash;
+struct ChunkRequest;
+struct ChunkBundle;
+struct SpawnArea;
+struct SpawnReady;
 } // namespace protocol
 
 namespace protocol
@@ -59,13 +121,102 @@ void send(ENetPeer *peer, ENetHost *host, const ChatMessage &packet);
 void send(ENetPeer *peer, ENetHost *host, const SetVoxel &packet);
 void send(ENetPeer *peer, ENetHost *host, const RemoveEntity &packet);
 void send(ENetPeer *peer, ENetHost *host, const EntityPlayer &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkHash &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkRequest &packet);
+void send(ENetPeer *peer, ENetHost *host, const ChunkBundle &packet);
+void send(ENetPeer *peer, ENetHost *host, const SpawnArea &packet);
+void send(ENetPeer *peer, ENetHost *host, const SpawnReady &packet);
 } // namespace protocol
 
 namespace protocol
 {
+// A decoded packet; invoking it triggers the
+// dispatcher with the packet structure it carries
+using Message = std::function<void(void)>;
+Message decode(const ENetPacket *packet, ENetPeer *peer);
+// Chunk hashes are looked up in the client's cache before
+// anything reaches the dispatcher; this decodes one without
+// making a message and fails for any other kind of packet
+bool decode(const ENetPacket *packet, ENetPeer *peer, ChunkHash &chunk_hash);
+std::uint16_t peek_id(const ENetPacket *packet);
+std::size_t peek_num_chunks(const ENetPacket *packet);
+entt::entity peek_entity(const ENetPacket *packet);
 void receive(const ENetPacket *packet, ENetPeer *peer);
 } // namespace protocol
 
+namespace protocol
+{
+// With a send queue set, outgoing packets are not
+// encoded and sent right away; the queue receives a message
+// that does that instead and is expected to invoke it on the
+// thread that services the ENet host. Passing nullptr makes
+// protocol::send encode packets in place again
+void set_send_queue(void (*queue)(Message &&message));
+} // namespace protocol
+
+namespace protocol
+{
+// Entity state packets are delta-encoded against
+// the last state exchanged with a specific peer; the
+// baselines must be dropped when the peer (re)connects
+// and when the entity is gone for good
+void reset_baselines(ENetPeer *peer);
+void reset_baselines(entt::entity entity);
+} // namespace protocol
+
+namespace protocol
+{
+// Broadcasts go to the peers added here instead of
+// walking every peer slot of the host, most of which are
+// usually empty; the thread servicing the host must add
+// peers on connect and remove them on disconnect
+void add_peer(ENetPeer *peer);
+void remove_peer(ENetPeer *peer);
+} // namespace protocol
+
+namespace protocol
+{
+// Packet identifiers are below this; traffic
+// of anything else is not accounted for
+constexpr static std::uint16_t NUM_PACKETS = 0x0013;
+
+// Wire bytes are what ENet gets to send, raw bytes are
+// the same packets before compression; a broadcast packet
+// is counted once for every peer it's sent to
+struct TrafficStats final {
+    std::uint64_t packets_sent {};
+    std::uint64_t bytes_sent {};
+    std::uint64_t raw_bytes_sent {};
+    std::uint64_t encode_ns {};
+    std::uint64_t packets_received {};
+    std::uint64_t bytes_received {};
+    std::uint64_t raw_bytes_received {};
+    std::uint64_t decode_ns {};
+};
+
+struct PeerTraffic final {
+    std::uint64_t packets_sent {};
+    std::uint64_t bytes_sent {};
+    std::uint64_t packets_received {};
+    std::uint64_t bytes_received {};
+};
+
+const char *get_packet_name(std::uint16_t packet_id);
+} // namespace protocol
+
+namespace protocol
+{
+// Traffic is counted by whichever thread encodes and
+// decodes packets and becomes visible to everyone else
+// after that same thread calls flush_traffic; doing that
+// once per tick is more than enough. Peer totals must be
+// reset by the thread servicing the host on (dis)connect
+void flush_traffic(void);
+void reset_traffic(ENetPeer *peer);
+TrafficStats get_traffic(std::uint16_t packet_id);
+PeerTraffic get_traffic(ENetPeer *peer);
+} // namespace protocol
+
 namespace protocol
 {
 void send_disconnect(ENetPeer *peer, ENetHost *host, const std::string &reason);
@@ -166,3 +317,49 @@ struct protocol::RemoveEntity final : public protocol::Base<0x000C> {
 struct protocol::EntityPlayer final : public protocol::Base<0x000D> {
     entt::entity entity {};
 };
+
+// Sent instead of ChunkVoxels when the client might
+// already have the chunk cached; the client is expected
+// to respond with ChunkRequest if it doesn't have it
+struct protocol::ChunkHash final : public protocol::Base<0x000E> {
+    entt::entity entity {};
+    ChunkCoord chunk {};
+    std::uint64_t hash {};
+};
+
+struct protocol::ChunkRequest final : public protocol::Base<0x000F> {
+    ChunkCoord chunk {};
+};
+
+// Several chunks sent at once; the voxel data of all
+// the chunks is compressed as a single stream so that the
+// compressor can make use of neighbouring chunks' similarity
+struct protocol::ChunkBundle final : public protocol::Base<0x0010> {
+    constexpr static std::size_t MAX_CHUNKS = 32;
+
+    struct Entry final {
+        entt::entity entity {};
+        ChunkCoord chunk {};
+        VoxelStorage voxels {};
+    };
+
+    std::vector<Entry> chunks {};
+};
+
+// Sent when the server starts advertising chunks around
+// the spawn point and once again after the last of them;
+// the number of chunks is exact only in the latter packet
+struct protocol::SpawnArea final : public protocol::Base<0x0011> {
+    constexpr static std::uint16_t STREAMING = 0x0000;
+    constexpr static std::uint16_t COMPLETE  = 0x0001;
+
+    std::uint16_t type {};
+    std::uint32_t num_chunks {};
+};
+
+// Sent by the client once every chunk of
+// the spawn area is loaded; the server spawns
+// the player only after receiving this
+struct protocol::SpawnReady final : public protocol::Base<0x0012> {
+    std::uint32_t num_chunks {};
+};
@@ -1,5 +1,7 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <common/telemetry.hh>
 #include <emhash/hash_table8.hpp>
 #include <entt/entity/registry.hpp>
 #include <entt/signal/dispatcher.hpp>
@@ -7,23 +9,74 @@
 #include <game/shared/event/chunk_create.hh>
 #include <game/shared/event/chunk_remove.hh>
 #include <game/shared/event/chunk_update.hh>
+#include <game/shared/event/voxel_batch.hh>
 #include <game/shared/event/voxel_set.hh>
 #include <game/shared/globals.hh>
 #include <game/shared/local_coord.hh>
 #include <game/shared/voxel_coord.hh>
 #include <game/shared/world.hh>
+#include <miniz.h>
+#include <spdlog/spdlog.h>
 
 static emhash8::HashMap<ChunkCoord, Chunk *> chunks = {};
+static TelemetryGauge num_chunks = {};
+
+struct PackedChunk final {
+    ChunkType type {};
+    entt::entity entity {};
+    std::vector<std::uint8_t> zdata {};
+};
+
+static emhash8::HashMap<ChunkCoord, PackedChunk> packed = {};
+static TelemetryGauge packed_bytes = {};
+
+struct PendingChunk final {
+    bool is_created {};
+    bool is_updated {};
+    std::vector<VoxelSetEvent> voxels {};
+};
+
+// Changes made since the last world::flush_events
+static emhash8::HashMap<ChunkCoord, PendingChunk> pending = {};
+
+// Only the latest change of every voxel is kept;
+// the changes of different voxels don't depend on
+// each other so their order is of no importance
+static void squash_voxels(std::vector<VoxelSetEvent> &voxels)
+{
+    if(voxels.size() < 2)
+        return;
+
+    std::stable_sort(voxels.begin(), voxels.end(), [](const VoxelSetEvent &a, const VoxelSetEvent &b) {
+        return a.index < b.index;
+    });
+
+    std::size_t count = 0;
+
+    for(std::size_t i = 0; i < voxels.size(); ++i) {
+        if(((i + 1) < voxels.size()) && (voxels[i + 1].index == voxels[i].index))
+            continue;
+        voxels[count++] = voxels[i];
+    }
+
+    voxels.resize(count);
+}
 
 static void on_destroy_chunk(entt::registry &registry, entt::entity entity)
 {
     ChunkComponent &component = registry.get<ChunkComponent>(entity);
     chunks.erase(component.coord);
+    num_chunks.set(static_cast<std::int64_t>(chunks.size()));
     Chunk::destroy(component.chunk);
 }
 
 void world::init(void)
 {
+    telemetry::add("world.chunks", num_chunks);
+    telemetry::add("world.packed_bytes", packed_bytes);
+
+    Chunk::init();
+
     globals::registry.on_destroy<ChunkComponent>().connect<&on_destroy_chunk>();
 }
 
@@ -41,11 +94,7 @@ void world::emplace_or_replace(const ChunkCoord &cpos, Chunk *chunk)
         Chunk::destroy(it->second);
         it->second = chunk;
 
-        ChunkUpdateEvent event = {};
-        event.chunk = component.chunk;
-        event.coord = component.coord;
-
-        globals::dispatcher.trigger(event);
+        pending[cpos].is_updated = true;
     }
     else {
         if(!globals::registry.valid(chunk->entity)) {
@@ -58,12 +107,9 @@ void world::emplace_or_replace(const ChunkCoord &cpos, Chunk *chunk)
         component.coord = cpos;
 
         chunks.emplace(component.coord, component.chunk);
+        num_chunks.set(static_cast<std::int64_t>(chunks.size()));
 
-        ChunkCreateEvent event = {};
-        event.chunk = component.chunk;
-        event.coord = component.coord;
-
-        globals::dispatcher.trigger(event);
+        pending[cpos].is_created = true;
     }
 }
 
@@ -127,10 +173,133 @@ bool world::set_voxel(Voxel voxel, const ChunkCoord &cpos, const LocalCoord &lpo
         event.chunk = chunk;
         event.voxel = voxel;
 
-        globals::dispatcher.trigger(event);
+        pending[rcpos].voxels.push_back(event);
 
         return true;
     }
 
     return false;
 }
+
+void world::invalidate(const ChunkCoord &cpos)
+{
+    pending[cpos].is_updated = true;
+}
+
+void world::flush_events(void)
+{
+    for(auto &it : pending) {
+        // Chunks may have been replaced since the
+        // changes were made; whatever was removed
+        // altogether is not worth talking about
+        Chunk *chunk = world::find(it.first);
+
+        if(!chunk)
+            continue;
+
+        if(it.second.is_created) {
+            ChunkCreateEvent event = {};
+            event.coord = it.first;
+            event.chunk = chunk;
+            globals::dispatcher.enqueue(event);
+        }
+        else if(it.second.is_updated) {
+            ChunkUpdateEvent event = {};
+            event.coord = it.first;
+            event.chunk = chunk;
+            globals::dispatcher.enqueue(event);
+        }
+
+        if(!it.second.voxels.empty()) {
+            squash_voxels(it.second.voxels);
+
+            for(VoxelSetEvent &voxel : it.second.voxels)
+                voxel.chunk = chunk;
+
+            VoxelBatchEvent event = {};
+            event.cpos = it.first;
+            event.chunk = chunk;
+            event.voxels = std::move(it.second.voxels);
+            globals::dispatcher.enqueue(std::move(event));
+        }
+    }
+
+    pending.clear();
+}
+
+std::size_t world::pack(void)
+{
+    std::array<std::uint8_t, sizeof(VoxelStorage)> bytes = {};
+    std::vector<std::uint8_t> zdata(mz_compressBound(bytes.size()));
+    std::vector<entt::entity> entities = {};
+    std::int64_t total_bytes = packed_bytes.get();
+
+    for(const auto &it : chunks) {
+        for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+            // Voxel data is stored in little-endian byte order
+            bytes[2 * i + 0] = static_cast<std::uint8_t>(it.second->voxels[i] & 0xFF);
+            bytes[2 * i + 1] = static_cast<std::uint8_t>(it.second->voxels[i] >> 8);
+        }
+
+        mz_ulong size = static_cast<mz_ulong>(zdata.size());
+
+        if(mz_compress2(zdata.data(), &size, bytes.data(), static_cast<mz_ulong>(bytes.size()), MZ_BEST_SPEED) != MZ_OK) {
+            // Whatever doesn't compress
+            // stays where it is
+            continue;
+        }
+
+        PackedChunk &packed_chunk = packed[it.first];
+        packed_chunk.type = it.second->type;
+        packed_chunk.entity = it.second->entity;
+        packed_chunk.zdata.assign(zdata.cbegin(), zdata.cbegin() + size);
+        entities.push_back(it.second->entity);
+        total_bytes += static_cast<std::int64_t>(size);
+    }
+
+    for(const entt::entity entity : entities) {
+        // The entities stay around and keep their
+        // identifiers; only the chunks are released
+        globals::registry.remove<ChunkComponent>(entity);
+    }
+
+    chunks.shrink_to_fit();
+    packed_bytes.set(total_bytes);
+
+    return entities.size();
+}
+
+std::size_t world::unpack(void)
+{
+    std::array<std::uint8_t, sizeof(VoxelStorage)> bytes = {};
+    const std::size_t count = packed.size();
+
+    for(const auto &it : packed) {
+        Chunk *chunk = Chunk::create(it.second.type, it.second.entity);
+        mz_ulong size = static_cast<mz_ulong>(bytes.size());
+
+        if((mz_uncompress(bytes.data(), &size, it.second.zdata.data(), static_cast<mz_ulong>(it.second.zdata.size())) != MZ_OK) || (size != bytes.size())) {
+            spdlog::error("world: unable to unpack chunk {} {} {}", it.first[0], it.first[1], it.first[2]);
+        }
+        else {
+            for(std::size_t i = 0; i < CHUNK_VOLUME; ++i) {
+                // Voxel data is stored in little-endian byte order
+                chunk->voxels[i] = static_cast<Voxel>(bytes[2 * i + 0]) | static_cast<Voxel>(bytes[2 * i + 1] << 8);
+            }
+        }
+
+        ChunkComponent &component = globals::registry.emplace<ChunkComponent>(chunk->entity);
+        component.chunk = chunk;
+        component.coord = it.first;
+
+        chunks.emplace(it.first, chunk);
+    }
+
+    packed.clear();
+    packed.shrink_to_fit();
+    packed_bytes.set(0);
+
+    num_chunks.set(static_cast<std::int64_t>(chunks.size()));
+
+    return count;
+}
@@ -1,7 +1,11 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
 #pragma once
+#include <cstddef>
 #include <game/shared/chunk.hh>
+#include <game/shared/chunk_coord.hh>
+#include <game/shared/local_coord.hh>
+#include <game/shared/voxel_coord.hh>
 
 namespace world
 {
@@ -22,3 +26,24 @@ Voxel get_voxel(const ChunkCoord &cpos, const LocalCoord &lpos);
 bool set_voxel(Voxel voxel, const VoxelCoord &vpos);
 bool set_voxel(Voxel voxel, const ChunkCoord &cpos, const LocalCoord &lpos);
 } // namespace world
+
+namespace world
+{
+// Changes to the world are not announced right away;
+// they're collected per chunk and queued in the dispatcher
+// by flush_events, so that listeners run once per changed
+// chunk instead of once per changed voxel. A chunk created
+// during the tick is not reported as updated as well
+void invalidate(const ChunkCoord &cpos);
+void flush_events(void);
+} // namespace world
+
+namespace world
+{
+// Voxel data of every chunk is compressed and kept aside;
+// packed chunks are gone from the world until world::unpack
+// puts them back with the same entities. Nobody is told about
+// any of this, so it's only meant for when nobody is looking
+std::size_t pack(void);
+std::size_t unpack(void);
+} // namespace world
@@ -1,6 +1,8 @@
 // SPDX-License-Identifier: Zlib
 // Copyright (C) 2024, Voxelius Contributors
 #include <algorithm>
+#include <common/profiler.hh>
+#include <common/telemetry.hh>
 #include <emhash/hash_table8.hpp>
 #include <entt/entity/registry.hpp>
 #include <FastNoiseLite.h>
@@ -36,9 +38,13 @@ struct ProtoChunk final {
 };
 
 static emhash8::HashMap<ChunkCoord, ProtoChunk> proto_chunks = {};
+static TelemetryCounter num_generated = {};
+static TelemetryGauge backlog = {};
 
 void worldgen::init(void)
 {
+    telemetry::add("worldgen.generated", num_generated);
+    telemetry::add("worldgen.backlog", backlog);
 }
 
 void worldgen::init_late(std::uint64_t seed)
@@ -53,6 +59,8 @@ void worldgen::deinit(void)
 
 void worldgen::update(void)
 {
+    PROFILER_ZONE("worldgen::update");
+
     auto it = proto_chunks.begin();
     while(it != proto_chunks.end()) {
         if(it->second.status == ProtoStatus::Terrain) {
@@ -114,6 +122,7 @@ void worldgen::update(void)
         if(it->second.status == ProtoStatus::Submit) {
             spdlog::debug("worldgen: submit {} {} {}", it->first[0], it->first[1], it->first[2]);
             world::emplace_or_replace(it->first, it->second.chunk);
+            num_generated.add();
             it = proto_chunks.erase(it);
             continue;
         }
@@ -121,6 +130,13 @@ void worldgen::update(void)
         Chunk::destroy(it->second.chunk);
         it = proto_chunks.erase(it);
     }
+
+    backlog.set(static_cast<std::int64_t>(proto_chunks.size()));
+}
+
+std::uint64_t worldgen::get_num_generated(void)
+{
+    return num_generated.get();
 }
 
 void worldgen::generate(const ChunkCoord &cpos)
@@ -130,5 +146,19 @@ void worldgen::generate(const ChunkCoord &cpos)
         pc.chunk = Chunk::create(ChunkType::Generated);
         pc.status = ProtoStatus::Terrain;
         pc.slice = ChunkSlice::Overworld;
+        backlog.set(static_cast<std::int64_t>(proto_chunks.size()));
+    }
+}
+
+bool worldgen::is_generating(void)
+{
+    return !proto_chunks.empty();
+}
+
+void worldgen::evict(void)
+{
+    if(proto_chunks.empty()) {
+        proto_chunks.shrink_to_fit();
+        overworld::evict();
     }
 }
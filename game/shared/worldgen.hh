@@ -14,4 +14,18 @@ void update(void);
 namespace worldgen
 {
 void generate(const ChunkCoord &cpos);
+bool is_generating(void);
+} // namespace worldgen
+
+namespace worldgen
+{
+// Data kept around for the chunks yet to be generated
+// is let go of; does nothing while chunks are being generated
+void evict(void);
+} // namespace worldgen
+
+namespace worldgen
+{
+// Safe to call from any thread
+std::uint64_t get_num_generated(void);
 } // namespace worldgen
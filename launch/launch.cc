@@ -5,7 +5,9 @@
 #include <cstdlib>
 #include <enet/enet.h>
 #include <filesystem>
+#include <game/bot/main.hh>
 #include <game/client/main.hh>
+#include <game/replay/main.hh>
 #include <game/server/main.hh>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
@@ -129,6 +131,12 @@ int main(int argc, char **argv)
 #elif defined(VGAME_SERVER)
     spdlog::info("main: starting server");
     server::main();
+#elif defined(VGAME_REPLAY)
+    spdlog::info("main: starting replay");
+    replay::main();
+#elif defined(VGAME_BOT)
+    spdlog::info("main: starting bot");
+    bot::main();
 #else
     #error Have your heard of the popular hit game Among Us?
     #error Its a really cool game where 1-3 imposters try to kill off the crewmates,
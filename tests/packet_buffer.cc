@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <common/packet_buffer.hh>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+enum class FieldType {
+    Bits,
+    UI8,
+    UI16,
+    UI32,
+    UI64,
+    VUI64,
+    VI64,
+    FP32,
+    String,
+    Count,
+};
+
+struct Field final {
+    FieldType type {};
+    unsigned int count {};
+    std::uint64_t value {};
+    std::string string {};
+};
+
+static unsigned int num_failures = 0U;
+
+static void check(bool condition, const char *what, unsigned int iteration)
+{
+    if(!condition) {
+        std::fprintf(stderr, "packet_buffer: iteration %u: %s\n", iteration, what);
+        num_failures += 1U;
+    }
+}
+
+// Varints are most interesting around the 7-bit
+// boundaries, so values are picked by their bit length
+static std::uint64_t make_value(std::mt19937_64 &rng)
+{
+    const unsigned int length = static_cast<unsigned int>(rng() % 65U);
+    return (length == 64U) ? rng() : (rng() & ((UINT64_C(1) << length) - 1U));
+}
+
+static Field make_field(std::mt19937_64 &rng)
+{
+    Field field = {};
+    field.type = static_cast<FieldType>(rng() % static_cast<std::uint64_t>(FieldType::Count));
+    field.value = make_value(rng);
+
+    switch(field.type) {
+        case FieldType::Bits:
+            field.count = 1U + static_cast<unsigned int>(rng() % 32U);
+            field.value &= (UINT64_C(1) << field.count) - 1U;
+            break;
+        case FieldType::String:
+            field.string.resize(static_cast<std::size_t>(rng() % 300U));
+            for(char &c : field.string)
+                c = static_cast<char>(rng());
+            break;
+        default:
+            break;
+    }
+
+    return field;
+}
+
+static void write_field(PacketBuffer &buffer, const Field &field)
+{
+    switch(field.type) {
+        case FieldType::Bits:
+            PacketBuffer::write_bits(buffer, static_cast<std::uint32_t>(field.value), field.count);
+            break;
+        case FieldType::UI8:
+            PacketBuffer::write_UI8(buffer, static_cast<std::uint8_t>(field.value));
+            break;
+        case FieldType::UI16:
+            PacketBuffer::write_UI16(buffer, static_cast<std::uint16_t>(field.value));
+            break;
+        case FieldType::UI32:
+            PacketBuffer::write_UI32(buffer, static_cast<std::uint32_t>(field.value));
+            break;
+        case FieldType::UI64:
+            PacketBuffer::write_UI64(buffer, field.value);
+            break;
+        case FieldType::VUI64:
+            PacketBuffer::write_VUI64(buffer, field.value);
+            break;
+        case FieldType::VI64:
+            PacketBuffer::write_VI64(buffer, static_cast<std::int64_t>(field.value));
+            break;
+        case FieldType::FP32:
+            PacketBuffer::write_FP32(buffer, static_cast<float>(field.value));
+            break;
+        case FieldType::String:
+            PacketBuffer::write_string(buffer, field.string);
+            break;
+        default:
+            break;
+    }
+}
+
+static bool read_field(PacketBuffer &buffer, const Field &field)
+{
+    switch(field.type) {
+        case FieldType::Bits:
+            return PacketBuffer::read_bits(buffer, field.count) == field.value;
+        case FieldType::UI8:
+            return PacketBuffer::read_UI8(buffer) == static_cast<std::uint8_t>(field.value);
+        case FieldType::UI16:
+            return PacketBuffer::read_UI16(buffer) == static_cast<std::uint16_t>(field.value);
+        case FieldType::UI32:
+            return PacketBuffer::read_UI32(buffer) == static_cast<std::uint32_t>(field.value);
+        case FieldType::UI64:
+            return PacketBuffer::read_UI64(buffer) == field.value;
+        case FieldType::VUI64:
+            return PacketBuffer::read_VUI64(buffer) == field.value;
+        case FieldType::VI64:
+            return PacketBuffer::read_VI64(buffer) == static_cast<std::int64_t>(field.value);
+        case FieldType::FP32:
+            return PacketBuffer::read_FP32(buffer) == static_cast<float>(field.value);
+        case FieldType::String:
+            return PacketBuffer::read_string(buffer) == field.string;
+        default:
+            return false;
+    }
+}
+
+// Any mix of fields must read back the way it was written;
+// bits share bytes with each other but never with anything
+// else, since any byte-level access starts a fresh byte
+static void test_round_trip(std::mt19937_64 &rng, unsigned int iteration)
+{
+    std::vector<Field> fields = {};
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer);
+
+    const std::size_t num_fields = 1U + static_cast<std::size_t>(rng() % 64U);
+    for(std::size_t i = 0; i < num_fields; ++i) {
+        fields.push_back(make_field(rng));
+        write_field(buffer, fields.back());
+    }
+
+    PacketBuffer input = {};
+    PacketBuffer::setup(input, buffer.vector.data(), buffer.vector.size());
+
+    for(const Field &field : fields) {
+        if(!read_field(input, field)) {
+            check(false, "field doesn't match", iteration);
+            return;
+        }
+    }
+
+    check(input.read_position == input.vector.size(), "fields don't add up to the buffer size", iteration);
+}
+
+// Bits written right after a byte-level field go to
+// a new byte even if the previous bit byte has room left
+static void test_fresh_byte(void)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer);
+    PacketBuffer::write_bits(buffer, 1U, 1U);
+    PacketBuffer::write_UI8(buffer, 0xAA);
+    PacketBuffer::write_bits(buffer, 1U, 1U);
+    PacketBuffer::write_bits(buffer, 1U, 1U);
+
+    const std::vector<std::uint8_t> expected = { 0x80, 0xAA, 0xC0 };
+    check(buffer.vector == expected, "bits after a byte-level field share a byte", 0U);
+}
+
+static void setup_bytes(PacketBuffer &buffer, const std::vector<std::uint8_t> &bytes)
+{
+    PacketBuffer::setup(buffer, bytes.data(), bytes.size());
+}
+
+static void test_truncated(void)
+{
+    PacketBuffer buffer = {};
+
+    // A varint that ends in the middle
+    setup_bytes(buffer, { 0xFF, 0x80 });
+    check(PacketBuffer::read_VUI64(buffer) == UINT64_C(0x7F), "truncated varint", 0U);
+    check(buffer.read_position > buffer.vector.size(), "truncated varint isn't past the end", 0U);
+    check(PacketBuffer::read_UI8(buffer) == 0U, "read past the end isn't zero", 0U);
+
+    // Ten bytes at most, whatever follows
+    std::vector<std::uint8_t> overlong(16, 0xFF);
+    setup_bytes(buffer, overlong);
+    check(PacketBuffer::read_VUI64(buffer) == UINT64_MAX, "overlong varint", 0U);
+    check(buffer.read_position == 10U, "overlong varint isn't cut at ten bytes", 0U);
+
+    // A string claiming more than there is
+    setup_bytes(buffer, { 0x10, 'a', 'b', 'c' });
+    check(PacketBuffer::read_string(buffer) == "abc", "string longer than the buffer", 0U);
+    check(buffer.read_position > buffer.vector.size(), "long string isn't past the end", 0U);
+
+    // A string with a ridiculous size
+    setup_bytes(buffer, { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 'x' });
+    check(PacketBuffer::read_string(buffer) == "x", "string with a huge size", 0U);
+
+    // A string whose size is cut off
+    setup_bytes(buffer, { 0x80 });
+    check(PacketBuffer::read_string(buffer).empty(), "string with a truncated size", 0U);
+
+    // Bits past the end read as zeroes
+    setup_bytes(buffer, { 0xFF });
+    check(PacketBuffer::read_bits(buffer, 12U) == 0xFF0U, "bits past the end", 0U);
+}
+
+static void test_long_string(void)
+{
+    PacketBuffer buffer = {};
+    PacketBuffer::setup(buffer);
+    PacketBuffer::write_string(buffer, std::string(70000, 'x'));
+
+    PacketBuffer input = {};
+    PacketBuffer::setup(input, buffer.vector.data(), buffer.vector.size());
+    check(PacketBuffer::read_string(input).size() == UINT16_MAX, "long string isn't cut off", 0U);
+}
+
+int main(void)
+{
+    std::mt19937_64 rng(UINT64_C(0x566F78656C697573));
+
+    for(unsigned int i = 0U; i < 10000U; ++i)
+        test_round_trip(rng, i);
+
+    test_fresh_byte();
+    test_truncated();
+    test_long_string();
+
+    if(num_failures) {
+        std::fprintf(stderr, "packet_buffer: %u checks failed\n", num_failures);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: Zlib
+// Copyright (C) 2024, Voxelius Contributors
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <game/server/globals.hh>
+#include <game/server/sessions.hh>
+#include <spdlog/fmt/fmt.h>
+#include <vector>
+
+// Logins and disconnects are not supposed to get any
+// slower as the server fills up; the time it takes with
+// a full server is allowed to be a few times that with an
+// almost empty one to keep the test from being flaky
+constexpr static double MAX_SLOWDOWN = 8.0;
+constexpr static unsigned int NUM_ROUNDS = 5U;
+constexpr static unsigned int NUM_CYCLES = 20000U;
+
+static unsigned int num_failures = 0U;
+
+static void check(bool condition, const char *what, unsigned int num_sessions)
+{
+    if(!condition) {
+        std::fprintf(stderr, "sessions: %u sessions: %s\n", num_sessions, what);
+        num_failures += 1U;
+    }
+}
+
+// Fills every slot but one and measures how long a login
+// followed by a disconnect takes in the remaining slot
+static double measure(unsigned int num_sessions)
+{
+    std::vector<ENetPeer> peers(num_sessions);
+
+    sessions::max_players = num_sessions;
+    sessions::init_late();
+
+    for(unsigned int i = 1U; i < num_sessions; ++i)
+        sessions::create(&peers[i], i, fmt::format("player{}", i));
+    check(sessions::get_connected().size() == num_sessions - 1U, "not every session was created", num_sessions);
+
+    double best_ns = 1.0e30;
+
+    for(unsigned int round = 0U; round < NUM_ROUNDS; ++round) {
+        const auto start = std::chrono::steady_clock::now();
+
+        for(unsigned int i = 0U; i < NUM_CYCLES; ++i)
+            sessions::destroy(sessions::create(&peers[0], UINT64_C(0), "player"));
+
+        const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        best_ns = std::min(best_ns, static_cast<double>(duration.count()) / static_cast<double>(NUM_CYCLES));
+    }
+
+    check(sessions::get_connected().size() == num_sessions - 1U, "sessions leaked or lost", num_sessions);
+    check(sessions::find(&peers[0]) == nullptr, "destroyed session is still attached to its peer", num_sessions);
+    check(sessions::find(static_cast<std::uint64_t>(num_sessions - 1U)) == sessions::find(&peers[num_sessions - 1U]), "player_uid lookup", num_sessions);
+    check(sessions::find(fmt::format("player{}", num_sessions / 2U)) == sessions::find(&peers[num_sessions / 2U]), "username lookup", num_sessions);
+
+    for(unsigned int i = 1U; i < num_sessions; ++i)
+        sessions::destroy(sessions::find(&peers[i]));
+    check(sessions::get_connected().empty(), "sessions left after everyone left", num_sessions);
+    check(sessions::num_players == 0U, "player count after everyone left", num_sessions);
+
+    sessions::deinit();
+
+    std::printf("sessions: %u sessions: %.3f us per login and disconnect\n", num_sessions, best_ns / 1000.0);
+    return best_ns;
+}
+
+static void test_usernames(void)
+{
+    std::vector<ENetPeer> peers(3);
+
+    sessions::max_players = 3U;
+    sessions::init_late();
+
+    Session *first = sessions::create(&peers[0], UINT64_C(1), "player");
+    Session *second = sessions::create(&peers[1], UINT64_C(2), "player");
+    Session *third = sessions::create(&peers[2], UINT64_C(3), "player");
+    check(first && (first->username == "player"), "first username", 3U);
+    check(second && (second->username == "player(1)"), "duplicate username", 3U);
+    check(third && (third->username == "player(2)"), "second duplicate username", 3U);
+    check(sessions::create(&peers[0], UINT64_C(4), "player") == nullptr, "session created with no free slots", 3U);
+
+    // Lowest free identifiers are handed out first
+    sessions::destroy(second);
+    Session *fourth = sessions::create(&peers[1], UINT64_C(4), "player");
+    check(fourth && (fourth->session_id == 1U) && (fourth->username == "player(1)"), "slot reuse", 3U);
+
+    sessions::deinit();
+}
+
+int main(void)
+{
+    globals::tickrate = 30U;
+    globals::tickrate_dt = 1000000U / globals::tickrate;
+
+    test_usernames();
+
+    const double base_ns = measure(16U);
+
+    for(const unsigned int num_sessions : { 256U, 1024U, 4096U, 10000U }) {
+        const double ns = measure(num_sessions);
+        check(ns <= MAX_SLOWDOWN * base_ns, "logins and disconnects got slower", num_sessions);
+    }
+
+    if(num_failures) {
+        std::fprintf(stderr, "sessions: %u checks failed\n", num_failures);
+        return 1;
+    }
+
+    return 0;
+}